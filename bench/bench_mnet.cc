@@ -0,0 +1,226 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Receive throughput and CPU cost of the recvmmsg and io_uring backends.
+// A second thread floods 224.0.0.251:5353 over the loopback interface
+// while the reactor drains the socket with one backend and then the
+// other. Last, the same flood from several sources is spread over SO_REUSEPORT
+// receive workers. Run as: bench_mnet [seconds per backend] [workers]
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mnet.h"
+#include "mnet_uring.h"
+#include "reactor.h"
+#include "receive_workers.h"
+
+/* A query for _googlecast._tcp.local PTR, as a Chromecast sender sends */
+static const char kQuery[] =
+    "\x00\x00\x00\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+    "\x0b_googlecast\x04_tcp\x05local\x00"
+    "\x00\x0c\x00\x01";
+
+static const std::size_t kSendBatch = 32;
+
+static std::uint64_t ThreadCpuNs()
+{
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  return (std::uint64_t(ru.ru_utime.tv_sec) + ru.ru_stime.tv_sec) *
+             1000000000 +
+         (std::uint64_t(ru.ru_utime.tv_usec) + ru.ru_stime.tv_usec) * 1000;
+}
+
+static struct sockaddr_in MdnsGroup()
+{
+  struct sockaddr_in dst;
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(5353);
+  dst.sin_addr.s_addr = htonl(0xe00000fb);
+  return dst;
+}
+
+// Send from 127.0.0.host until stop is set, kSendBatch datagrams per
+// sendmmsg
+static void Flood(const std::atomic<bool>& stop, std::uint8_t host)
+{
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  struct sockaddr_in src;
+  struct sockaddr_in dst = MdnsGroup();
+  struct iovec iov{const_cast<char*>(kQuery), sizeof(kQuery) - 1};
+  struct mmsghdr msgs[kSendBatch];
+
+  memset(&src, 0, sizeof(src));
+  src.sin_family = AF_INET;
+  src.sin_addr.s_addr = htonl(0x7f000000 | host);
+  bind(fd, reinterpret_cast<struct sockaddr*>(&src), sizeof(src));
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo));
+  memset(msgs, 0, sizeof(msgs));
+  for (struct mmsghdr& m : msgs) {
+    m.msg_hdr.msg_name = &dst;
+    m.msg_hdr.msg_namelen = sizeof(dst);
+    m.msg_hdr.msg_iov = &iov;
+    m.msg_hdr.msg_iovlen = 1;
+  }
+  while (!stop.load(std::memory_order_relaxed)) {
+    sendmmsg(fd, msgs, kSendBatch, 0);
+  }
+  close(fd);
+}
+
+struct Result {
+  std::uint64_t mPackets = 0;
+  std::uint64_t mBatches = 0;
+  std::uint64_t mWallNs = 0;
+  std::uint64_t mCpuNs = 0;
+};
+
+static void Report(const char* name, const Result& r)
+{
+  const double secs = r.mWallNs / 1e9;
+  printf("%-8s %10.0f pkts/s  %5.1f%% cpu  %6.0f ns/pkt  "
+         "%5.1f pkts/batch\n",
+         name, r.mPackets / secs, 100.0 * r.mCpuNs / r.mWallNs,
+         r.mPackets ? double(r.mCpuNs) / r.mPackets : 0.0,
+         r.mBatches ? double(r.mPackets) / r.mBatches : 0.0);
+}
+
+// Run the reactor for ms milliseconds, counting what the handler sees
+static bool Measure(mnet::Reactor& reactor, std::uint64_t ms, Result& r,
+                    std::string& errmsg)
+{
+  reactor.AddTimer(ms, [&reactor]() { reactor.Stop(); });
+  const std::uint64_t wall = mnet::Reactor::Now();
+  const std::uint64_t cpu = ThreadCpuNs();
+  if (!reactor.Run(errmsg)) {
+    return false;
+  }
+  r.mWallNs = mnet::Reactor::Now() - wall;
+  r.mCpuNs = ThreadCpuNs() - cpu;
+  return true;
+}
+
+static bool JoinLoopback(mnet::MNet& net, std::string& errmsg)
+{
+  return net.AddMulticastMembership(if_nametoindex("lo"), errmsg);
+}
+
+// count workers against one flood per worker, each from its own source.
+// Sources may hash to the same worker, as they would on a real network.
+static void MeasureWorkers(std::size_t count, std::uint64_t ms)
+{
+  std::string errmsg;
+  mnet::ReceiveWorkers workers;
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> senders;
+
+  if (!workers.Start(AF_INET, count, true, nullptr, errmsg, JoinLoopback)) {
+    printf("workers: %s\n", errmsg.c_str());
+    return;
+  }
+  for (std::size_t i = 0; i < count; i++) {
+    senders.emplace_back(Flood, std::cref(stop), std::uint8_t(i + 1));
+  }
+  const std::uint64_t wall = mnet::Reactor::Now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  const double secs = (mnet::Reactor::Now() - wall) / 1e9;
+  stop = true;
+  for (std::thread& t : senders) {
+    t.join();
+  }
+  std::uint64_t total = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    printf("worker %zu %10.0f pkts/s\n", i, workers.GetPackets(i) / secs);
+    total += workers.GetPackets(i);
+  }
+  printf("%zu workers %10.0f pkts/s\n", count, total / secs);
+}
+
+int main(int argc, char** argv)
+{
+  std::string errmsg;
+  const std::uint64_t ms = argc > 1 ? std::atoi(argv[1]) * 1000 : 3000;
+  const int workers = argc > 2 ? std::atoi(argv[2]) : 4;
+  mnet::MNet net;
+  mnet::BufferPool pool;
+  mnet::MNetBatch batch(pool);
+  std::atomic<bool> stop{false};
+
+  if (!net.CreateSocket(errmsg) ||
+      !net.AddMulticastMembership(if_nametoindex("lo"), errmsg)) {
+    printf("Setting up the socket failed: %s\n", errmsg.c_str());
+    return -1;
+  }
+  std::thread sender(Flood, std::cref(stop), std::uint8_t(1));
+
+  Result r;
+  auto count = [&r](const mnet::MNetBatch& b) {
+    r.mPackets += b.GetCount();
+    r.mBatches++;
+  };
+  {
+    mnet::Reactor reactor;
+    if (!reactor.Open(errmsg) ||
+        !reactor.AddSocket(net, batch, count, errmsg) ||
+        !Measure(reactor, ms, r, errmsg)) {
+      printf("epoll: %s\n", errmsg.c_str());
+    } else {
+      Report("epoll", r);
+    }
+  }
+
+  r = Result();
+  {
+    mnet::Reactor reactor;
+    mnet::MNetUring ring;
+    if (!ring.Open(net, pool, errmsg, mnet::BufferPool::CLASS_STANDARD)) {
+      printf("io_uring: unavailable: %s\n", errmsg.c_str());
+    } else if (!reactor.Open(errmsg) ||
+               !reactor.AddRing(ring, batch, count, errmsg) ||
+               !Measure(reactor, ms, r, errmsg)) {
+      printf("io_uring: %s\n", errmsg.c_str());
+    } else {
+      Report("io_uring", r);
+      printf("io_uring made %zu io_uring_enter calls\n",
+             ring.GetEnterCalls());
+    }
+  }
+
+  stop = true;
+  sender.join();
+  net.Close();
+
+  if (workers > 0) {
+    MeasureWorkers(workers, ms);
+  }
+  return 0;
+}
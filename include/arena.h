@@ -0,0 +1,103 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+
+namespace arena {
+
+// A bump allocator for objects that share one lifetime, such as
+// everything parsed out of a single packet. Allocations are never freed
+// individually, Reset() releases all of them at once. Destructors are not
+// run, so only trivially destructible state should be left in the arena.
+//
+// After Reset() the arena keeps one block large enough for everything
+// allocated since the previous reset, so a steady stream of similar
+// packets does not touch malloc.
+class Arena {
+  struct alignas(std::max_align_t) Block {
+    Block* mNext;
+    std::size_t mSize;
+  };
+
+  Block* mHead = nullptr;
+  std::size_t mUsed = 0;
+  std::size_t mAllocated = 0;
+  const std::size_t mBlockSize;
+
+  Block* AllocateBlock(std::size_t size);
+  void Release();
+  void* Data(Block* b) const { return b + 1; }
+
+public:
+  explicit Arena(std::size_t block_size = 4096) : mBlockSize(block_size) {}
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena();
+
+  // Throws std::bad_alloc when allocation fails
+  void* Allocate(std::size_t n,
+                 std::size_t align = alignof(std::max_align_t));
+  // Every pointer handed out since the last Reset() is invalidated
+  void Reset();
+  // Total bytes requested since the last Reset(), including padding
+  std::size_t GetAllocated() const { return mAllocated; }
+};
+
+// Standard allocator over an Arena, for containers whose elements live
+// only as long as the arena does. Without an arena it uses the heap.
+template <typename T>
+class ArenaAllocator {
+  template <typename U> friend class ArenaAllocator;
+  Arena* mArena;
+
+public:
+  using value_type = T;
+
+  explicit ArenaAllocator(Arena* a = nullptr) : mArena(a) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& o) : mArena(o.mArena) {}
+
+  T* allocate(std::size_t n) {
+    if (mArena == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(mArena->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* p, std::size_t) {
+    if (mArena == nullptr) {
+      ::operator delete(p);
+    }
+  }
+  Arena* GetArena() const { return mArena; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& o) const {
+    return mArena == o.mArena;
+  }
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& o) const {
+    return mArena != o.mArena;
+  }
+};
+
+} // namespace arena
+
+#endif // ARENA_H
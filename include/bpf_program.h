@@ -0,0 +1,105 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BPF_PROGRAM_H
+#define BPF_PROGRAM_H
+
+#include <linux/filter.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mnet {
+
+// A classic BPF program, built one instruction at a time and handed to
+// setsockopt() as a sock_fprog. Programs run on received UDP datagrams,
+// where offsets from SKF_NET_OFF reach the IP header.
+class BpfProgram {
+  std::vector<struct sock_filter> mInsns;
+
+public:
+  // The index of the next instruction, for computing jump offsets
+  std::size_t GetLength() const { return mInsns.size(); }
+  const struct sock_filter& operator[](std::size_t i) const {
+    return mInsns[i];
+  }
+
+  void Stmt(std::uint16_t code, std::uint32_t k) {
+    mInsns.push_back(BPF_STMT(code, k));
+  }
+  // Returns the index of the jump, for SetJumpTarget()
+  std::size_t Jump(std::uint16_t code, std::uint32_t k, std::uint8_t jt,
+                   std::uint8_t jf) {
+    mInsns.push_back(BPF_JUMP(code, k, jt, jf));
+    return mInsns.size() - 1;
+  }
+  // Point a branch of the jump at insn to target, which is further on.
+  // For jumps emitted before their target is.
+  void SetJumpTarget(std::size_t insn, bool taken, std::size_t target) {
+    const std::uint8_t offset = target - insn - 1;
+    if (taken) {
+      mInsns[insn].jt = offset;
+    } else {
+      mInsns[insn].jf = offset;
+    }
+  }
+
+  // Valid until the program is changed
+  struct sock_fprog GetProg() const {
+    return {static_cast<unsigned short>(mInsns.size()),
+            const_cast<struct sock_filter*>(mInsns.data())};
+  }
+};
+
+// Leave a hash of the source address of the datagram in A, reduced to
+// [0, shards). The same source always hashes to the same shard.
+// family: AF_INET or AF_INET6, the family of the socket it runs on
+void EmitSourceShard(BpfProgram& prog, int family, std::uint32_t shards);
+
+// For SO_ATTACH_REUSEPORT_CBPF: returns the index of the socket in the
+// reuseport group that receives a unicast datagram, by source
+BpfProgram ReuseportSteeringProgram(int family, std::uint32_t shards);
+
+// Which received mDNS messages a socket keeps. Everything else is
+// dropped in the kernel, before it wakes us or is copied.
+struct MdnsSocketFilter {
+  enum eRole : std::uint8_t {
+    /* Queries and responses */
+    ROLE_ANY = 0,
+    /* Queries only (QR = 0), the messages a responder answers */
+    ROLE_RESPONDER,
+    /* Responses only (QR = 1), the messages a querier waits for */
+    ROLE_QUERIER,
+  };
+
+  eRole mRole = ROLE_ANY;
+  /* Drop messages with a non-zero OPCODE or RCODE, which RFC 6762
+     sections 18.3 and 18.11 tell us to ignore */
+  bool mStandardOnly = true;
+};
+
+// For SO_ATTACH_FILTER: accepts the messages filter keeps. With more than
+// one shard, it also drops the datagrams whose source does not hash to
+// shard; multicast is copied to every socket of a reuseport group, so
+// this is what splits it between them.
+BpfProgram MdnsFilterProgram(int family, const MdnsSocketFilter& filter,
+                             std::uint32_t shards = 1,
+                             std::uint32_t shard = 0);
+
+} // namespace mnet
+#endif // BPF_PROGRAM_H
@@ -0,0 +1,139 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mnet {
+
+class BufferPool;
+
+// A reference counted handle to a pooled buffer. Copying a handle shares
+// the buffer, the last handle to go away returns it to its pool.
+class Buffer {
+  friend class BufferPool;
+
+  struct Block {
+    BufferPool* mPool;
+    Block* mNext;
+    std::size_t mLength;
+    std::uint32_t mRefs;
+    std::uint8_t mClass;
+  };
+
+  Block* mBlock = nullptr;
+
+  explicit Buffer(Block* b) : mBlock(b) {}
+  void Release();
+  static char* Data(Block* b) {
+    return reinterpret_cast<char*>(b) + kHeaderSize;
+  }
+
+public:
+  /* Keeps the data aligned for any fundamental type */
+  static constexpr std::size_t kHeaderSize =
+      (sizeof(Block) + alignof(std::max_align_t) - 1) &
+      ~(alignof(std::max_align_t) - 1);
+
+  Buffer() = default;
+  Buffer(const Buffer& o) : mBlock(o.mBlock) {
+    if (mBlock != nullptr) {
+      mBlock->mRefs++;
+    }
+  }
+  Buffer(Buffer&& o) : mBlock(o.mBlock) { o.mBlock = nullptr; }
+  Buffer& operator=(const Buffer& o);
+  Buffer& operator=(Buffer&& o);
+  ~Buffer() { Release(); }
+
+  bool IsEmpty() const { return mBlock == nullptr; }
+  // Only the holder of the sole handle may write to the buffer
+  bool IsShared() const { return mBlock != nullptr && mBlock->mRefs > 1; }
+  char* GetData() const {
+    return mBlock == nullptr ? nullptr : Data(mBlock);
+  }
+  std::size_t GetCapacity() const;
+  // The number of octets in use, set by whoever filled the buffer
+  std::size_t GetLength() const {
+    return mBlock == nullptr ? 0 : mBlock->mLength;
+  }
+  void SetLength(std::size_t len) { mBlock->mLength = len; }
+  void Reset() { Release(); }
+};
+
+// Fixed size receive buffers. Buffers come in a few size classes and a
+// released buffer goes back on the free list of its class, so once the
+// pool has grown to the number of packets in flight, receiving does not
+// touch malloc. Not thread safe, every thread receiving packets keeps a
+// pool of its own. The pool MUST outlive every Buffer taken from it.
+class BufferPool {
+public:
+  enum eSizeClass : std::uint8_t {
+    /* RFC 1035:
+         Messages carried by UDP are restricted to 512 bytes (not
+         counting the IP or UDP headers).
+    */
+    CLASS_SMALL = 0,
+    /* An Ethernet MTU without the IPv4 and UDP headers */
+    CLASS_STANDARD,
+    /* RFC 6762 17:
+         Even when fragmentation is used, a Multicast DNS packet,
+         including IP and UDP headers, MUST NOT exceed 9000 bytes.
+    */
+    CLASS_JUMBO,
+    CLASS_COUNT,
+  };
+
+  static constexpr std::size_t kClassSizes[CLASS_COUNT] = {
+    512, 1500 - 20 - 8, 9000 - 20 - 8,
+  };
+
+private:
+  Buffer::Block* mFree[CLASS_COUNT] = {};
+  std::size_t mAllocated[CLASS_COUNT] = {};
+  std::size_t mInUse[CLASS_COUNT] = {};
+
+  friend class Buffer;
+  Buffer::Block* Allocate(eSizeClass c);
+  void Return(Buffer::Block* b);
+
+public:
+  BufferPool() = default;
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+  ~BufferPool();
+
+  // The smallest class that holds size octets. Returns false if size is
+  // larger than any class.
+  static bool ClassFor(std::size_t size, eSizeClass& c);
+  // Throws std::bad_alloc when allocation fails
+  Buffer Acquire(eSizeClass c);
+  // An empty handle if size is larger than any class
+  Buffer Acquire(std::size_t size);
+  // Allocate n buffers of class c up front
+  void Reserve(eSizeClass c, std::size_t n);
+  // Buffers of class c ever allocated, and those handed out right now
+  std::size_t GetAllocated(eSizeClass c) const { return mAllocated[c]; }
+  std::size_t GetInUse(eSizeClass c) const { return mInUse[c]; }
+};
+
+} // namespace mnet
+
+#endif // BUFFER_POOL_H
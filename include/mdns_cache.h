@@ -0,0 +1,164 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_CACHE_H
+#define MDNS_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gsl/span>
+
+#include "mdns_message.h"
+#include "timer_wheel.h"
+
+namespace dns_message {
+
+// The records other hosts announced, kept past the message they came in
+// so a lookup can be answered without asking the network again. Records
+// are found by (name, type, class) with one hash probe, names compare
+// without case, and each expires when its TTL runs out on a timing wheel
+// rather than by scanning the cache.
+//
+// Times are milliseconds on any monotonic clock, such as Reactor::Now()
+// divided down, given by the caller so the cache never reads a clock.
+class DNSRecordCache {
+public:
+  /* A goodbye (TTL zero, RFC 6762 10.1) and a cache-flush record (10.2)
+     do not remove records at once: they are kept for one more second,
+     so the rest of an announcement that is split over packets, or a
+     goodbye that crossed a refresh, does not flap the cache. */
+  static constexpr std::uint64_t kFlushDelayMs = 1000;
+  static constexpr std::size_t kDefaultMaxRecords = 4096;
+  /* A 1500 byte Ethernet MTU less the IPv6 and UDP headers, which also
+     fits IPv4 */
+  static constexpr std::size_t kDefaultQueryMTU = 1500 - 40 - 8;
+
+  struct Record {
+    /* Uncompressed wire format, in the case it was received in */
+    std::string mName;
+    /* Names in it are uncompressed. SRV RDATA is priority, weight and
+       port followed by the target, the same as DNSResponseCache takes. */
+    std::string mRData;
+    std::uint16_t mType;
+    /* Without the cache-flush bit */
+    std::uint16_t mRRClass;
+    /* As received, and when */
+    std::uint32_t mTTL;
+    std::uint64_t mReceivedMs;
+    std::uint64_t mExpiresMs;
+  };
+
+  struct Question {
+    /* Uncompressed wire format */
+    gsl::span<const char> mName;
+    std::uint16_t mType;
+    /* The unicast-response bit is ignored for the lookup */
+    std::uint16_t mRRClass;
+  };
+
+private:
+  using Id = timer_wheel::TimerWheel::Id;
+  static constexpr Id kNone = UINT32_MAX;
+
+  struct Entry {
+    Record mRecord;
+    std::uint64_t mHash;
+    /* The next entry of the same hash bucket, or of the free list */
+    Id mNext;
+  };
+
+  std::vector<Entry> mEntries;
+  Id mFree = kNone;
+  std::size_t mCount = 0;
+  const std::size_t mMaxRecords;
+  /* Hash of the lower case name, type and class, to the first entry of
+     its chain */
+  std::unordered_map<std::uint64_t, Id> mBuckets;
+  timer_wheel::TimerWheel mWheel;
+  std::vector<Id> mExpired;
+  std::uint64_t mRefused = 0;
+
+  Id Find(std::uint64_t hash, gsl::span<const char> name,
+          std::uint16_t type, std::uint16_t rrclass,
+          gsl::span<const char> rdata) const;
+  void Remove(Id id);
+
+public:
+  explicit DNSRecordCache(std::uint64_t now_ms,
+                          std::size_t max_records = kDefaultMaxRecords);
+  DNSRecordCache(const DNSRecordCache&) = delete;
+  DNSRecordCache& operator=(const DNSRecordCache&) = delete;
+
+  // Learn one record received at now_ms, following the TTL zero and
+  // cache-flush rules. Returns false if it could not be decoded, or the
+  // cache is full of other records.
+  bool Add(const DNSRR& rr, std::uint64_t now_ms);
+  // Learn every answer and additional of a response. Returns the number
+  // learned.
+  std::size_t AddResponse(const DNSMessage& msg, std::uint64_t now_ms);
+
+  // Find the live records of (name, type, rrclass), name uncompressed
+  // wire format. Up to max are stored in out, the return value is how
+  // many there are. They stay valid until the cache next changes.
+  std::size_t Lookup(gsl::span<const char> name, std::uint16_t type,
+                     std::uint16_t rrclass, std::uint64_t now_ms,
+                     const Record** out, std::size_t max) const;
+  std::size_t Lookup(const DNSName& name, std::uint16_t type,
+                     std::uint16_t rrclass, std::uint64_t now_ms,
+                     const Record** out, std::size_t max) const;
+  // Write a query for count questions, with the cached answers to them
+  // as known answers (RFC 6762 7.1). Only answers with more than half
+  // their TTL left are listed, with the TTL they have left. When they do
+  // not fit in mtu bytes the rest follow in more packets, each but the
+  // last with TC set (7.2). The packets are appended to packets, returns
+  // how many; zero if the questions alone do not fit. QTYPE ANY lists no
+  // known answers.
+  std::size_t WriteQuery(const Question* questions, std::size_t count,
+                         std::uint64_t now_ms, std::size_t mtu,
+                         std::vector<std::vector<char>>& packets) const;
+
+  // Seconds left, rounded down, zero once expired
+  static std::uint32_t GetRemainingTTL(const Record& r,
+                                       std::uint64_t now_ms);
+
+  // Drop the records that expired by now_ms, returns how many
+  std::size_t Expire(std::uint64_t now_ms);
+  // When Expire() next has something to do, zero if the cache is empty
+  std::uint64_t GetNextExpiry() const { return mWheel.GetNextDeadline(); }
+  std::size_t GetCount() const { return mCount; }
+  // Records not learned because the cache was full
+  std::uint64_t GetRefused() const { return mRefused; }
+
+  // Decode the RDATA of rr into the uncompressed form Record keeps.
+  // False for a type that may carry a name DNSRData does not decode.
+  static bool CanonicalRData(const DNSRR& rr, std::string& out);
+  // The hash records are found by, of the name without case, the type
+  // and the class without the cache-flush bit. DNSResponseCache indexes
+  // its own records with it.
+  static std::uint64_t HashKey(gsl::span<const char> name,
+                               std::uint16_t type, std::uint16_t rrclass);
+  // Wire format names compare without case
+  static bool NameEqual(gsl::span<const char> a, gsl::span<const char> b);
+};
+
+} // namespace dns_message
+
+#endif // MDNS_CACHE_H
@@ -0,0 +1,125 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_DUPLICATES_H
+#define MDNS_DUPLICATES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+
+#include <gsl/span>
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+// What other hosts just multicast on the link, so we need not say it
+// again.
+//
+// RFC 6762 7.3: a querier about to ask a question another host just
+// asked can wait for the answers to that query instead.
+// RFC 6762 7.4: a responder about to send an answer another responder
+// just sent, with a TTL no lower than ours, can leave it out.
+//
+// Questions are keyed by a hash of their name, type and class, answers
+// by that hash and a digest of their RDATA, each with DNSRecordCache's
+// hash. Only the 64 bit keys are kept, so a collision could suppress a
+// send that was needed: that risk is taken for a fixed size entry. Every
+// entry lives kHoldMs, so they expire in the order they were seen and a
+// FIFO of them is the whole expiry schedule.
+//
+// Times are milliseconds on the caller's monotonic clock.
+class DNSDuplicateSuppressor {
+public:
+  /* As long as a query or response can be waiting to be sent: the 500
+     ms a response may be aggregated for, with room for a querier's own
+     jitter */
+  static constexpr std::uint64_t kHoldMs = 1000;
+  static constexpr std::size_t kDefaultMaxEntries = 1024;
+
+private:
+  struct Seen {
+    std::uint64_t mExpiresMs;
+    /* The TTL of an answer, unused for a question */
+    std::uint32_t mTTL;
+  };
+
+  class Table {
+    std::unordered_map<std::uint64_t, Seen> mSeen;
+    /* Keys in the order they were seen, with when they expire. A key
+       seen again is in it twice, and only its last entry removes it. */
+    std::deque<std::pair<std::uint64_t, std::uint64_t>> mOrder;
+
+  public:
+    void Insert(std::uint64_t key, std::uint32_t ttl, std::uint64_t now_ms,
+                std::size_t max);
+    const Seen* Find(std::uint64_t key, std::uint64_t now_ms) const;
+    void Expire(std::uint64_t now_ms);
+    std::size_t GetCount() const { return mSeen.size(); }
+  };
+
+  Table mQuestions;
+  Table mAnswers;
+  const std::size_t mMaxEntries;
+  std::uint64_t mSuppressedQuestions = 0;
+  std::uint64_t mSuppressedAnswers = 0;
+
+public:
+  explicit DNSDuplicateSuppressor(
+      std::size_t max_entries = kDefaultMaxEntries)
+      : mMaxEntries(max_entries) {}
+  DNSDuplicateSuppressor(const DNSDuplicateSuppressor&) = delete;
+  DNSDuplicateSuppressor& operator=(const DNSDuplicateSuppressor&) = delete;
+
+  // Note the questions of a query another host sent. A question asking
+  // for a unicast response, or one with known answers we may not have,
+  // would not bring us the answers we want, and is not noted.
+  void ObserveQuery(const DNSMessage& msg, std::uint64_t now_ms);
+  // Note the answers and additionals of a response another host sent
+  void ObserveResponse(const DNSMessage& msg, std::uint64_t now_ms);
+
+  // True if our question, name in uncompressed wire format, was asked
+  // in the last kHoldMs and need not be sent. Counted when true.
+  bool SuppressQuestion(gsl::span<const char> name, std::uint16_t type,
+                        std::uint16_t rrclass, std::uint64_t now_ms);
+  // True if our answer was sent by another host in the last kHoldMs with
+  // a TTL of at least ttl. rdata is as DNSRecordCache::CanonicalRData()
+  // gives it. Counted when true.
+  bool SuppressAnswer(gsl::span<const char> name, std::uint16_t type,
+                      std::uint16_t rrclass, gsl::span<const char> rdata,
+                      std::uint32_t ttl, std::uint64_t now_ms);
+
+  // Drop what is older than kHoldMs. The Observe calls do it too.
+  void Expire(std::uint64_t now_ms);
+  std::size_t GetQuestionCount() const { return mQuestions.GetCount(); }
+  std::size_t GetAnswerCount() const { return mAnswers.GetCount(); }
+  std::uint64_t GetSuppressedQuestions() const {
+    return mSuppressedQuestions;
+  }
+  std::uint64_t GetSuppressedAnswers() const { return mSuppressedAnswers; }
+
+  // The key of an answer: the record's hash, extended over its RDATA
+  static std::uint64_t AnswerKey(gsl::span<const char> name,
+                                 std::uint16_t type, std::uint16_t rrclass,
+                                 gsl::span<const char> rdata);
+};
+
+} // namespace dns_message
+
+#endif // MDNS_DUPLICATES_H
@@ -0,0 +1,77 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_FILTER_H
+#define MDNS_FILTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dns_message {
+
+// Classifies raw received packets before any DNSMessage is built, so
+// traffic we are not interested in costs a few byte compares.
+class DNSPacketFilter {
+public:
+  enum eVerdict : std::uint8_t {
+    /* The packet should be parsed */
+    ACCEPT = 0,
+    /* Shorter than a header */
+    DROP_TOO_SHORT,
+    /* RFC 6762:
+         Multicast DNS messages received with an OPCODE other than
+         zero MUST be silently ignored.
+    */
+    DROP_OPCODE,
+    /* RFC 6762:
+         Multicast DNS messages received with non-zero Response Codes
+         MUST be silently ignored.
+    */
+    DROP_RCODE,
+    /* Neither a question nor an answer to look at */
+    DROP_NO_NAME,
+    /* The first name runs past the end of the packet or is compressed */
+    DROP_MALFORMED_NAME,
+    /* The first name is not one of ours, nor a subdomain of one */
+    DROP_NAME,
+    VERDICT_COUNT,
+  };
+
+private:
+  /* Uncompressed wire format names, including the root label */
+  std::vector<std::string> mNames;
+  std::uint64_t mCounters[VERDICT_COUNT] = {};
+
+  bool MatchName(const unsigned char* name, std::size_t len) const;
+
+public:
+  DNSPacketFilter() = default;
+  // name: an uncompressed wire format name such as
+  //       "\x0b_googlecast\x04_tcp\x05local\0". Packets are accepted when
+  //       their first name is this name or a subdomain of it. Without
+  //       any names only the header is checked.
+  bool AddName(const char* const name, std::size_t len);
+  eVerdict Classify(const char* const m, std::size_t mlen);
+  std::uint64_t GetCount(eVerdict v) const { return mCounters[v]; }
+  void ResetCounters();
+  static const char* VerdictName(eVerdict v);
+};
+
+} // namespace dns_message
+
+#endif // MDNS_FILTER_H
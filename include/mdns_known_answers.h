@@ -0,0 +1,140 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_KNOWN_ANSWERS_H
+#define MDNS_KNOWN_ANSWERS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mdns_message.h"
+#include "timer_wheel.h"
+
+namespace dns_message {
+
+/* RFC 6762 7.2:
+     A Multicast DNS responder seeing a Multicast DNS query with the TC
+     bit set defers its response for a time period randomly selected in
+     the interval 400-500 ms. This gives the Multicast DNS querier time
+     to send additional Known-Answer packets before the responder
+     responds. If the responder sees any of its answers listed in the
+     Known-Answer lists of subsequent packets from the querying host, it
+     MUST delete that answer from the list of answers it is planning to
+     give.
+
+   Holds each truncated query until its known answers are all in, one
+   pending query per source. The known answers are merged as the set of
+   our records they name, see DNSResponseCache::GetKnownAnswers(), so a
+   pending query costs its first packet and a mask however many packets
+   follow it. The table is bounded: once it is full, truncated queries
+   are answered at once, as if they had not been truncated.
+
+   Times are milliseconds on the caller's monotonic clock, as for
+   DNSRecordCache. */
+class DNSKnownAnswerAccumulator {
+public:
+  static constexpr std::uint64_t kMinDelayMs = 400;
+  static constexpr std::uint64_t kMaxDelayMs = 500;
+  static constexpr std::size_t kDefaultMaxPending = 64;
+
+  enum eAction : std::uint8_t {
+    /* Not truncated, or no room to hold it: answer it now */
+    ANSWER_NOW = 0,
+    /* A truncated query, held until Release() returns it */
+    HELD,
+    /* More known answers for a held query */
+    MERGED,
+    /* Known answers for no held query, nothing to answer */
+    IGNORED,
+  };
+
+  // A query Release() hands back, with all its known answers
+  struct Query {
+    struct sockaddr_storage mSrcAddr;
+    socklen_t mSrcAddrLen;
+    unsigned mIfIndex;
+    /* The packet with the questions */
+    std::vector<char> mMessage;
+    /* The union of the known answer sets of every packet */
+    std::uint64_t mKnown;
+    std::size_t mPackets;
+  };
+
+private:
+  using Id = timer_wheel::TimerWheel::Id;
+  static constexpr Id kNone = UINT32_MAX;
+
+  struct Entry {
+    Query mQuery;
+    /* The key of its source in mSources, or empty once a newer query
+       from the same source took it over */
+    std::string mSource;
+    Id mNextFree;
+  };
+
+  std::vector<Entry> mEntries;
+  Id mFree = kNone;
+  std::size_t mCount = 0;
+  const std::size_t mMaxPending;
+  /* Interface and source address, to the query still taking known
+     answers from that source */
+  std::unordered_map<std::string, Id> mSources;
+  timer_wheel::TimerWheel mWheel;
+  std::vector<Id> mExpired;
+  std::minstd_rand mRandom;
+  std::uint64_t mRefused = 0;
+
+  // The known answers of id are all in: stop merging into it, and
+  // release it on the next tick
+  void Close(Id id, std::uint64_t now_ms);
+
+public:
+  explicit DNSKnownAnswerAccumulator(
+      std::uint64_t now_ms, std::size_t max_pending = kDefaultMaxPending,
+      std::uint32_t seed = std::random_device()());
+  DNSKnownAnswerAccumulator(const DNSKnownAnswerAccumulator&) = delete;
+  DNSKnownAnswerAccumulator&
+  operator=(const DNSKnownAnswerAccumulator&) = delete;
+
+  // Take one query packet received at now_ms. known is the set of our
+  // records its answer section lists. A packet without TC ends the
+  // known answers of its source, which is then released on the next
+  // tick rather than after the full delay.
+  eAction Add(const DNSMessage& msg, const struct sockaddr* src,
+              socklen_t srclen, unsigned ifindex, std::uint64_t known,
+              std::uint64_t now_ms);
+
+  // Move the queries whose delay is over by now_ms to out, oldest
+  // first. Returns how many.
+  std::size_t Release(std::uint64_t now_ms, std::vector<Query>& out);
+  // When Release() next has something to do, zero if nothing is held
+  std::uint64_t GetNextDeadline() const { return mWheel.GetNextDeadline(); }
+  std::size_t GetCount() const { return mCount; }
+  // Truncated queries answered at once because the table was full
+  std::uint64_t GetRefused() const { return mRefused; }
+};
+
+} // namespace dns_message
+
+#endif // MDNS_KNOWN_ANSWERS_H
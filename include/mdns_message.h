@@ -17,22 +17,201 @@
 #ifndef MDNS_MESSAGE_H
 #define MDNS_MESSAGE_H
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
-// Needs C++14 support
-//#include <gsl/gsl>
+#include <gsl/span>
+
+#include "arena.h"
 
 namespace dns_message {
 
+class DNSName;
+class DNSNameMemo;
 class DNSHeader;
 class DNSQuestion;
 class DNSRR;
 class DNSRData;
-class DNSPtrRData;
+class DNSTxtIndex;
 class DNSMessage;
 
+/* RFC 6762 16:
+     Multicast DNS uses UTF-8 with the same case-insensitive matching
+     as unicast DNS, i.e. only ASCII letters are folded.
+*/
+// Every case-insensitive name and key comparison goes through this one,
+// length octets are below 64 so they pass through unchanged.
+inline unsigned char fold_case(unsigned char c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// A read cursor over a received message. Fields are decoded big-endian
+// from unsigned octets. Bounds are checked once per group of fixed size
+// fields with Has(), the unchecked reads that follow it cannot fail.
+class DNSWireReader {
+private:
+  const unsigned char* mData = nullptr;
+  std::size_t mLength = 0;
+  std::size_t mPos = 0;
+
+public:
+  DNSWireReader() = default;
+  explicit DNSWireReader(gsl::span<const char> m, std::size_t pos = 0)
+      : mData(reinterpret_cast<const unsigned char*>(m.data())),
+        mLength(m.size()), mPos(pos) {}
+  gsl::span<const char> GetMessage() const {
+    return gsl::span<const char>(reinterpret_cast<const char*>(mData),
+                                 mLength);
+  }
+  std::size_t GetOffset() const { return mPos; }
+  std::size_t GetLength() const { return mLength; }
+  std::size_t Remaining() const {
+    return mPos < mLength ? mLength - mPos : 0;
+  }
+  bool Has(std::size_t n) const {
+    return mPos <= mLength && mLength - mPos >= n;
+  }
+  bool Seek(std::size_t pos) {
+    if (pos > mLength) {
+      return false;
+    }
+    mPos = pos;
+    return true;
+  }
+
+  // Unchecked, only after Has() covered them
+  std::uint8_t U8() { return mData[mPos++]; }
+  std::uint16_t U16() {
+    const std::uint16_t v = (std::uint16_t(mData[mPos]) << 8) |
+                            mData[mPos + 1];
+    mPos += 2;
+    return v;
+  }
+  std::uint32_t U32() {
+    const std::uint32_t v = (std::uint32_t(mData[mPos]) << 24) |
+                            (std::uint32_t(mData[mPos + 1]) << 16) |
+                            (std::uint32_t(mData[mPos + 2]) << 8) |
+                            mData[mPos + 3];
+    mPos += 4;
+    return v;
+  }
+  void Skip(std::size_t n) { mPos += n; }
+  // Any octet of the message, such as a compression pointer target
+  std::uint8_t At(std::size_t pos) const { return mData[pos]; }
+
+  // Checked, the cursor does not move on failure
+  bool ReadU16(std::uint16_t& v) {
+    if (!Has(2)) {
+      return false;
+    }
+    v = U16();
+    return true;
+  }
+  bool ReadU32(std::uint32_t& v) {
+    if (!Has(4)) {
+      return false;
+    }
+    v = U32();
+    return true;
+  }
+  bool ReadSpan(std::size_t n, gsl::span<const char>& out) {
+    if (!Has(n)) {
+      return false;
+    }
+    out = GetMessage().subspan(mPos, n);
+    mPos += n;
+    return true;
+  }
+};
+
+// Remembers the decompressed length and label count of the name suffix
+// found at each compression pointer target of one message, so a suffix
+// shared by many records is only walked once.
+class DNSNameMemo {
+private:
+  struct Entry {
+    std::uint16_t mOffset;
+    std::uint8_t mLength;
+    std::uint8_t mLabelCount;
+  };
+
+  /* Pointers address at most 14 bits, so this never names a target */
+  static constexpr std::uint16_t kEmpty = 0xFFFF;
+  static constexpr std::size_t kSize = 64;
+  Entry mEntries[kSize];
+
+  static std::size_t Slot(std::uint16_t offset) {
+    return (offset ^ (offset >> 6)) & (kSize - 1);
+  }
+
+public:
+  DNSNameMemo() { Clear(); }
+  void Clear();
+  bool Find(std::uint16_t offset, std::uint8_t& length,
+            std::uint8_t& label_count) const;
+  // When the memo is full the suffix is simply not remembered
+  void Insert(std::uint16_t offset, std::uint8_t length,
+              std::uint8_t label_count);
+};
+
+class DNSName {
+private:
+  /* RFC 1035:
+       Domain names in messages are expressed in terms of a sequence
+       of labels. Each label is represented as a one octet length
+       field followed by that number of octets. Since every domain
+       name ends with the null label of the root, a domain name is
+       terminated by a length byte of zero.
+
+     A DNSName does not own its labels. It refers to the name in place
+     within the message it was parsed from, and that message MUST
+     outlive it.
+  */
+  gsl::span<const char> mMsg;
+
+  /* Position of the first label within mMsg */
+  std::uint16_t mOffset = 0;
+
+  /* Number of octets the name occupies at mOffset, including the
+     terminating zero length label or compression pointer */
+  std::uint16_t mWireLength = 0;
+
+  /* RFC 1035:
+       To simplify implementations, the total length of a domain name
+       (i.e., label octets and label length octets) is restricted to
+       255 octets or less.
+
+     This is the length after decompression, including the root.
+  */
+  std::uint8_t mLength = 0;
+
+  /* Number of labels after decompression, not counting the root */
+  std::uint8_t mLabelCount = 0;
+
+public:
+  DNSName() = default;
+  // Compression pointers are followed and validated, memo may be shared
+  // by every name parsed from the same message
+  bool ProcessName(DNSWireReader& r, DNSNameMemo* memo = nullptr);
+  bool ProcessName(gsl::span<const char> m, std::size_t& offset,
+                   DNSNameMemo* memo = nullptr);
+  std::uint16_t GetOffset() const { return mOffset; }
+  std::uint16_t GetWireLength() const { return mWireLength; }
+  std::uint8_t GetLength() const { return mLength; }
+  std::uint8_t GetLabelCount() const { return mLabelCount; }
+  gsl::span<const char> GetWire() const {
+    return mMsg.subspan(mOffset, mWireLength);
+  }
+  // Allocates, only use this off the parsing path
+  std::vector<std::string> GetLabels() const;
+  // Copy the decompressed name, root included, into out. Returns the
+  // number of octets written, zero if out is smaller than GetLength().
+  std::size_t CopyTo(char* out, std::size_t outlen) const;
+};
+
 class DNSHeader {
 private:
   /* The header contains the following fields:
@@ -253,6 +432,7 @@ private:
 
 public:
   DNSHeader() = default;
+  bool ProcessHeader(DNSWireReader& r);
   bool ProcessHeader(const char* const m, const std::size_t mlen);
   bool ProcessHeader(const char* const m);
   std::uint16_t GetMsgID() const { return mMsgID; }
@@ -298,7 +478,7 @@ private:
        that this field may be an odd number of octets; no
        padding is used.
   */
-  std::vector<std::string> mQNames;
+  DNSName mQName;
 
   /* RFC 1035:
        a two octet code which specifies the type of the query.
@@ -378,29 +558,162 @@ private:
 public:
   DNSQuestion() = default;
   DNSQuestion(DNSQuestion&&);
+  bool ProcessQuestion(DNSWireReader& r, DNSNameMemo* memo = nullptr);
   bool ProcessQuestion(const char* const m, std::size_t mlen,
-                       std::size_t& offset);
-  std::vector<std::string> GetQNames() const { return mQNames; }
+                       std::size_t& offset, DNSNameMemo* memo = nullptr);
+  const DNSName& GetQName() const { return mQName; }
+  std::vector<std::string> GetQNames() const { return mQName.GetLabels(); }
   std::uint16_t GetQType() const { return mQType; }
   std::uint16_t GetQClass() const { return mQClass; }
   const std::string Stringify() const;
 };
 
+// The decoded RDATA of one resource record. Every type shares this one
+// compact representation, the RR type selects which fields are valid.
+// Like DNSName it refers into the message rather than copying from it.
 class DNSRData {
+private:
+  /* The RR type the RDATA was decoded as */
+  std::uint16_t mType = 0;
+
+  /* RFC 2782 (SRV):
+       Priority: The priority of this target host.
+       Weight: A server selection mechanism.
+       Port: The port on this target host of this service.
+  */
+  std::uint16_t mPriority = 0;
+  std::uint16_t mWeight = 0;
+  std::uint16_t mPort = 0;
+
+  /* PTR: PTRDNAME, a domain name which points to some location in the
+          domain name space.
+     SRV: Target, the domain name of the target host.
+     NSEC: Next Domain Name, in mDNS the record's own name.
+     Other types with a name layout: the first name.
+  */
+  DNSName mName;
+
+  /* Types with a name layout of two names: the second name, such as the
+     RNAME of SOA */
+  DNSName mName2;
+
+  /* A: a 32 bit Internet address.
+     AAAA: a 128 bit IPv6 address.
+     TXT: One or more <character-string>s.
+     NSEC: Type Bit Maps.
+     Types with a name layout: the fixed octets after the names.
+     Any other type: the undecoded RDATA.
+  */
+  gsl::span<const char> mData;
+
+  /* The decoders are called once the whole RDATA is known to be in the
+     message */
+  bool ProcessSrv(DNSWireReader& r, std::uint16_t rdlength,
+                  DNSNameMemo* memo);
+  bool ProcessTxt(DNSWireReader& r, std::uint16_t rdlength);
+  bool ProcessNsec(DNSWireReader& r, std::uint16_t rdlength,
+                   DNSNameMemo* memo);
+
+public:
+  /* RFC 3597 4 and RFC 6762 18.14: besides PTR, SRV and NSEC, these
+     types carry domain names in their RDATA, which a sender may
+     compress. Each is an optional 16 bit preference, one or two names,
+     then a fixed number of octets. */
+  struct NameLayout {
+    bool mPreference;
+    std::uint8_t mNames;
+    std::uint8_t mFixed;
+  };
+
+private:
+  bool ProcessNames(DNSWireReader& r, std::uint16_t rdlength,
+                    const NameLayout& layout, DNSNameMemo* memo);
+
 public:
   DNSRData() = default;
+  // nullptr for types without a name layout, including PTR, SRV and NSEC
+  static const NameLayout* GetNameLayout(std::uint16_t type);
+  // Decode rdlength octets of RDATA of the given type at the cursor
+  bool ProcessRData(DNSWireReader& r, std::uint16_t type,
+                    std::uint16_t rdlength, DNSNameMemo* memo);
+  bool ProcessRData(gsl::span<const char> m, std::size_t& offset,
+                    std::uint16_t type, std::uint16_t rdlength,
+                    DNSNameMemo* memo);
+  std::uint16_t GetType() const { return mType; }
+  // PTR
+  const DNSName& GetPtrDName() const { return mName; }
+  std::vector<std::string> GetDName() const { return mName.GetLabels(); }
+  // A and AAAA, in network byte order
+  gsl::span<const char> GetAddress() const { return mData; }
+  // SRV
+  std::uint16_t GetPriority() const { return mPriority; }
+  std::uint16_t GetWeight() const { return mWeight; }
+  std::uint16_t GetPort() const { return mPort; }
+  const DNSName& GetTarget() const { return mName; }
+  // TXT, the raw character-strings
+  gsl::span<const char> GetTxtData() const { return mData; }
+  // NSEC
+  const DNSName& GetNextDomainName() const { return mName; }
+  gsl::span<const char> GetTypeBitMaps() const { return mData; }
+  bool HasType(std::uint16_t type) const;
+  // Types with a name layout: the preference of MX, AFSDB, RT, KX and
+  // PX, the names in order, and the octets after them, such as the five
+  // 32 bit fields of SOA
+  std::uint16_t GetPreference() const { return mPriority; }
+  const DNSName& GetFirstName() const { return mName; }
+  const DNSName& GetSecondName() const { return mName2; }
+  gsl::span<const char> GetFixed() const { return mData; }
+  // Types that are not decoded
+  gsl::span<const char> GetRaw() const { return mData; }
+  // The RDATA holds no name, so GetRaw() means the same in any message.
+  // False for every decoded name type and for the undecoded types that
+  // may still carry a compressed name, such as NAPTR.
+  bool IsOpaque() const;
   const std::string Stringify() const;
 };
 
-class DNSPtrRData final : public DNSRData {
+// A key/value index over the TXT RDATA of a DNS-SD service, such as the
+// fn=, md=, id=, ca= and st= keys of a Cast receiver. Keys and values are
+// spans into the message, building and searching the index does not
+// allocate.
+class DNSTxtIndex {
+public:
+  static constexpr std::size_t kMaxEntries = 32;
+
 private:
-  std::vector<std::string> mPtrDName;
+  struct Entry {
+    gsl::span<const char> mKey;
+    /* Empty for boolean attributes, see mHasValue */
+    gsl::span<const char> mValue;
+    bool mHasValue;
+  };
+
+  Entry mEntries[kMaxEntries];
+  std::size_t mCount = 0;
+  bool mTruncated = false;
+
+  const Entry* FindEntry(const char* key, std::size_t keylen) const;
 
 public:
-  explicit DNSPtrRData(std::vector<std::string>&& n) : mPtrDName(n) {}
-  void AddPtrNames(const std::vector<std::string>&&);
-  const std::vector<std::string>& GetDName() const { return mPtrDName; }
-  const std::string Stringify() const;
+  DNSTxtIndex() = default;
+  // txt: TXT RDATA, a sequence of <character-string>s. A string that
+  //      runs past the end of txt stops the index and marks it truncated.
+  void ProcessTxt(gsl::span<const char> txt);
+  bool ProcessTxt(const DNSRData& rdata);
+  std::size_t GetCount() const { return mCount; }
+  // More than kMaxEntries keys were present or the strings overran the
+  // RDATA, the rest were ignored
+  bool IsTruncated() const { return mTruncated; }
+  bool HasKey(const char* key) const;
+  // On success value refers to the value of key, which is empty for a
+  // key without '='. Keys are matched without case.
+  bool Find(const char* key, gsl::span<const char>& value) const;
+  bool Find(const char* key, std::size_t keylen,
+            gsl::span<const char>& value) const;
+  // Compare or fingerprint TXT RDATA without decoding it, to recognize
+  // an unchanged re-announcement
+  static bool Equal(gsl::span<const char> a, gsl::span<const char> b);
+  static std::uint64_t Digest(gsl::span<const char> txt);
 };
 
 class DNSRR {
@@ -438,6 +751,30 @@ public:
     RR_MX,
     /* text strings */
     RR_TXT,
+    /* responsible person (RFC 1183) */
+    RR_RP,
+    /* AFS database location (RFC 1183) */
+    RR_AFSDB,
+    /* route through (RFC 1183) */
+    RR_RT = 21,
+    /* signature (RFC 2535, obsolete) */
+    RR_SIG = 24,
+    /* X.400 mapping information (RFC 2163) */
+    RR_PX = 26,
+    /* IPv6 host address (RFC 3596) */
+    RR_AAAA = 28,
+    /* next domain (RFC 2535, obsolete) */
+    RR_NXT = 30,
+    /* server selection (RFC 2782) */
+    RR_SRV = 33,
+    /* naming authority pointer (RFC 3403) */
+    RR_NAPTR = 35,
+    /* key exchanger (RFC 2230) */
+    RR_KX,
+    /* delegation name (RFC 6672) */
+    RR_DNAME = 39,
+    /* next secure, asserts non-existence (RFC 4034, RFC 6762) */
+    RR_NSEC = 47,
   };
 
 private:
@@ -470,7 +807,7 @@ private:
   /* RFC 1035:
        a domain name to which this resource record pertains.
   */
-  std::vector<std::string> mName;
+  DNSName mName;
 
   /* RFC 1035:
        two octets containing one of the RR type codes. This field
@@ -516,49 +853,98 @@ private:
        if the TYPE is A and the CLASS is IN, the RDATA field is a 4
        octet ARPA Internet address.
   */
-  std::unique_ptr<DNSRData> mRData;
-
-protected:
-  bool ProcessRData(DNSRData** rdata, const char* const m, std::size_t mlen,
-                    std::size_t& offset, eRRType type,
-                    std::uint16_t rrdlength);
-  bool ProcessPtrRData(DNSRData** rdata, const char* const m, std::size_t mlen,
-                       std::size_t& offset, std::uint16_t rrdlength);
+  DNSRData mRData;
 
 public:
-  std::vector<std::string> GetName() const { return mName; }
+  const DNSName& GetOwnerName() const { return mName; }
+  std::vector<std::string> GetName() const { return mName.GetLabels(); }
   std::uint16_t GetRRType() const { return mRRType; }
   std::uint16_t GetRRClass() const { return mRRClass; }
-  std::uint16_t GetTTL() const { return mTTL; }
+  std::uint32_t GetTTL() const { return mTTL; }
   std::uint16_t GetRDLength() const { return mRDLength; }
-  const DNSRData* GetRData() const { return mRData.get(); }
+  const DNSRData& GetRData() const { return mRData; }
+  bool ProcessRR(DNSWireReader& r, DNSNameMemo* memo = nullptr);
   bool ProcessRR(const char* const m, std::size_t mlen,
-                 std::size_t& offset);
+                 std::size_t& offset, DNSNameMemo* memo = nullptr);
   const std::string Stringify() const;
 };
 
+using DNSQuestions =
+    std::vector<DNSQuestion, arena::ArenaAllocator<DNSQuestion>>;
+using DNSRRs = std::vector<DNSRR, arena::ArenaAllocator<DNSRR>>;
+
 class DNSMessage {
+public:
+  /* Sections in the order they appear in the message */
+  enum eSection : std::uint8_t {
+    SECTION_QD = 0,
+    SECTION_AN,
+    SECTION_NS,
+    SECTION_AR,
+  };
+
 private:
-  std::unique_ptr<DNSHeader> mHeader;
-  std::vector<DNSQuestion> mQuestions;
-  std::vector<DNSRR> mRRSection[3];
+  DNSHeader mHeader;
+
+  /* Sections are parsed in order, on demand, by the const accessors.
+     They are allocated from the arena given on construction, if any. */
+  mutable DNSQuestions mQuestions;
+  mutable DNSRRs mRRSection[3];
+
+  /* Decompressed name suffixes, shared by every name in the message */
+  mutable DNSNameMemo mNameMemo;
+
+  /* Number of sections parsed so far, the next one begins at the
+     cursor */
+  mutable std::uint8_t mSectionsParsed = 0;
+  mutable DNSWireReader mReader;
+  bool mHeaderParsed = false;
+  mutable bool mParseError = false;
+
+  /* Only used when the message is copied on construction */
   std::string mRawMsg;
 
+  /* The message being parsed. Every name and record parsed from it
+     refers back into this buffer instead of copying. */
+  gsl::span<const char> mMsg;
+
 protected:
-  bool ProcessQuestions(const char* const m, std::size_t mlen,
-                        std::uint16_t qcount, std::size_t& offset);
-  bool ProcessRRs(const char* const m, std::size_t mlen,
-                  std::uint16_t ancount, std::size_t& offset,
-                  std::uint8_t section);
+  bool ProcessQuestions(DNSWireReader& r, std::uint16_t qcount) const;
+  bool ProcessRRs(DNSWireReader& r, std::uint16_t count,
+                  std::uint8_t section) const;
+  bool ProcessSections(eSection last) const;
 
 public:
   // Throws std::bad_alloc when allocation fails
   // m MUST not be NULL or nullptr, undefined behavior
   explicit DNSMessage(const char* const m, const std::size_t mlen);
   explicit DNSMessage(const char* const m);
+  // View mode: m is not copied, it MUST outlive this object and every
+  // name and record obtained from it. When arena is given every
+  // allocation made while parsing comes from it, and it MUST NOT be
+  // reset before this object is destroyed.
+  explicit DNSMessage(gsl::span<const char> m,
+                      arena::Arena* arena = nullptr);
+  DNSMessage(const DNSMessage&) = delete;
+  DNSMessage& operator=(const DNSMessage&) = delete;
   ~DNSMessage() = default;
-  const std::string GetRawMessage() const { return mRawMsg; }
+  gsl::span<const char> GetMessage() const { return mMsg; }
+  const std::string GetRawMessage() const {
+    return std::string(mMsg.data(), mMsg.size());
+  }
+  // Parse the whole message
   bool ProcessMessage();
+  // Lazy mode: only validate the header. Each section, and any section
+  // before it, is parsed the first time its accessor is called.
+  bool ProcessMessageLazily();
+  // True if a section failed to parse. That section and all that follow
+  // it are empty.
+  bool HasParseError() const { return mParseError; }
+  const DNSHeader& GetHeader() const { return mHeader; }
+  const DNSQuestions& GetQuestions() const;
+  const DNSRRs& GetAnswers() const;
+  const DNSRRs& GetAuthorities() const;
+  const DNSRRs& GetAdditionals() const;
   const std::string Stringify() const;
   static bool ProcessName(const char* const m, std::size_t mlen,
                           std::string& name, std::uint8_t &nlen);
@@ -567,6 +953,133 @@ public:
 
 };
 
+// Builds a message in wire format directly in a caller provided buffer,
+// without allocating. Questions and records must be added in section
+// order. Names are given uncompressed, as a sequence of labels ending
+// with the root, and are compressed against every name already written.
+//
+// When a question or record does not fit it is not written at all and
+// the message so far stays valid, so a caller can finish the packet and
+// continue in the next one.
+class DNSMessageWriter {
+public:
+  /* Header flag bits, as they appear in the second 16 bit word */
+  static constexpr std::uint16_t kFlagQR = 0x8000;
+  static constexpr std::uint16_t kFlagAA = 0x0400;
+  static constexpr std::uint16_t kFlagTC = 0x0200;
+
+  /* RFC 6762:
+       the top bit of the rrclass field is used to indicate that the
+       record is a member of a unique RRSet
+  */
+  static constexpr std::uint16_t kCacheFlush = 0x8000;
+
+private:
+  /* The offset of a name suffix written earlier, and the hash of the
+     suffix it begins. Offset zero is the header, never a name. */
+  struct Suffix {
+    std::uint32_t mHash;
+    std::uint16_t mOffset;
+  };
+
+  static constexpr std::size_t kSuffixTableSize = 128;
+  Suffix mSuffixes[kSuffixTableSize];
+  std::size_t mSuffixCount;
+
+  gsl::span<char> mBuf;
+  std::size_t mLength;
+  std::uint16_t mMsgID;
+  std::uint16_t mFlags;
+  std::uint16_t mCounts[4];
+  /* The last section written to, and the section of the open record */
+  std::uint8_t mSection;
+  std::uint8_t mRRSection;
+
+  /* Where the record being written, and its RDATA, begin. Zero when no
+     record is open. */
+  std::size_t mRRStart;
+  std::size_t mRDataStart;
+
+  bool Put(const void* data, std::size_t len);
+  bool PutU16(std::uint16_t v);
+  bool PutU32(std::uint32_t v);
+  bool PutName(gsl::span<const char> name);
+  bool MatchSuffix(std::size_t offset, const unsigned char* name) const;
+  std::uint16_t FindSuffix(std::uint32_t hash,
+                           const unsigned char* name) const;
+  void InsertSuffix(std::uint32_t hash, std::uint16_t offset);
+
+public:
+  explicit DNSMessageWriter(gsl::span<char> buf, std::uint16_t msgid = 0,
+                            std::uint16_t flags = 0);
+  DNSMessageWriter(const DNSMessageWriter&) = delete;
+  DNSMessageWriter& operator=(const DNSMessageWriter&) = delete;
+  // Start over with an empty message in the same buffer
+  void Reset(std::uint16_t msgid = 0, std::uint16_t flags = 0);
+  bool AddQuestion(gsl::span<const char> qname, std::uint16_t qtype,
+                   std::uint16_t qclass);
+  bool AddQuestion(const DNSName& qname, std::uint16_t qtype,
+                   std::uint16_t qclass);
+
+  // Write a record piece by piece. BeginRR writes everything up to
+  // RDLENGTH, EndRR fills in RDLENGTH once the RDATA is written. If any
+  // step fails, AbortRR removes the partial record.
+  bool BeginRR(DNSMessage::eSection section, gsl::span<const char> name,
+               std::uint16_t type, std::uint16_t rrclass, std::uint32_t ttl);
+  bool BeginRR(DNSMessage::eSection section, const DNSName& name,
+               std::uint16_t type, std::uint16_t rrclass, std::uint32_t ttl);
+  bool WriteRData(gsl::span<const char> data);
+  bool WriteRDataU16(std::uint16_t v);
+  // A compressed name, only for the types RFC 6762 18.14 allows
+  bool WriteRDataName(gsl::span<const char> name);
+  bool WriteRDataName(const DNSName& name);
+  bool EndRR();
+  void AbortRR();
+
+  // Whole records. On failure nothing is written.
+  bool AddRR(DNSMessage::eSection section, gsl::span<const char> name,
+             std::uint16_t type, std::uint16_t rrclass, std::uint32_t ttl,
+             gsl::span<const char> rdata);
+  bool AddPtr(DNSMessage::eSection section, gsl::span<const char> name,
+              std::uint16_t rrclass, std::uint32_t ttl,
+              gsl::span<const char> ptrdname);
+  bool AddSrv(DNSMessage::eSection section, gsl::span<const char> name,
+              std::uint16_t rrclass, std::uint32_t ttl,
+              std::uint16_t priority, std::uint16_t weight,
+              std::uint16_t port, gsl::span<const char> target);
+  // An empty txt is written as the single empty string RFC 6763 requires
+  bool AddTxt(DNSMessage::eSection section, gsl::span<const char> name,
+              std::uint16_t rrclass, std::uint32_t ttl,
+              gsl::span<const char> txt);
+  // An A or AAAA record, chosen by the size of address
+  bool AddAddress(DNSMessage::eSection section, gsl::span<const char> name,
+                  std::uint16_t rrclass, std::uint32_t ttl,
+                  gsl::span<const char> address);
+  // The restricted form of RFC 6762 6.1, types MUST be less than 256
+  bool AddNsec(DNSMessage::eSection section, gsl::span<const char> name,
+               std::uint16_t rrclass, std::uint32_t ttl,
+               const std::uint16_t* types, std::size_t ntypes);
+  // Re-encode a parsed record, recompressing its names against this
+  // message. Fails for a type that may carry a name in its RDATA which
+  // DNSRData does not decode, see DNSRData::IsOpaque().
+  bool AddRR(DNSMessage::eSection section, const DNSRR& rr);
+
+  // Write the header. Returns the length of the message, or zero if the
+  // buffer cannot hold a header or a record is still open.
+  std::size_t Finish();
+  std::size_t GetLength() const { return mLength; }
+  // The header is only written by Finish(), so the flags can change
+  // until then, such as to set TC once a message turns out to be full
+  void SetFlags(std::uint16_t flags) { mFlags = flags; }
+  std::uint16_t GetFlags() const { return mFlags; }
+  std::uint16_t GetCount(DNSMessage::eSection section) const {
+    return mCounts[section];
+  }
+  gsl::span<const char> GetMessage() const {
+    return gsl::span<const char>(mBuf.data(), mLength);
+  }
+};
+
 } // namespace dns_message
 
 #endif // MDNS_MESSAGE_H
@@ -0,0 +1,196 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_RESPONSE_H
+#define MDNS_RESPONSE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gsl/span>
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+// A response serialized once and sent many times. Only the fields that
+// differ between sends are patched, in place: the message ID, the TTLs
+// and the cache-flush bits. Patching to the value already present costs
+// a compare, so answering the same way twice is one copy of the bytes.
+class DNSResponseTemplate {
+public:
+  /* Leave the TTLs as they were compiled */
+  static constexpr std::uint32_t kKeepTTL = UINT32_MAX;
+
+private:
+  /* Where the CLASS field of a record is, and the CLASS and TTL it was
+     compiled with. TTL follows CLASS directly. */
+  struct Record {
+    std::uint16_t mClassOffset;
+    std::uint16_t mRRClass;
+    std::uint32_t mTTL;
+  };
+
+  std::vector<char> mWire;
+  std::vector<Record> mRecords;
+
+  /* The patches currently applied to mWire */
+  std::uint16_t mMsgID = 0;
+  std::uint32_t mMaxTTL = kKeepTTL;
+  bool mCacheFlush = true;
+
+  /* Generation of the records this was compiled from, see
+     DNSResponseCache */
+  std::uint64_t mGeneration = 0;
+
+  friend class DNSResponseCache;
+
+public:
+  DNSResponseTemplate() = default;
+  // msg: a complete message, such as one produced by DNSMessageWriter.
+  //      It is copied and parsed once to find the fields to patch.
+  bool Compile(gsl::span<const char> msg);
+  bool IsEmpty() const { return mWire.empty(); }
+  std::size_t GetRecordCount() const { return mRecords.size(); }
+
+  /* RFC 6762 6.7:
+       it MUST repeat the query ID and the question given in the query
+       message. In addition, the cache-flush bit described in Section
+       10.2 MUST NOT be set in legacy unicast responses.
+
+       The resource record TTL given in a legacy unicast response
+       SHOULD NOT be greater than ten seconds, even if the true TTL of
+       the Multicast DNS resource record is higher.
+
+     A legacy unicast template is compiled with the question in it, then
+     patched with SetMsgID(id), SetMaxTTL(10) and SetCacheFlush(false).
+     Multicast responses use SetMsgID(0), and SetMaxTTL(0) turns a
+     template into its goodbye packet.
+  */
+  void SetMsgID(std::uint16_t msgid);
+  // Every TTL is lowered to at most ttl, kKeepTTL restores them
+  void SetMaxTTL(std::uint32_t ttl);
+  // false clears every cache-flush bit, true restores the compiled ones
+  void SetCacheFlush(bool flush);
+
+  // The patched message, ready to be sent as is
+  gsl::span<const char> GetMessage() const {
+    return gsl::span<const char>(mWire.data(), mWire.size());
+  }
+  // Copy the patched message into out. Returns its length, or zero if
+  // out is too small.
+  std::size_t CopyTo(char* out, std::size_t outlen) const;
+};
+
+// Owns the records we answer with and the responses compiled from them.
+// A response is a set of those records, and its template is compiled
+// the first time the set is asked for. Changing a record recompiles
+// every template lazily, on its next use.
+class DNSResponseCache {
+public:
+  /* A set of records is a bit mask of their ids */
+  static constexpr std::size_t kMaxRecords = 64;
+
+  /* RFC 6762 17:
+       Even when fragmentation is used, a Multicast DNS packet,
+       including IP and UDP headers, MUST NOT exceed 9000 bytes.
+  */
+  static constexpr std::size_t kMaxMessageLength = 9000 - 20 - 8;
+
+  /* Templates kept at most. The sets asked for depend on each query's
+     known answers, so queriers could otherwise grow the table without
+     bound. The least recently used one is dropped, and compiled again
+     if it is asked for again. */
+  static constexpr std::size_t kMaxTemplates = 64;
+
+  /* Names and RDATA are uncompressed wire format. For PTR and SRV the
+     names in the RDATA are compressed when a template is compiled. */
+  struct Record {
+    std::string mName;
+    std::string mRData;
+    std::uint32_t mTTL;
+    std::uint16_t mType;
+    std::uint16_t mRRClass;
+    DNSMessage::eSection mSection;
+  };
+
+private:
+  struct Entry {
+    DNSResponseTemplate mTemplate;
+    /* mUseClock when it was last asked for */
+    std::uint64_t mLastUse = 0;
+  };
+
+  std::vector<Record> mRecords;
+  /* DNSRecordCache::HashKey() of each record, to the set of records
+     with that key */
+  std::unordered_map<std::uint64_t, std::uint64_t> mIndex;
+  /* Set to its template */
+  std::unordered_map<std::uint64_t, Entry> mTemplates;
+  std::uint64_t mUseClock = 0;
+  std::vector<char> mScratch;
+
+  /* Bumped whenever a record changes, templates of an older generation
+     are stale */
+  std::uint64_t mGeneration = 1;
+
+  bool WriteRecord(DNSMessageWriter& writer, const Record& r) const;
+  bool Compile(std::uint64_t set, DNSResponseTemplate& t);
+
+public:
+  DNSResponseCache() = default;
+  DNSResponseCache(const DNSResponseCache&) = delete;
+  DNSResponseCache& operator=(const DNSResponseCache&) = delete;
+
+  // Add a record, id is the bit that selects it in a set. SRV RDATA is
+  // priority, weight and port followed by the uncompressed target.
+  bool AddRecord(DNSMessage::eSection section, gsl::span<const char> name,
+                 std::uint16_t type, std::uint16_t rrclass, std::uint32_t ttl,
+                 gsl::span<const char> rdata, std::size_t& id);
+  // Templates only go stale when the record really changed
+  bool UpdateRData(std::size_t id, gsl::span<const char> rdata);
+  bool UpdateTTL(std::size_t id, std::uint32_t ttl);
+  std::size_t GetRecordCount() const { return mRecords.size(); }
+  // id MUST be less than GetRecordCount()
+  const Record& GetRecord(std::size_t id) const { return mRecords[id]; }
+  std::uint64_t GetGeneration() const { return mGeneration; }
+  std::size_t GetTemplateCount() const { return mTemplates.size(); }
+
+  /* RFC 6762 7.1:
+       A Multicast DNS responder MUST NOT answer a Multicast DNS query if
+       the answer it would give is already included in the Answer
+       Section with an RR TTL at least half the correct value.
+
+     The set of our records that query lists so, to take out of the
+     answer. Each known answer costs one hash probe, and its RDATA is
+     only decoded if the probe finds one of our records. */
+  std::uint64_t GetKnownAnswers(const DNSMessage& query) const;
+
+  // The response made of the records in set, as multicast answers with
+  // QR and AA set. Returns nullptr if set is empty or names an unknown
+  // record, or if the records do not fit in one message. The template
+  // stays valid until the next call. It keeps its patches, unless a
+  // record changed or it was dropped from the table, and it was
+  // compiled again.
+  DNSResponseTemplate* GetTemplate(std::uint64_t set);
+};
+
+} // namespace dns_message
+
+#endif // MDNS_RESPONSE_H
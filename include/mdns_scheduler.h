@@ -0,0 +1,128 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MDNS_SCHEDULER_H
+#define MDNS_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include <gsl/span>
+
+#include "mdns_duplicates.h"
+#include "mdns_response.h"
+
+namespace dns_message {
+
+/* RFC 6762 6:
+     In any case where there may be multiple responses, such as queries
+     where the answer is a member of a shared resource record set, each
+     responder SHOULD delay its response by a random amount of time
+     selected with uniform random distribution in the range 20-120 ms.
+
+     In the case where a Multicast DNS responder has good reason to
+     believe that it will be the only responder on the link that will
+     send a response (i.e., because it is able to answer every question
+     in the query message, and for all of those answer records it has
+     previously verified that the name, rrtype, and rrclass are unique
+     on the link), it SHOULD NOT impose any random delay before
+     responding
+
+     ... a Multicast DNS responder MAY choose to delay its response by
+     up to 500 ms to aggregate answers
+
+   Gathers the answers to many queries into one pending packet per
+   interface, as a set of DNSResponseCache records, so a record asked
+   for twice is sent once. A packet is sent when the earliest of its
+   answers is due, or at once when the next answer would take it past
+   the MTU. An answer whose records all have the cache-flush bit is
+   unique and due at once, otherwise it waits its jitter. Answers that
+   another responder just sent are left out as the packet goes.
+
+   Times are milliseconds on the caller's monotonic clock. */
+class DNSResponseScheduler {
+public:
+  static constexpr std::uint64_t kMinSharedDelayMs = 20;
+  static constexpr std::uint64_t kMaxSharedDelayMs = 120;
+  static constexpr std::uint64_t kMaxAggregateMs = 500;
+  /* A 1500 byte Ethernet MTU less the IPv6 and UDP headers */
+  static constexpr std::size_t kDefaultMTU = 1500 - 40 - 8;
+
+  // Called with each packet to multicast on interface ifindex. msg is
+  // only valid during the call.
+  using Sender =
+      std::function<void(unsigned ifindex, gsl::span<const char> msg)>;
+
+private:
+  struct Pending {
+    unsigned mIfIndex;
+    /* The records to send, zero when nothing is pending */
+    std::uint64_t mSet;
+    /* What mSet takes uncompressed, never less than it is compressed */
+    std::size_t mSize;
+    /* The first answer came at mOpenedMs, the packet goes at
+       mDeadlineMs */
+    std::uint64_t mOpenedMs;
+    std::uint64_t mDeadlineMs;
+  };
+
+  DNSResponseCache& mCache;
+  const Sender mSender;
+  DNSDuplicateSuppressor* const mDuplicates;
+  const std::size_t mMTU;
+  /* One per interface ever answered on, there are few of them */
+  std::vector<Pending> mPending;
+  std::minstd_rand mRandom;
+  std::uint64_t mPacketsSent = 0;
+  std::uint64_t mRecordsSent = 0;
+  std::uint64_t mRecordsMerged = 0;
+
+  Pending& Find(unsigned ifindex);
+  std::size_t GetRecordSize(std::size_t id) const;
+  void Send(Pending& p, std::uint64_t now_ms);
+
+public:
+  // duplicates, if given, is asked before each record is sent
+  DNSResponseScheduler(DNSResponseCache& cache, Sender sender,
+                       DNSDuplicateSuppressor* duplicates = nullptr,
+                       std::size_t mtu = kDefaultMTU,
+                       std::uint32_t seed = std::random_device()());
+  DNSResponseScheduler(const DNSResponseScheduler&) = delete;
+  DNSResponseScheduler& operator=(const DNSResponseScheduler&) = delete;
+
+  // Answer with the records of set on ifindex, such as the records a
+  // query asked for less its known answers. The packet it joins may be
+  // sent from here, if this answer does not fit in it.
+  void Schedule(unsigned ifindex, std::uint64_t set, std::uint64_t now_ms);
+  // Send every packet due by now_ms. Returns how many were sent.
+  std::size_t Flush(std::uint64_t now_ms);
+  // When Flush() next has something to do, zero if nothing is pending
+  std::uint64_t GetNextDeadline() const;
+
+  std::uint64_t GetPending(unsigned ifindex) const;
+  std::uint64_t GetPacketsSent() const { return mPacketsSent; }
+  std::uint64_t GetRecordsSent() const { return mRecordsSent; }
+  // Records asked for while already in the pending packet
+  std::uint64_t GetRecordsMerged() const { return mRecordsMerged; }
+};
+
+} // namespace dns_message
+
+#endif // MDNS_SCHEDULER_H
@@ -19,27 +19,268 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
-// Needs C++14 support
-//#include <gsl/gsl>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "bpf_program.h"
+#include "buffer_pool.h"
 
 namespace mnet {
 
+// Why a receive or send call failed. The errno of the syscall that failed
+// is left in errno, text is only made by NetErrorName() and strerror()
+// when the caller logs it.
+enum eNetError : std::uint8_t {
+  NET_OK = 0,
+  NET_ERR_POLL,
+  NET_ERR_RECV,
+  NET_ERR_SEND,
+  /* The socket or ring was never opened, or was closed */
+  NET_ERR_CLOSED,
+  /* io_uring_enter failed */
+  NET_ERR_RING,
+  /* Every send slot is in flight */
+  NET_ERR_QUEUE_FULL,
+  /* The destination does not fit a sockaddr_storage */
+  NET_ERR_ADDRESS,
+};
+
+const char* NetErrorName(eNetError err);
+
+// One received datagram. The source address is kept raw, FormatAddress()
+// turns it into text when that is needed for logging.
+struct MNetPacket {
+  Buffer mBuffer;
+  const char* mData;
+  std::size_t mLength;
+  struct sockaddr_storage mSrcAddr;
+  socklen_t mSrcAddrLen;
+  /* The interface the datagram arrived on, from IP_PKTINFO or
+     IPV6_PKTINFO, or zero if the kernel did not say */
+  unsigned mIfIndex;
+  /* The datagram was larger than the buffer, mLength octets of it were
+     kept. It MUST NOT be parsed. */
+  bool mTruncated;
+};
+
+// The arrival interface from an IP_PKTINFO or IPV6_PKTINFO control
+// message in hdr, zero if there is none
+unsigned InterfaceFromControl(const struct msghdr& hdr);
+
+// Fill hdr's control buffer, control, so the datagram leaves through
+// interface ifindex. hdr.msg_name MUST be set, its family picks the
+// control message. Leaves hdr without control data if ifindex is zero.
+void SetSendInterface(struct msghdr& hdr, char* control, unsigned ifindex);
+
+// "address:port", for log messages only
+std::string FormatAddress(const struct sockaddr_storage& addr,
+                          socklen_t addrlen);
+
+class MNetBatch {
+public:
+  /* Datagrams drained per syscall */
+  static constexpr std::size_t kMaxPackets = 32;
+
+  using Packet = MNetPacket;
+
+  /* Room for the IP_PKTINFO or IPV6_PKTINFO control message */
+  static constexpr std::size_t kControlLength = 64;
+
+private:
+  BufferPool& mPool;
+  const BufferPool::eSizeClass mClass;
+  struct mmsghdr mMsgs[kMaxPackets];
+  struct iovec mIov[kMaxPackets];
+  /* Aligned for the cmsghdr at its start */
+  alignas(struct cmsghdr) char mControl[kMaxPackets][kControlLength];
+  Buffer mBuffers[kMaxPackets];
+  Packet mPackets[kMaxPackets];
+  std::size_t mCount = 0;
+  std::size_t mTruncatedCount = 0;
+
+  friend class MNet;
+  friend class MNetUring;
+  // Point every message header back at its buffer and address, recvmmsg
+  // overwrites the lengths
+  void Prepare();
+
+public:
+  // size_class: the largest datagram expected, CLASS_STANDARD for an
+  //             Ethernet MTU or CLASS_JUMBO for jumbo frames
+  explicit MNetBatch(BufferPool& pool,
+                     BufferPool::eSizeClass size_class =
+                         BufferPool::CLASS_STANDARD)
+      : mPool(pool), mClass(size_class) {}
+  MNetBatch(const MNetBatch&) = delete;
+  MNetBatch& operator=(const MNetBatch&) = delete;
+  std::size_t GetCount() const { return mCount; }
+  const Packet& GetPacket(std::size_t i) const { return mPackets[i]; }
+  const Packet* begin() const { return mPackets; }
+  const Packet* end() const { return mPackets + mCount; }
+  // Datagrams ever received that did not fit their buffer
+  std::size_t GetTruncatedCount() const { return mTruncatedCount; }
+};
+
+// A local interface the group was joined on
+struct MNetInterface {
+  unsigned mIndex;
+  std::string mName;
+  /* The first address of the socket's family found on the interface */
+  struct sockaddr_storage mAddr;
+};
+
+// Datagrams waiting to be sent, in one FIFO per interface. Pop() takes
+// one datagram from each interface in turn, so a busy interface cannot
+// hold back replies on the others, and each FIFO is capped so a flood of
+// queries on one interface only drops replies on that interface.
+class MNetSendQueue {
+public:
+  struct Datagram {
+    Buffer mBuffer;
+    struct sockaddr_storage mDst;
+    socklen_t mDstLen;
+    unsigned mIfIndex;
+  };
+
+  /* Datagrams held per interface before new ones are dropped */
+  static constexpr std::size_t kDefaultDepth = 256;
+
+private:
+  struct Queue {
+    unsigned mIfIndex;
+    std::deque<Datagram> mPending;
+    std::size_t mDropped;
+  };
+
+  std::vector<Queue> mQueues;
+  const std::size_t mDepth;
+  /* The queue Pop() starts its next turn at */
+  std::size_t mNext = 0;
+  std::size_t mPending = 0;
+  /* Datagrams the kernel took, the sendmmsg() calls that took them and
+     the datagrams dropped on a send error */
+  std::uint64_t mSent = 0;
+  std::uint64_t mSendCalls = 0;
+  std::uint64_t mSendErrors = 0;
+
+  friend class MNet;
+
+  Queue* Find(unsigned ifindex);
+
+public:
+  explicit MNetSendQueue(std::size_t depth = kDefaultDepth)
+      : mDepth(depth) {}
+
+  // Returns false, and drops d, if the queue of d.mIfIndex is full
+  bool Push(Datagram&& d);
+  // Move up to max datagrams into out, round robin across interfaces
+  std::size_t Pop(Datagram* out, std::size_t max);
+  // Put back count datagrams Pop() returned, at the front of their
+  // queues and in their order, such as when the socket buffer is full
+  void Requeue(Datagram* d, std::size_t count);
+  std::size_t GetPending() const { return mPending; }
+  std::size_t GetPending(unsigned ifindex) const;
+  std::size_t GetDropped(unsigned ifindex) const;
+  std::uint64_t GetSent() const { return mSent; }
+  std::uint64_t GetSendCalls() const { return mSendCalls; }
+  std::uint64_t GetSendErrors() const { return mSendErrors; }
+  // How well flushes batch, the higher the fewer syscalls per datagram
+  double GetPacketsPerCall() const {
+    return mSendCalls ? double(mSent) / mSendCalls : 0.0;
+  }
+};
+
+// One mDNS socket, for either IPv4 or IPv6. A dual stack responder opens
+// one of each and hands both to the same reactor and handler.
 class MNet {
-  int mFd;
-  const char* mdns_addr = "224.0.0.251";
+  int mFd = -1;
+  const int mFamily;
+  /* The group, and the address the socket binds. An IPv6 socket cannot
+     bind the link-local group without naming an interface, so it binds
+     the wildcard and only joins the group. */
+  const char* mdns_addr;
+  const char* bind_addr;
   const char* mdns_port = "5353";
   bool is_ready;
+  bool mReusePort = false;
+  /* What the socket filter keeps, and the shard it keeps it for */
+  MdnsSocketFilter mFilter;
+  std::uint32_t mShards = 1;
+  std::uint32_t mShard = 0;
+  std::vector<MNetInterface> mInterfaces;
+
+  bool AttachFilter(std::string& errmsg);
 
 public:
-  MNet() = default;
+  /* Datagrams sent by one sendmmsg() of Flush() */
+  static constexpr std::size_t kFlushBatch = 32;
+
+  // family: AF_INET for 224.0.0.251 or AF_INET6 for ff02::fb
+  explicit MNet(int family = AF_INET)
+      : mFamily(family),
+        mdns_addr(family == AF_INET6 ? "ff02::fb" : "224.0.0.251"),
+        bind_addr(family == AF_INET6 ? "::" : "224.0.0.251") {}
+  MNet(const MNet&) = delete;
+  MNet& operator=(const MNet&) = delete;
+  ~MNet() { Close(); }
+  void Close();
+  // Share the port with other sockets of this process that set it too,
+  // before CreateSocket(). SO_REUSEADDR is always set, so other mDNS
+  // responders on the host, such as Avahi, can bind 5353 as well.
+  void SetReusePort(bool reuse) { mReusePort = reuse; }
   bool CreateSocket(std::string& errmsg);
+  // Make this socket shard shard of shards SO_REUSEPORT sockets. Unicast
+  // is steered to it by source address, and so is multicast, which the
+  // kernel copies to every socket of the group, by the socket filter
+  // dropping the other shards' sources.
+  bool AttachSharding(std::uint32_t shards, std::uint32_t shard,
+                      std::string& errmsg);
+  // Drop the messages filter does not keep in the kernel, once the
+  // socket is created. Calling it again, such as when the role changes,
+  // swaps the program atomically: no datagram sees neither filter.
+  bool SetFilter(const MdnsSocketFilter& filter, std::string& errmsg);
+  const MdnsSocketFilter& GetFilter() const { return mFilter; }
   bool DisableMulticastLoop(std::string& errmsg);
+  // Join the group on every interface that is up, multicast capable, not
+  // a loopback and has an address of our family. Fails only if none could be
+  // joined, errmsg lists the interfaces joined.
   bool AddMulticastMembership(std::string& errmsg);
+  // Join the group on interface ifindex only
+  bool AddMulticastMembership(unsigned ifindex, std::string& errmsg);
+  const std::vector<MNetInterface>& GetInterfaces() const {
+    return mInterfaces;
+  }
+  // Whether an interface with these flags from getifaddrs() is one we
+  // answer on
+  static bool IsEligibleInterface(unsigned flags);
   bool IsReady() const { return is_ready; }
-  bool Poll(std::string& errmsg) const;
-  bool Read(char** msg, size_t& msglen, std::string& errmsg) const;
+  int GetFd() const { return mFd; }
+  int GetFamily() const { return mFamily; }
+  // revents of a zero timeout poll() for POLLIN and POLLOUT
+  eNetError Poll(short& revents) const;
+  // Receive one datagram, if one is queued, into a buffer from pool large
+  // enough for any mDNS message. pkt.mBuffer is empty if there was
+  // nothing to read.
+  eNetError Read(BufferPool& pool, MNetPacket& pkt) const;
+  // Receive every datagram already queued on the socket, up to
+  // MNetBatch::kMaxPackets, with one syscall. Does not block, an empty
+  // batch means there was nothing to read.
+  eNetError ReadBatch(MNetBatch& batch) const;
+  // Send d out of interface d.mIfIndex, or wherever the routing table
+  // says if that is zero
+  eNetError Send(const MNetSendQueue::Datagram& d) const;
+  // Send what queue holds, kFlushBatch datagrams per sendmmsg(). Each
+  // datagram carries its own destination and interface, so multicast and
+  // unicast replies for any interface share calls. sent is set to the
+  // number the kernel took. A datagram that failed is dropped; once the
+  // socket buffer is full the rest stays queued for the next flush.
+  eNetError Flush(MNetSendQueue& queue, std::size_t& sent) const;
 };
 
 } // namespace mnet
@@ -0,0 +1,150 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef MNET_URING_H
+#define MNET_URING_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "buffer_pool.h"
+#include "mnet.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace mnet {
+
+// An io_uring backend for an MNet socket. One multishot recvmsg stays
+// posted on the socket and the kernel picks a buffer for every datagram
+// from a ring of pooled buffers, so receiving costs no syscall per
+// packet. Sends are queued and submitted together with one
+// io_uring_enter. Completions are reaped into an MNetBatch, the same
+// batch the recvmmsg path fills.
+//
+// Needs Linux 6.0 or later, for multishot recvmsg and provided buffer
+// rings. Open() fails on anything older, and on kernels where io_uring
+// is disabled, and the caller falls back to MNet::ReadBatch.
+class MNetUring {
+public:
+  /* Submission queue entries, which bounds the sends in flight */
+  static constexpr unsigned kQueueDepth = 64;
+  /* Receive buffers handed to the kernel, a power of two */
+  static constexpr unsigned kRecvBuffers = 64;
+
+private:
+  struct SendSlot {
+    Buffer mBuffer;
+    struct sockaddr_storage mDst;
+    struct iovec mIov;
+    struct msghdr mHdr;
+    alignas(struct cmsghdr) char mControl[MNetBatch::kControlLength];
+  };
+
+  int mRingFd = -1;
+  const MNet* mNet = nullptr;
+  BufferPool* mPool = nullptr;
+  BufferPool::eSizeClass mClass = BufferPool::CLASS_JUMBO;
+
+  void* mSqRing = nullptr;
+  std::size_t mSqRingSize = 0;
+  void* mCqRing = nullptr;
+  std::size_t mCqRingSize = 0;
+  struct io_uring_sqe* mSqes = nullptr;
+  std::size_t mSqesSize = 0;
+  unsigned* mSqHead = nullptr;
+  unsigned* mSqTail = nullptr;
+  unsigned* mSqArray = nullptr;
+  unsigned mSqMask = 0;
+  unsigned mSqEntries = 0;
+  unsigned* mCqHead = nullptr;
+  unsigned* mCqTail = nullptr;
+  unsigned mCqMask = 0;
+  struct io_uring_cqe* mCqes = nullptr;
+  /* Entries filled in but not yet submitted */
+  unsigned mToSubmit = 0;
+
+  struct io_uring_buf_ring* mBufRing = nullptr;
+  std::size_t mBufRingSize = 0;
+  std::uint16_t mBufTail = 0;
+  Buffer mRecvBuffers[kRecvBuffers];
+  /* Buffers in the batch handed out last, given back on the next Reap() */
+  std::uint16_t mLent[MNetBatch::kMaxPackets];
+  std::size_t mLentCount = 0;
+  /* The receive template, only the name and control lengths are read
+     by the kernel */
+  struct msghdr mRecvHdr;
+  bool mRecvArmed = false;
+
+  SendSlot mSends[kQueueDepth];
+  std::uint16_t mFreeSends[kQueueDepth];
+  std::size_t mFreeSendCount = 0;
+  std::size_t mSendErrors = 0;
+  std::size_t mEnterCalls = 0;
+
+  struct io_uring_sqe* GetSqe();
+  eNetError Enter(unsigned min_complete);
+  void ProvideBuffer(std::uint16_t bid);
+  void ArmRecv();
+
+public:
+  MNetUring() = default;
+  MNetUring(const MNetUring&) = delete;
+  MNetUring& operator=(const MNetUring&) = delete;
+  ~MNetUring();
+
+  // Whether this kernel lets us create a ring at all
+  static bool IsSupported();
+
+  // Start receiving on the socket of net, into buffers of size_class
+  // from pool. net and pool MUST outlive the ring. Returns false if the
+  // kernel lacks a feature we need, with the reason in errmsg.
+  bool Open(const MNet& net, BufferPool& pool, std::string& errmsg,
+            BufferPool::eSizeClass size_class = BufferPool::CLASS_JUMBO);
+  void Close();
+  bool IsOpen() const { return mRingFd != -1; }
+  // Readable whenever completions are waiting, for the reactor
+  int GetFd() const { return mRingFd; }
+
+  // Submit anything queued and move up to MNetBatch::kMaxPackets received
+  // datagrams into batch. Does not block, an empty batch means there was
+  // nothing to reap. Packets stay valid until the next call.
+  eNetError Reap(MNetBatch& batch);
+
+  // Queue msg for dst, out of interface ifindex if that is not zero.
+  // Nothing is sent until Submit() or the next Reap().
+  // The ring keeps a reference to msg until the send completes. Returns
+  // NET_ERR_QUEUE_FULL if kQueueDepth sends are already in flight.
+  eNetError QueueSend(const Buffer& msg, const struct sockaddr* dst,
+                      socklen_t dstlen, unsigned ifindex = 0);
+  // Hand every queued entry to the kernel with one syscall
+  eNetError Submit();
+
+  // Sends that completed with an error
+  std::size_t GetSendErrors() const { return mSendErrors; }
+  // io_uring_enter calls ever made
+  std::size_t GetEnterCalls() const { return mEnterCalls; }
+};
+
+} // namespace mnet
+#endif // MNET_URING_H
@@ -0,0 +1,151 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <signal.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "mnet.h"
+#include "mnet_uring.h"
+
+namespace mnet {
+
+// The daemon main loop. It sleeps in epoll_wait until a registered socket
+// is readable, a protocol timer expires or a shutdown signal arrives, so
+// it uses no CPU while idle. Timers share one timerfd, armed for the
+// earliest deadline, and SIGINT and SIGTERM are taken through a
+// signalfd instead of a handler. Callbacks run on the thread that called
+// Run().
+class Reactor {
+public:
+  // Called with every batch drained from a readable MNet socket
+  using BatchHandler = std::function<void(const MNetBatch&)>;
+  // Called when fd is ready, with the epoll events that are set
+  using FdHandler = std::function<void(std::uint32_t events)>;
+  using TimerHandler = std::function<void()>;
+  using TimerId = std::uint64_t;
+
+  /* The delay before flushing again what a full socket buffer refused */
+  static constexpr std::uint64_t kFlushRetryMs = 5;
+
+private:
+  struct Source {
+    int mFd;
+    const MNet* mNet;
+    MNetUring* mRing;
+    MNetBatch* mBatch;
+    BatchHandler mOnBatch;
+    FdHandler mOnReady;
+  };
+
+  struct Sender {
+    const MNet* mNet;
+    MNetSendQueue* mQueue;
+  };
+
+  int mEpollFd = -1;
+  int mTimerFd = -1;
+  int mSignalFd = -1;
+  sigset_t mSignals;
+  sigset_t mSavedMask;
+  bool mSignalsBlocked = false;
+  bool mStopping = false;
+  int mStopSignal = 0;
+
+  /* Indexed by the epoll data of each registered descriptor. Held by
+     pointer, so a handler may register more while one is dispatched. */
+  std::vector<std::unique_ptr<Source>> mSources;
+  std::vector<Sender> mSenders;
+  /* The timer that retries a flush the socket buffer cut short */
+  TimerId mFlushRetry = 0;
+
+  /* Pending timers, by deadline in CLOCK_MONOTONIC nanoseconds and then
+     by id, so timers with equal deadlines fire in the order they were
+     added */
+  std::map<std::pair<std::uint64_t, TimerId>, TimerHandler> mTimers;
+  TimerId mNextTimerId = 1;
+  std::uint64_t mArmedDeadline = 0;
+
+  bool Register(int fd, std::uint32_t events, Source&& source,
+                std::string& errmsg);
+  void ArmTimer();
+  void RunTimers();
+  void DrainSignals();
+  void DrainSocket(Source& source);
+  void DrainRing(Source& source);
+  void FlushSenders();
+
+public:
+  Reactor() = default;
+  Reactor(const Reactor&) = delete;
+  Reactor& operator=(const Reactor&) = delete;
+  ~Reactor();
+
+  // Create the epoll, timer and signal descriptors. SIGINT and SIGTERM
+  // are blocked on the calling thread until Close(). A worker's reactor
+  // passes handle_signals false and leaves them to the main thread's.
+  bool Open(std::string& errmsg, bool handle_signals = true);
+  void Close();
+
+  // Drain net into batch whenever its socket is readable, and hand each
+  // batch to handler. net and batch MUST outlive the reactor.
+  bool AddSocket(const MNet& net, MNetBatch& batch, BatchHandler handler,
+                 std::string& errmsg);
+  // The same, with datagrams reaped from an io_uring instead of read
+  bool AddRing(MNetUring& ring, MNetBatch& batch, BatchHandler handler,
+               std::string& errmsg);
+  // Flush queue out of net at the end of every loop iteration, so what
+  // the handlers of one wakeup queue leaves in as few sendmmsg() calls as
+  // possible. What a full socket buffer held back is retried after
+  // kFlushRetryMs. net and queue MUST outlive the reactor.
+  bool AddSendQueue(const MNet& net, MNetSendQueue& queue,
+                    std::string& errmsg);
+  // Any other descriptor, for example a completion queue
+  bool AddFd(int fd, std::uint32_t events, FdHandler handler,
+             std::string& errmsg);
+
+  // Run handler once, delay_ms milliseconds from now
+  TimerId AddTimer(std::uint64_t delay_ms, TimerHandler handler);
+  // Returns false if the timer already ran or was cancelled
+  bool CancelTimer(TimerId id);
+  std::size_t GetTimerCount() const { return mTimers.size(); }
+
+  // Dispatch events until Stop() is called or a shutdown signal arrives
+  bool Run(std::string& errmsg);
+  // Wait at most timeout_ms for events and dispatch them, -1 waits
+  // forever
+  bool RunOnce(int timeout_ms, std::string& errmsg);
+  void Stop() { mStopping = true; }
+  bool IsStopping() const { return mStopping; }
+  // The signal that stopped the loop, zero if none did
+  int GetStopSignal() const { return mStopSignal; }
+
+  static std::uint64_t Now();
+};
+
+} // namespace mnet
+
+#endif // REACTOR_H
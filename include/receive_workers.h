@@ -0,0 +1,99 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RECEIVE_WORKERS_H
+#define RECEIVE_WORKERS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "mnet.h"
+#include "reactor.h"
+
+namespace mnet {
+
+// Receive threads, each draining and parsing its own SO_REUSEPORT socket
+// on 5353. Datagrams are sharded by source address, see
+// MNet::AttachSharding(), so one querier is always handled by the same
+// worker. Nothing is shared between workers: each has its own socket,
+// buffer pool, batch and reactor, and its handler runs on its thread
+// only. Shutdown signals stay with the main thread's reactor, which
+// calls Stop().
+class ReceiveWorkers {
+public:
+  // Makes the batch handler of worker i. Called by Start(), the handler
+  // then only runs on worker i's thread.
+  using HandlerFactory = std::function<Reactor::BatchHandler(std::size_t)>;
+  // Joins the group on a worker's socket, after it is bound
+  using SocketSetup = std::function<bool(MNet&, std::string&)>;
+
+private:
+  struct Worker {
+    MNet mNet;
+    BufferPool mPool;
+    MNetBatch mBatch;
+    Reactor mReactor;
+    /* An eventfd, written to stop the worker from another thread */
+    int mWakeFd = -1;
+    int mCpu = -1;
+    std::thread mThread;
+    std::atomic<std::uint64_t> mPackets{0};
+
+    explicit Worker(int family)
+        : mNet(family), mBatch(mPool, BufferPool::CLASS_JUMBO) {}
+    ~Worker();
+  };
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+
+  static void Run(Worker& w);
+
+public:
+  ReceiveWorkers() = default;
+  ReceiveWorkers(const ReceiveWorkers&) = delete;
+  ReceiveWorkers& operator=(const ReceiveWorkers&) = delete;
+  ~ReceiveWorkers() { Stop(); }
+
+  // Start count workers for family. pin_cpus pins worker i to CPU i,
+  // modulo the CPUs online. Without a factory the workers only count
+  // datagrams. setup defaults to joining the group on every
+  // eligible interface with the multicast loop disabled.
+  bool Start(int family, std::size_t count, bool pin_cpus,
+             HandlerFactory factory, std::string& errmsg,
+             SocketSetup setup = nullptr);
+  // Wake every worker, wait for it to finish and close its socket
+  void Stop();
+  // Swap every worker's socket filter, keeping each one's shard. Safe
+  // while the workers run.
+  bool SetFilter(const MdnsSocketFilter& filter, std::string& errmsg);
+
+  std::size_t GetCount() const { return mWorkers.size(); }
+  // Datagrams received by worker i so far, safe from any thread
+  std::uint64_t GetPackets(std::size_t i) const {
+    return mWorkers[i]->mPackets.load(std::memory_order_relaxed);
+  }
+};
+
+} // namespace mnet
+#endif // RECEIVE_WORKERS_H
@@ -0,0 +1,100 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace timer_wheel {
+
+// A hierarchical timing wheel for many timers of coarse resolution, such
+// as record TTLs. Scheduling and cancelling are O(1). Advancing visits
+// only the ticks where a slot is due, and costs the timers that move or
+// fire there, however many are pending; a long idle gap is one step.
+// Timers are named by small integer ids the owner picks, such as indices
+// into its own table, so the wheel allocates nothing per timer once it
+// has seen an id.
+//
+// Level 0 has one slot per tick. Each level above has slots as wide as
+// the whole level below, and its timers cascade down a level when the
+// level below wraps. A deadline past the top level waits in its last
+// slot and is placed again each time it cascades.
+class TimerWheel {
+public:
+  using Id = std::uint32_t;
+
+  static constexpr std::size_t kLevels = 4;
+  static constexpr std::size_t kSlotBits = 6;
+  static constexpr std::size_t kSlots = 1 << kSlotBits;
+
+private:
+  static constexpr Id kNone = UINT32_MAX;
+  static constexpr std::uint16_t kNoSlot = UINT16_MAX;
+
+  struct Node {
+    Id mPrev = kNone;
+    Id mNext = kNone;
+    /* In ticks */
+    std::uint64_t mDeadline = 0;
+    /* level * kSlots + slot, kNoSlot when not scheduled */
+    std::uint16_t mSlot = kNoSlot;
+  };
+
+  std::vector<Node> mNodes;
+  Id mHeads[kLevels * kSlots];
+  const std::uint64_t mTickMs;
+  /* The next tick to process, every timer before it has fired */
+  std::uint64_t mTick;
+  std::size_t mCount = 0;
+
+  void Link(Id id);
+  void Unlink(Id id);
+  // Place every timer of the current slot of level again, a level down
+  void Cascade(std::size_t level);
+  // The first tick at or after mTick where a timer cascades or fires
+  std::uint64_t GetNextTick() const;
+
+public:
+  // now_ms: the current time on the clock deadlines are given on
+  explicit TimerWheel(std::uint64_t now_ms, std::uint64_t tick_ms = 100);
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  // (Re)schedule id to fire once the wheel is advanced to deadline_ms,
+  // rounded up to a tick. A deadline already past fires within a tick.
+  void Schedule(Id id, std::uint64_t deadline_ms);
+  // Returns false if id was not scheduled
+  bool Cancel(Id id);
+  bool IsScheduled(Id id) const {
+    return id < mNodes.size() && mNodes[id].mSlot != kNoSlot;
+  }
+  std::size_t GetCount() const { return mCount; }
+
+  // Fire every timer due by now_ms, appending its id to expired in
+  // deadline order. Returns the number appended.
+  std::size_t Advance(std::uint64_t now_ms, std::vector<Id>& expired);
+  // When Advance() may next have something to do, zero if nothing is
+  // scheduled. It is never late, but may be early for a timer that still
+  // has to cascade, which then costs a wakeup that fires nothing.
+  std::uint64_t GetNextDeadline() const;
+};
+
+} // namespace timer_wheel
+#endif // TIMER_WHEEL_H
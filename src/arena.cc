@@ -0,0 +1,82 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdint>
+
+#include "arena.h"
+
+namespace arena {
+
+Arena::~Arena()
+{
+  Release();
+}
+
+void Arena::Release()
+{
+  while (mHead != nullptr) {
+    Block* next = mHead->mNext;
+    ::operator delete(mHead);
+    mHead = next;
+  }
+}
+
+Arena::Block* Arena::AllocateBlock(std::size_t size)
+{
+  Block* b = static_cast<Block*>(::operator new(sizeof(Block) + size));
+  b->mNext = mHead;
+  b->mSize = size;
+  mHead = b;
+  mUsed = 0;
+  return b;
+}
+
+// n: number of bytes
+// align: required alignment of the returned pointer, a power of two
+void* Arena::Allocate(std::size_t n, std::size_t align)
+{
+  std::size_t start = 0;
+  if (mHead != nullptr) {
+    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(Data(mHead));
+    start = ((base + mUsed + align - 1) & ~(align - 1)) - base;
+  }
+  if (mHead == nullptr || start + n > mHead->mSize) {
+    // Blocks are aligned for any fundamental type, the new block always
+    // starts at offset 0
+    AllocateBlock(n > mBlockSize ? n : mBlockSize);
+    start = 0;
+  }
+  mAllocated += (start - mUsed) + n;
+  mUsed = start + n;
+  return static_cast<char*>(Data(mHead)) + start;
+}
+
+void Arena::Reset()
+{
+  if (mHead != nullptr && mHead->mNext != nullptr) {
+    // The last packet did not fit in one block. Replace the chain with a
+    // single block that fits it, so the next one will. Round up to leave
+    // room for alignment padding that differs between the two layouts.
+    const std::size_t size = (mAllocated / mBlockSize + 1) * mBlockSize;
+    Release();
+    AllocateBlock(size);
+  }
+  mUsed = 0;
+  mAllocated = 0;
+}
+
+} // namespace arena
@@ -0,0 +1,105 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+
+#include <utility>
+
+#include "bpf_program.h"
+
+namespace mnet {
+
+/* Offsets of the source address in the IP header */
+static const std::int32_t kIPv4Source = 12;
+static const std::int32_t kIPv6Source = 8;
+
+/* Fibonacci hashing, spreads sources that differ only in low bits */
+static const std::uint32_t kHashMultiplier = 0x9e3779b1;
+
+/* What a socket filter returns to keep the whole datagram */
+static const std::uint32_t kAcceptAll = 0xffffffff;
+
+/* A UDP socket's filter sees the datagram from the UDP header on, so the
+   flags are two bytes into the DNS header, after 8 bytes of UDP header.
+   A load past the end of a datagram drops it, as a short one should be. */
+static const std::uint32_t kFlagsOffset = 8 + 2;
+static const std::uint32_t kFlagQR = 0x8000;
+static const std::uint32_t kFlagsOpcode = 0x7800;
+static const std::uint32_t kFlagsRcode = 0x000f;
+
+void EmitSourceShard(BpfProgram& prog, int family, std::uint32_t shards)
+{
+  if (family == AF_INET6) {
+    // Fold the four words of the address into one
+    prog.Stmt(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + kIPv6Source);
+    prog.Stmt(BPF_MISC | BPF_TAX, 0);
+    for (std::int32_t word = 4; word < 16; word += 4) {
+      prog.Stmt(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + kIPv6Source + word);
+      prog.Stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+      prog.Stmt(BPF_MISC | BPF_TAX, 0);
+    }
+  } else {
+    prog.Stmt(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + kIPv4Source);
+  }
+  prog.Stmt(BPF_ALU | BPF_MUL | BPF_K, kHashMultiplier);
+  prog.Stmt(BPF_ALU | BPF_RSH | BPF_K, 16);
+  prog.Stmt(BPF_ALU | BPF_MOD | BPF_K, shards);
+}
+
+BpfProgram ReuseportSteeringProgram(int family, std::uint32_t shards)
+{
+  BpfProgram prog;
+  EmitSourceShard(prog, family, shards);
+  prog.Stmt(BPF_RET | BPF_A, 0);
+  return prog;
+}
+
+BpfProgram MdnsFilterProgram(int family, const MdnsSocketFilter& filter,
+                             std::uint32_t shards, std::uint32_t shard)
+{
+  BpfProgram prog;
+  /* Jumps to the drop, and the branch of each that takes it */
+  std::vector<std::pair<std::size_t, bool>> drops;
+
+  prog.Stmt(BPF_LD | BPF_H | BPF_ABS, kFlagsOffset);
+  if (filter.mStandardOnly) {
+    drops.emplace_back(
+        prog.Jump(BPF_JMP | BPF_JSET | BPF_K, kFlagsOpcode | kFlagsRcode, 0,
+                  0),
+        true);
+  }
+  if (filter.mRole == MdnsSocketFilter::ROLE_RESPONDER) {
+    drops.emplace_back(prog.Jump(BPF_JMP | BPF_JSET | BPF_K, kFlagQR, 0, 0),
+                       true);
+  } else if (filter.mRole == MdnsSocketFilter::ROLE_QUERIER) {
+    drops.emplace_back(prog.Jump(BPF_JMP | BPF_JSET | BPF_K, kFlagQR, 0, 0),
+                       false);
+  }
+  if (shards > 1) {
+    EmitSourceShard(prog, family, shards);
+    drops.emplace_back(prog.Jump(BPF_JMP | BPF_JEQ | BPF_K, shard, 0, 0),
+                       false);
+  }
+  prog.Stmt(BPF_RET | BPF_K, kAcceptAll);
+  const std::size_t drop = prog.GetLength();
+  prog.Stmt(BPF_RET | BPF_K, 0);
+  for (const std::pair<std::size_t, bool>& jump : drops) {
+    prog.SetJumpTarget(jump.first, jump.second, drop);
+  }
+  return prog;
+}
+
+} // namespace mnet
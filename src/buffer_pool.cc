@@ -0,0 +1,138 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <new>
+
+#include "buffer_pool.h"
+
+namespace mnet {
+
+constexpr std::size_t BufferPool::kClassSizes[BufferPool::CLASS_COUNT];
+
+void Buffer::Release()
+{
+  if (mBlock == nullptr) {
+    return;
+  }
+  if (--mBlock->mRefs == 0) {
+    mBlock->mPool->Return(mBlock);
+  }
+  mBlock = nullptr;
+}
+
+Buffer& Buffer::operator=(const Buffer& o)
+{
+  // Taking the new reference first keeps self assignment safe
+  Block* const b = o.mBlock;
+  if (b != nullptr) {
+    b->mRefs++;
+  }
+  Release();
+  mBlock = b;
+  return *this;
+}
+
+Buffer& Buffer::operator=(Buffer&& o)
+{
+  if (this != &o) {
+    Release();
+    mBlock = o.mBlock;
+    o.mBlock = nullptr;
+  }
+  return *this;
+}
+
+std::size_t Buffer::GetCapacity() const
+{
+  return mBlock == nullptr ? 0 : BufferPool::kClassSizes[mBlock->mClass];
+}
+
+BufferPool::~BufferPool()
+{
+  // Buffers still handed out are a bug in the caller, they are leaked
+  // rather than freed under it
+  for (Buffer::Block*& head : mFree) {
+    while (head != nullptr) {
+      Buffer::Block* next = head->mNext;
+      ::operator delete(head);
+      head = next;
+    }
+  }
+}
+
+bool BufferPool::ClassFor(std::size_t size, eSizeClass& c)
+{
+  for (std::uint8_t i = 0; i < CLASS_COUNT; i++) {
+    if (size <= kClassSizes[i]) {
+      c = eSizeClass(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+Buffer BufferPool::Acquire(eSizeClass c)
+{
+  Buffer::Block* b = mFree[c];
+  if (b != nullptr) {
+    mFree[c] = b->mNext;
+  } else {
+    b = Allocate(c);
+  }
+  b->mNext = nullptr;
+  b->mLength = 0;
+  b->mRefs = 1;
+  mInUse[c]++;
+  return Buffer(b);
+}
+
+Buffer BufferPool::Acquire(std::size_t size)
+{
+  eSizeClass c;
+  if (!ClassFor(size, c)) {
+    return Buffer();
+  }
+  return Acquire(c);
+}
+
+Buffer::Block* BufferPool::Allocate(eSizeClass c)
+{
+  Buffer::Block* b = static_cast<Buffer::Block*>(
+      ::operator new(Buffer::kHeaderSize + kClassSizes[c]));
+  b->mPool = this;
+  b->mClass = c;
+  mAllocated[c]++;
+  return b;
+}
+
+void BufferPool::Reserve(eSizeClass c, std::size_t n)
+{
+  while (mAllocated[c] - mInUse[c] < n) {
+    Buffer::Block* b = Allocate(c);
+    b->mNext = mFree[c];
+    mFree[c] = b;
+  }
+}
+
+void BufferPool::Return(Buffer::Block* b)
+{
+  b->mNext = mFree[b->mClass];
+  mFree[b->mClass] = b;
+  mInUse[b->mClass]--;
+}
+
+} // namespace mnet
@@ -15,52 +15,319 @@
  */
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "mdns_cache.h"
+#include "mdns_filter.h"
 #include "mdns_message.h"
 #include "mnet.h"
+#include "mnet_uring.h"
+#include "reactor.h"
+#include "receive_workers.h"
 
-int main()
+static const char kGoogleCastService[] = "\x0b_googlecast\x04_tcp\x05local";
+
+// What the handler did not get to parse. The filter counts the rest.
+struct ReceiveStats {
+  std::uint64_t mTruncated = 0;
+  std::uint64_t mUnparsed = 0;
+  std::uint64_t mLearned = 0;
+};
+
+// Filter and parse every packet of a batch in one pass, with one arena
+// reset between packets. Responses are learned into cache, if there is
+// one. Nothing is printed here, outcomes are only counted.
+static void HandleBatch(const mnet::MNetBatch& batch,
+                        dns_message::DNSPacketFilter& filter,
+                        arena::Arena& arena, ReceiveStats& stats,
+                        dns_message::DNSRecordCache* cache = nullptr)
+{
+  for (const mnet::MNetBatch::Packet& packet : batch) {
+    if (packet.mTruncated) {
+      stats.mTruncated++;
+      continue;
+    }
+    if (filter.Classify(packet.mData, packet.mLength) !=
+        dns_message::DNSPacketFilter::ACCEPT) {
+      continue;
+    }
+    arena.Reset();
+    dns_message::DNSMessage msg{
+        gsl::span<const char>(packet.mData, packet.mLength), &arena};
+    // Only the header is validated, the sections are parsed on use
+    if (!msg.ProcessMessageLazily()) {
+      stats.mUnparsed++;
+    } else if (cache != nullptr && msg.GetHeader().GetQRField()) {
+      stats.mLearned +=
+          cache->AddResponse(msg, mnet::Reactor::Now() / 1000000);
+    }
+  }
+}
+
+// Print the filter verdicts and receive stats of the filters given
+static void PrintReceiveStats(
+    const std::vector<const dns_message::DNSPacketFilter*>& filters,
+    const std::vector<const ReceiveStats*>& stats)
+{
+  using Filter = dns_message::DNSPacketFilter;
+  for (int v = 0; v < Filter::VERDICT_COUNT; v++) {
+    const Filter::eVerdict verdict = static_cast<Filter::eVerdict>(v);
+    unsigned long long count = 0;
+    for (const Filter* f : filters) {
+      count += f->GetCount(verdict);
+    }
+    printf("%s: %llu\n", Filter::VerdictName(verdict), count);
+  }
+  ReceiveStats total;
+  for (const ReceiveStats* s : stats) {
+    total.mTruncated += s->mTruncated;
+    total.mUnparsed += s->mUnparsed;
+    total.mLearned += s->mLearned;
+  }
+  printf("Truncated: %llu, unparsed: %llu, records learned: %llu\n",
+         static_cast<unsigned long long>(total.mTruncated),
+         static_cast<unsigned long long>(total.mUnparsed),
+         static_cast<unsigned long long>(total.mLearned));
+}
+
+// One socket of the dual stack responder, with its own batch, ring and
+// transmit queue. Both feed the same handler. The batch receives into
+// jumbo buffers, as the ring does, so a message up to the 9000 bytes of
+// RFC 6762 17 is not truncated.
+struct Endpoint {
+  mnet::MNet mNet;
+  mnet::MNetBatch mBatch;
+  mnet::MNetUring mRing;
+  mnet::MNetSendQueue mSendQueue;
+
+  Endpoint(int family, mnet::BufferPool& pool)
+      : mNet(family), mBatch(pool, mnet::BufferPool::CLASS_JUMBO) {}
+};
+
+// Expire the records of a DNSRecordCache on a reactor timer, armed for
+// the next expiry only
+class CacheExpiry {
+  dns_message::DNSRecordCache& mCache;
+  mnet::Reactor& mReactor;
+  mnet::Reactor::TimerId mTimer = 0;
+  /* When mTimer runs, zero when it is not armed */
+  std::uint64_t mArmedMs = 0;
+
+public:
+  CacheExpiry(dns_message::DNSRecordCache& cache, mnet::Reactor& reactor)
+      : mCache(cache), mReactor(reactor) {}
+
+  // Call after the cache may have changed
+  void Rearm() {
+    const std::uint64_t next = mCache.GetNextExpiry();
+    if (next == mArmedMs) {
+      return;
+    }
+    if (mArmedMs != 0) {
+      mReactor.CancelTimer(mTimer);
+      mArmedMs = 0;
+    }
+    if (next == 0) {
+      return;
+    }
+    const std::uint64_t now_ms = mnet::Reactor::Now() / 1000000;
+    mTimer = mReactor.AddTimer(next > now_ms ? next - now_ms : 0, [this]() {
+      mArmedMs = 0;
+      mCache.Expire(mnet::Reactor::Now() / 1000000);
+      Rearm();
+    });
+    mArmedMs = next;
+  }
+};
+
+// Workers only answer queries, responses from other devices are dropped
+// in the kernel
+static mnet::MdnsSocketFilter ResponderFilter()
+{
+  mnet::MdnsSocketFilter filter;
+  filter.mRole = mnet::MdnsSocketFilter::ROLE_RESPONDER;
+  return filter;
+}
+
+// Set up net to receive mDNS on every eligible interface. Both queries
+// and responses are kept, the responses feed the cache.
+static bool OpenSocket(mnet::MNet& net, std::string& errmsg)
+{
+  if (!net.CreateSocket(errmsg)) {
+    errmsg = "CreateSocket() failed: " + errmsg;
+    return false;
+  }
+  if (!net.DisableMulticastLoop(errmsg)) {
+    errmsg = "DisableMulticastLoop() failed: " + errmsg;
+    return false;
+  }
+  if (!net.AddMulticastMembership(errmsg)) {
+    errmsg = "AddMulticastMembership() failed: " + errmsg;
+    return false;
+  }
+  std::string filter_err;
+  if (!net.SetFilter(mnet::MdnsSocketFilter(), filter_err)) {
+    // Still correct without it, the packet filter checks the header too
+    printf("SetFilter() failed: %s\n", filter_err.c_str());
+  }
+  return true;
+}
+
+// What one receive worker parses with, nothing of it is shared
+struct WorkerState {
+  dns_message::DNSPacketFilter mFilter;
+  arena::Arena mArena;
+  ReceiveStats mStats;
+};
+
+// The state is also kept in states, to be read once the workers stopped
+static mnet::Reactor::BatchHandler MakeWorkerHandler(
+    std::vector<std::shared_ptr<WorkerState>>& states)
+{
+  std::shared_ptr<WorkerState> state = std::make_shared<WorkerState>();
+  state->mFilter.AddName(kGoogleCastService, sizeof(kGoogleCastService));
+  states.push_back(state);
+  return [state](const mnet::MNetBatch& b) {
+    HandleBatch(b, state->mFilter, state->mArena, state->mStats);
+  };
+}
+
+// Receive on count SO_REUSEPORT sockets per family, one thread each,
+// while this thread only waits for a stop signal
+static int RunWorkers(std::size_t count)
 {
   std::string errmsg;
-  mnet::MNet mnet;
-  if (!mnet.CreateSocket(errmsg)) {
-    printf("CreateSocket() failed: %s\n", errmsg.c_str());
+  mnet::Reactor reactor;
+  std::vector<std::shared_ptr<WorkerState>> states;
+  mnet::ReceiveWorkers v4;
+  mnet::ReceiveWorkers v6;
+  auto factory = [&states](std::size_t) { return MakeWorkerHandler(states); };
+
+  // Block the stop signals before the workers inherit the mask
+  if (!reactor.Open(errmsg)) {
+    printf("Open() failed: %s\n", errmsg.c_str());
     return -1;
   }
-  if (!mnet.DisableMulticastLoop(errmsg)) {
-    printf("DisableMulticastLoop() failed: %s\n", errmsg.c_str());
-    return -1;
+  std::size_t listening = 0;
+  for (mnet::ReceiveWorkers* w : {&v4, &v6}) {
+    const int family = w == &v6 ? AF_INET6 : AF_INET;
+    const char* name = family == AF_INET6 ? "IPv6" : "IPv4";
+    if (!w->Start(family, count, true, factory, errmsg)) {
+      printf("%s: %s\n", name, errmsg.c_str());
+      continue;
+    }
+    printf("%s: %zu workers\n", name, w->GetCount());
+    if (!w->SetFilter(ResponderFilter(), errmsg)) {
+      printf("%s: SetFilter() failed: %s\n", name, errmsg.c_str());
+    }
+    listening++;
   }
-  if (!mnet.AddMulticastMembership(errmsg)) {
-    printf("AddMulticastMembership() failed: %s\n", errmsg.c_str());
+  if (listening == 0) {
     return -1;
   }
-  printf("AddMulticastMembership() said: %s\n", errmsg.c_str());
-  if (!mnet.Poll(errmsg)) {
-    printf("Poll() failed: %s\n", errmsg.c_str());
+  if (!reactor.Run(errmsg)) {
+    printf("Run() failed: %s\n", errmsg.c_str());
     return -1;
   }
-  printf("Poll() said: %s\n", errmsg.c_str());
+  v4.Stop();
+  v6.Stop();
+  reactor.Close();
+  printf("Stopped by signal %d\n", reactor.GetStopSignal());
+  std::vector<const dns_message::DNSPacketFilter*> filters;
+  std::vector<const ReceiveStats*> stats;
+  for (const std::shared_ptr<WorkerState>& state : states) {
+    filters.push_back(&state->mFilter);
+    stats.push_back(&state->mStats);
+  }
+  PrintReceiveStats(filters, stats);
+  return 0;
+}
 
-  char* msgbuf;
-  size_t msgbuflen;
-  if (!mnet.Read(&msgbuf, msgbuflen, errmsg)) {
-    printf("Read() failed: %s\n", errmsg.c_str());
+// Usage: 5ycast [--io-uring | --workers N]
+int main(int argc, char** argv)
+{
+  if (argc > 2 && strcmp(argv[1], "--workers") == 0) {
+    const int count = std::atoi(argv[2]);
+    if (count <= 0) {
+      printf("--workers needs a positive count\n");
+      return -1;
+    }
+    return RunWorkers(count);
+  }
+  const bool use_uring = argc > 1 && strcmp(argv[1], "--io-uring") == 0;
+  std::string errmsg;
+  mnet::Reactor reactor;
+  dns_message::DNSPacketFilter filter;
+  // sizeof includes the terminating nul, which is the root label
+  filter.AddName(kGoogleCastService, sizeof(kGoogleCastService));
+
+  // The reactor is closed before these go away
+  mnet::BufferPool pool;
+  arena::Arena arena;
+  Endpoint v4(AF_INET, pool);
+  Endpoint v6(AF_INET6, pool);
+  dns_message::DNSRecordCache cache(mnet::Reactor::Now() / 1000000);
+  CacheExpiry expiry(cache, reactor);
+  ReceiveStats stats;
+  auto handler = [&filter, &arena, &stats, &cache,
+                  &expiry](const mnet::MNetBatch& b) {
+    HandleBatch(b, filter, arena, stats, &cache);
+    expiry.Rearm();
+  };
+  if (!reactor.Open(errmsg)) {
+    printf("Open() failed: %s\n", errmsg.c_str());
     return -1;
   }
-  if (msgbuflen == 0) {
-    printf("Read() said: %s\n", errmsg.c_str());
-  } else {
-    printf("Read() said: %s\n", errmsg.c_str());
-    printf("Read %zd bytes: '%s'\n\n", msgbuflen, msgbuf);
-    dns_message::DNSMessage msg{msgbuf, msgbuflen};
-    if(!msg.ProcessMessage()) {
-      printf("Parsing incoming message failed\n");
-    } else {
-      printf("%s\n", msg.Stringify().c_str());
+  std::size_t listening = 0;
+  for (Endpoint* e : {&v4, &v6}) {
+    const char* family = e->mNet.GetFamily() == AF_INET6 ? "IPv6" : "IPv4";
+    if (!OpenSocket(e->mNet, errmsg)) {
+      // A host without IPv6, or without IPv4, is still served
+      printf("%s: %s\n", family, errmsg.c_str());
+      continue;
+    }
+    printf("%s: %s\n", family, errmsg.c_str());
+    if (use_uring && !e->mRing.Open(e->mNet, pool, errmsg)) {
+      printf("%s: io_uring is unavailable, using recvmmsg: %s\n", family,
+             errmsg.c_str());
     }
+    if (e->mRing.IsOpen()) {
+      if (!reactor.AddRing(e->mRing, e->mBatch, handler, errmsg)) {
+        printf("AddRing() failed: %s\n", errmsg.c_str());
+        return -1;
+      }
+    } else if (!reactor.AddSocket(e->mNet, e->mBatch, handler, errmsg)) {
+      printf("AddSocket() failed: %s\n", errmsg.c_str());
+      return -1;
+    }
+    if (!reactor.AddSendQueue(e->mNet, e->mSendQueue, errmsg)) {
+      printf("AddSendQueue() failed: %s\n", errmsg.c_str());
+      return -1;
+    }
+    listening++;
+  }
+  if (listening == 0) {
+    return -1;
+  }
+  if (!reactor.Run(errmsg)) {
+    printf("Run() failed: %s\n", errmsg.c_str());
+    return -1;
+  }
+  reactor.Close();
+  printf("Stopped by signal %d\n", reactor.GetStopSignal());
+  for (Endpoint* e : {&v4, &v6}) {
+    const mnet::MNetSendQueue& q = e->mSendQueue;
+    printf("%s: sent %llu datagrams, %.1f per sendmmsg(), %llu failed\n",
+           e->mNet.GetFamily() == AF_INET6 ? "IPv6" : "IPv4",
+           static_cast<unsigned long long>(q.GetSent()),
+           q.GetPacketsPerCall(),
+           static_cast<unsigned long long>(q.GetSendErrors()));
   }
-  printf("Everything ran successfully!\n");
+  PrintReceiveStats({&filter}, {&stats});
+  printf("%zu records cached\n", cache.GetCount());
   return 0;
 }
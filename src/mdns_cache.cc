@@ -0,0 +1,404 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "mdns_cache.h"
+
+namespace dns_message {
+
+constexpr DNSRecordCache::Id DNSRecordCache::kNone;
+
+/* The cache-flush bit shares the CLASS field */
+static const std::uint16_t kCacheFlush = DNSMessageWriter::kCacheFlush;
+static const std::size_t kMaxNameLength = 255;
+
+// FNV-1a over the name without case, then the type and class
+std::uint64_t DNSRecordCache::HashKey(gsl::span<const char> name,
+                                      std::uint16_t type,
+                                      std::uint16_t rrclass)
+{
+  std::uint64_t h = 14695981039346656037ULL;
+  for (char c : name) {
+    h = (h ^ fold_case(c)) * 1099511628211ULL;
+  }
+  const unsigned char tail[] = {
+    static_cast<unsigned char>(type >> 8), static_cast<unsigned char>(type),
+    static_cast<unsigned char>(rrclass >> 8),
+    static_cast<unsigned char>(rrclass),
+  };
+  for (unsigned char c : tail) {
+    h = (h ^ c) * 1099511628211ULL;
+  }
+  return h;
+}
+
+bool DNSRecordCache::NameEqual(gsl::span<const char> a,
+                               gsl::span<const char> b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::ptrdiff_t i = 0; i < a.size(); i++) {
+    if (fold_case(a[i]) != fold_case(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static inline std::uint16_t get_u16(const char* p)
+{
+  return std::uint16_t(std::uint8_t(p[0]) << 8) | std::uint8_t(p[1]);
+}
+
+static bool AppendName(const DNSName& name, std::string& out)
+{
+  char buf[kMaxNameLength];
+  const std::size_t len = name.CopyTo(buf, sizeof(buf));
+  out.append(buf, len);
+  return len != 0;
+}
+
+bool DNSRecordCache::CanonicalRData(const DNSRR& rr, std::string& out)
+{
+  const DNSRData& rdata = rr.GetRData();
+  out.clear();
+  switch (rr.GetRRType()) {
+    case DNSRR::RR_PTR:
+      AppendName(rdata.GetPtrDName(), out);
+      break;
+    case DNSRR::RR_SRV: {
+      const std::uint16_t fixed[] = {
+        rdata.GetPriority(), rdata.GetWeight(), rdata.GetPort(),
+      };
+      for (std::uint16_t v : fixed) {
+        out.push_back(static_cast<char>(v >> 8));
+        out.push_back(static_cast<char>(v));
+      }
+      AppendName(rdata.GetTarget(), out);
+      break;
+    }
+    case DNSRR::RR_NSEC:
+      AppendName(rdata.GetNextDomainName(), out);
+      out.append(rdata.GetTypeBitMaps().data(),
+                 rdata.GetTypeBitMaps().size());
+      break;
+    default: {
+      const DNSRData::NameLayout* const layout =
+          DNSRData::GetNameLayout(rr.GetRRType());
+      if (layout != nullptr) {
+        // Pointers in the RDATA only mean something in the packet it
+        // came in, keep the names whole
+        if (layout->mPreference) {
+          out.push_back(static_cast<char>(rdata.GetPreference() >> 8));
+          out.push_back(static_cast<char>(rdata.GetPreference()));
+        }
+        if (!AppendName(rdata.GetFirstName(), out) ||
+            (layout->mNames == 2 &&
+             !AppendName(rdata.GetSecondName(), out))) {
+          return false;
+        }
+        out.append(rdata.GetFixed().data(), rdata.GetFixed().size());
+      } else if (rdata.IsOpaque()) {
+        // A, AAAA, TXT and the undecoded types without names are their
+        // RDATA as is
+        out.assign(rdata.GetRaw().data(), rdata.GetRaw().size());
+      } else {
+        // It may hold a compressed name we cannot follow
+        return false;
+      }
+      break;
+    }
+  }
+  // A name that did not copy leaves nothing, which no record has
+  return !out.empty() || rr.GetRDLength() == 0;
+}
+
+DNSRecordCache::DNSRecordCache(std::uint64_t now_ms, std::size_t max_records)
+    : mMaxRecords(max_records), mWheel(now_ms)
+{
+}
+
+DNSRecordCache::Id DNSRecordCache::Find(std::uint64_t hash,
+                                        gsl::span<const char> name,
+                                        std::uint16_t type,
+                                        std::uint16_t rrclass,
+                                        gsl::span<const char> rdata) const
+{
+  const auto bucket = mBuckets.find(hash);
+  if (bucket == mBuckets.end()) {
+    return kNone;
+  }
+  for (Id id = bucket->second; id != kNone; id = mEntries[id].mNext) {
+    const Record& r = mEntries[id].mRecord;
+    if (r.mType == type && r.mRRClass == rrclass &&
+        r.mRData.size() == std::size_t(rdata.size()) &&
+        std::memcmp(r.mRData.data(), rdata.data(), rdata.size()) == 0 &&
+        NameEqual(name, r.mName)) {
+      return id;
+    }
+  }
+  return kNone;
+}
+
+bool DNSRecordCache::Add(const DNSRR& rr, std::uint64_t now_ms)
+{
+  char namebuf[kMaxNameLength];
+  std::string rdata;
+  const std::size_t namelen =
+      rr.GetOwnerName().CopyTo(namebuf, sizeof(namebuf));
+  if (namelen == 0 || !CanonicalRData(rr, rdata)) {
+    return false;
+  }
+  const gsl::span<const char> name(namebuf, namelen);
+  const std::uint16_t type = rr.GetRRType();
+  const std::uint16_t rrclass = rr.GetRRClass() & ~kCacheFlush;
+  const std::uint64_t hash = HashKey(name, type, rrclass);
+  const std::uint64_t flush_at = now_ms + kFlushDelayMs;
+
+  // RFC 6762 10.2: the rest of the RRSet goes, except what arrived in
+  // the last second, which is the rest of this same announcement. A
+  // goodbye only speaks for its own record.
+  if ((rr.GetRRClass() & kCacheFlush) != 0 && rr.GetTTL() != 0) {
+    const auto bucket = mBuckets.find(hash);
+    Id id = bucket == mBuckets.end() ? kNone : bucket->second;
+    for (; id != kNone; id = mEntries[id].mNext) {
+      Record& r = mEntries[id].mRecord;
+      if (r.mType == type && r.mRRClass == rrclass &&
+          r.mReceivedMs + kFlushDelayMs <= now_ms &&
+          r.mExpiresMs > flush_at && r.mRData != rdata &&
+          NameEqual(name, r.mName)) {
+        r.mExpiresMs = flush_at;
+        mWheel.Schedule(id, flush_at);
+      }
+    }
+  }
+
+  const gsl::span<const char> rdspan(rdata.data(), rdata.size());
+  Id id = Find(hash, name, type, rrclass, rdspan);
+  if (rr.GetTTL() == 0) {
+    // A goodbye for a record we do not have changes nothing
+    if (id != kNone && mEntries[id].mRecord.mExpiresMs > flush_at) {
+      mEntries[id].mRecord.mExpiresMs = flush_at;
+      mWheel.Schedule(id, flush_at);
+    }
+    return true;
+  }
+  if (id == kNone) {
+    if (mCount >= mMaxRecords) {
+      mRefused++;
+      return false;
+    }
+    if (mFree != kNone) {
+      id = mFree;
+      mFree = mEntries[id].mNext;
+    } else {
+      id = mEntries.size();
+      mEntries.emplace_back();
+    }
+    Entry& e = mEntries[id];
+    e.mRecord.mName.assign(namebuf, namelen);
+    e.mRecord.mRData = std::move(rdata);
+    e.mRecord.mType = type;
+    e.mRecord.mRRClass = rrclass;
+    e.mHash = hash;
+    // Insert at the head of the chain, or start one
+    auto bucket = mBuckets.emplace(hash, kNone).first;
+    e.mNext = bucket->second;
+    bucket->second = id;
+    mCount++;
+  }
+  Record& r = mEntries[id].mRecord;
+  r.mTTL = rr.GetTTL();
+  r.mReceivedMs = now_ms;
+  r.mExpiresMs = now_ms + std::uint64_t(r.mTTL) * 1000;
+  mWheel.Schedule(id, r.mExpiresMs);
+  return true;
+}
+
+std::size_t DNSRecordCache::AddResponse(const DNSMessage& msg,
+                                        std::uint64_t now_ms)
+{
+  std::size_t added = 0;
+  if (!msg.GetHeader().GetQRField()) {
+    return 0;
+  }
+  for (const DNSRRs* rrs : {&msg.GetAnswers(), &msg.GetAdditionals()}) {
+    for (const DNSRR& rr : *rrs) {
+      if (Add(rr, now_ms)) {
+        added++;
+      }
+    }
+  }
+  return added;
+}
+
+void DNSRecordCache::Remove(Id id)
+{
+  Entry& e = mEntries[id];
+  auto bucket = mBuckets.find(e.mHash);
+  if (bucket->second == id) {
+    if (e.mNext == kNone) {
+      mBuckets.erase(bucket);
+    } else {
+      bucket->second = e.mNext;
+    }
+  } else {
+    Id prev = bucket->second;
+    while (mEntries[prev].mNext != id) {
+      prev = mEntries[prev].mNext;
+    }
+    mEntries[prev].mNext = e.mNext;
+  }
+  mWheel.Cancel(id);
+  // The strings keep their storage for the next record in this entry
+  e.mNext = mFree;
+  mFree = id;
+  mCount--;
+}
+
+std::size_t DNSRecordCache::Lookup(gsl::span<const char> name,
+                                   std::uint16_t type, std::uint16_t rrclass,
+                                   std::uint64_t now_ms, const Record** out,
+                                   std::size_t max) const
+{
+  std::size_t count = 0;
+  rrclass &= ~kCacheFlush;
+  const auto bucket = mBuckets.find(HashKey(name, type, rrclass));
+  if (bucket == mBuckets.end()) {
+    return 0;
+  }
+  for (Id id = bucket->second; id != kNone; id = mEntries[id].mNext) {
+    const Record& r = mEntries[id].mRecord;
+    if (r.mType == type && r.mRRClass == rrclass && r.mExpiresMs > now_ms &&
+        NameEqual(name, r.mName)) {
+      if (count < max) {
+        out[count] = &r;
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+std::size_t DNSRecordCache::Lookup(const DNSName& name, std::uint16_t type,
+                                   std::uint16_t rrclass,
+                                   std::uint64_t now_ms, const Record** out,
+                                   std::size_t max) const
+{
+  char buf[kMaxNameLength];
+  const std::size_t len = name.CopyTo(buf, sizeof(buf));
+  if (len == 0) {
+    return 0;
+  }
+  return Lookup(gsl::span<const char>(buf, len), type, rrclass, now_ms, out,
+                max);
+}
+
+// A cached record as a known answer, names compressed again where the
+// type allows it
+static bool WriteKnownAnswer(DNSMessageWriter& writer,
+                             const DNSRecordCache::Record& r,
+                             std::uint32_t ttl)
+{
+  const gsl::span<const char> name(r.mName.data(), r.mName.size());
+  const gsl::span<const char> rdata(r.mRData.data(), r.mRData.size());
+  switch (r.mType) {
+    case DNSRR::RR_PTR:
+      return writer.AddPtr(DNSMessage::SECTION_AN, name, r.mRRClass, ttl,
+                           rdata);
+    case DNSRR::RR_SRV:
+      // CanonicalRData always has the fixed fields and a target
+      return writer.AddSrv(DNSMessage::SECTION_AN, name, r.mRRClass, ttl,
+                           get_u16(rdata.data()), get_u16(rdata.data() + 2),
+                           get_u16(rdata.data() + 4), rdata.subspan(6));
+    default:
+      return writer.AddRR(DNSMessage::SECTION_AN, name, r.mType, r.mRRClass,
+                          ttl, rdata);
+  }
+}
+
+std::size_t DNSRecordCache::WriteQuery(
+    const Question* questions, std::size_t count, std::uint64_t now_ms,
+    std::size_t mtu, std::vector<std::vector<char>>& packets) const
+{
+  const std::size_t first = packets.size();
+  std::vector<char> buf(mtu);
+  DNSMessageWriter writer(gsl::span<char>(buf.data(), buf.size()));
+  for (std::size_t i = 0; i < count; i++) {
+    if (!writer.AddQuestion(questions[i].mName, questions[i].mType,
+                            questions[i].mRRClass)) {
+      return 0;
+    }
+  }
+  for (std::size_t i = 0; i < count; i++) {
+    const Question& q = questions[i];
+    // The top bit of QCLASS asks for a unicast response, it is the same
+    // bit as cache-flush
+    const std::uint16_t rrclass = q.mRRClass & ~kCacheFlush;
+    const auto bucket = mBuckets.find(HashKey(q.mName, q.mType, rrclass));
+    Id id = bucket == mBuckets.end() ? kNone : bucket->second;
+    for (; id != kNone; id = mEntries[id].mNext) {
+      const Record& r = mEntries[id].mRecord;
+      /* RFC 6762 7.1:
+           a Multicast DNS querier SHOULD NOT include records in the
+           Known-Answer list whose remaining TTL is less than half of
+           their original TTL. */
+      if (r.mType != q.mType || r.mRRClass != rrclass ||
+          r.mExpiresMs <= now_ms ||
+          (r.mExpiresMs - now_ms) * 2 <= std::uint64_t(r.mTTL) * 1000 ||
+          !NameEqual(q.mName, r.mName)) {
+        continue;
+      }
+      const std::uint32_t ttl = GetRemainingTTL(r, now_ms);
+      if (WriteKnownAnswer(writer, r, ttl)) {
+        continue;
+      }
+      if (writer.GetCount(DNSMessage::SECTION_QD) == 0 &&
+          writer.GetCount(DNSMessage::SECTION_AN) == 0) {
+        // Too large for any packet, the responder will tell us again
+        continue;
+      }
+      // Full: more known answers follow, and the responder waits for them
+      writer.SetFlags(writer.GetFlags() | DNSMessageWriter::kFlagTC);
+      packets.emplace_back(buf.data(), buf.data() + writer.Finish());
+      writer.Reset();
+      WriteKnownAnswer(writer, r, ttl);
+    }
+  }
+  packets.emplace_back(buf.data(), buf.data() + writer.Finish());
+  return packets.size() - first;
+}
+
+std::uint32_t DNSRecordCache::GetRemainingTTL(const Record& r,
+                                              std::uint64_t now_ms)
+{
+  return r.mExpiresMs > now_ms ? (r.mExpiresMs - now_ms) / 1000 : 0;
+}
+
+std::size_t DNSRecordCache::Expire(std::uint64_t now_ms)
+{
+  mExpired.clear();
+  mWheel.Advance(now_ms, mExpired);
+  for (Id id : mExpired) {
+    Remove(id);
+  }
+  return mExpired.size();
+}
+
+} // namespace dns_message
@@ -0,0 +1,187 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <string>
+
+#include "mdns_cache.h"
+#include "mdns_duplicates.h"
+
+namespace dns_message {
+
+/* The cache-flush bit of a record, and the unicast-response bit of a
+   question, are the same top bit of the class */
+static const std::uint16_t kClassTopBit = DNSMessageWriter::kCacheFlush;
+static const std::size_t kMaxNameLength = 255;
+
+void DNSDuplicateSuppressor::Table::Insert(std::uint64_t key,
+                                           std::uint32_t ttl,
+                                           std::uint64_t now_ms,
+                                           std::size_t max)
+{
+  const std::uint64_t expires = now_ms + kHoldMs;
+  Seen& seen = mSeen[key];
+  if (seen.mExpiresMs == expires) {
+    // Twice in one packet, or in one millisecond
+    seen.mTTL = std::max(seen.mTTL, ttl);
+    return;
+  }
+  seen = Seen{expires, ttl};
+  mOrder.emplace_back(key, expires);
+  // The oldest go first when the link is busier than the table is large
+  while (mOrder.size() > max) {
+    const auto it = mSeen.find(mOrder.front().first);
+    if (it != mSeen.end() &&
+        it->second.mExpiresMs == mOrder.front().second) {
+      mSeen.erase(it);
+    }
+    mOrder.pop_front();
+  }
+}
+
+const DNSDuplicateSuppressor::Seen*
+DNSDuplicateSuppressor::Table::Find(std::uint64_t key,
+                                    std::uint64_t now_ms) const
+{
+  const auto it = mSeen.find(key);
+  if (it == mSeen.end() || it->second.mExpiresMs <= now_ms) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+void DNSDuplicateSuppressor::Table::Expire(std::uint64_t now_ms)
+{
+  while (!mOrder.empty() && mOrder.front().second <= now_ms) {
+    const auto it = mSeen.find(mOrder.front().first);
+    if (it != mSeen.end() &&
+        it->second.mExpiresMs == mOrder.front().second) {
+      mSeen.erase(it);
+    }
+    mOrder.pop_front();
+  }
+}
+
+std::uint64_t DNSDuplicateSuppressor::AnswerKey(gsl::span<const char> name,
+                                                std::uint16_t type,
+                                                std::uint16_t rrclass,
+                                                gsl::span<const char> rdata)
+{
+  // FNV-1a carried on from the record's hash
+  std::uint64_t h =
+      DNSRecordCache::HashKey(name, type, rrclass & ~kClassTopBit);
+  for (char c : rdata) {
+    h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+  }
+  return h;
+}
+
+void DNSDuplicateSuppressor::ObserveQuery(const DNSMessage& msg,
+                                          std::uint64_t now_ms)
+{
+  const DNSHeader& header = msg.GetHeader();
+  Expire(now_ms);
+  /* RFC 6762 7.3:
+       and the Known-Answer Section of that query does not contain any
+       records that this host would not also put in its own Known-Answer
+       Section
+
+     We do not compare lists, a query that has one is not noted. */
+  if (header.GetQRField() || header.GetTCField() ||
+      header.GetANCount() != 0) {
+    return;
+  }
+  char namebuf[kMaxNameLength];
+  for (const DNSQuestion& q : msg.GetQuestions()) {
+    const std::size_t len = q.GetQName().CopyTo(namebuf, sizeof(namebuf));
+    if (len == 0 || (q.GetQClass() & kClassTopBit) != 0) {
+      continue;
+    }
+    mQuestions.Insert(DNSRecordCache::HashKey(
+                          gsl::span<const char>(namebuf, len),
+                          q.GetQType(), q.GetQClass()),
+                      0, now_ms, mMaxEntries);
+  }
+}
+
+void DNSDuplicateSuppressor::ObserveResponse(const DNSMessage& msg,
+                                             std::uint64_t now_ms)
+{
+  Expire(now_ms);
+  if (!msg.GetHeader().GetQRField()) {
+    return;
+  }
+  char namebuf[kMaxNameLength];
+  std::string rdata;
+  for (const DNSRRs* rrs : {&msg.GetAnswers(), &msg.GetAdditionals()}) {
+    for (const DNSRR& rr : *rrs) {
+      const std::size_t len =
+          rr.GetOwnerName().CopyTo(namebuf, sizeof(namebuf));
+      if (len == 0 || !DNSRecordCache::CanonicalRData(rr, rdata)) {
+        continue;
+      }
+      mAnswers.Insert(AnswerKey(gsl::span<const char>(namebuf, len),
+                                rr.GetRRType(), rr.GetRRClass(),
+                                gsl::span<const char>(rdata.data(),
+                                                      rdata.size())),
+                      rr.GetTTL(), now_ms, mMaxEntries);
+    }
+  }
+}
+
+bool DNSDuplicateSuppressor::SuppressQuestion(gsl::span<const char> name,
+                                              std::uint16_t type,
+                                              std::uint16_t rrclass,
+                                              std::uint64_t now_ms)
+{
+  if (mQuestions.Find(DNSRecordCache::HashKey(name, type,
+                                              rrclass & ~kClassTopBit),
+                      now_ms) == nullptr) {
+    return false;
+  }
+  mSuppressedQuestions++;
+  return true;
+}
+
+bool DNSDuplicateSuppressor::SuppressAnswer(gsl::span<const char> name,
+                                            std::uint16_t type,
+                                            std::uint16_t rrclass,
+                                            gsl::span<const char> rdata,
+                                            std::uint32_t ttl,
+                                            std::uint64_t now_ms)
+{
+  /* RFC 6762 7.4:
+       If a host is planning to send an answer, and it sees another host
+       on the network send a response message containing the same answer
+       record, and the TTL in that record is not less than the TTL this
+       host would have given, then this host SHOULD treat its own answer
+       as having been sent. */
+  const Seen* seen =
+      mAnswers.Find(AnswerKey(name, type, rrclass, rdata), now_ms);
+  if (seen == nullptr || seen->mTTL < ttl) {
+    return false;
+  }
+  mSuppressedAnswers++;
+  return true;
+}
+
+void DNSDuplicateSuppressor::Expire(std::uint64_t now_ms)
+{
+  mQuestions.Expire(now_ms);
+  mAnswers.Expire(now_ms);
+}
+
+} // namespace dns_message
@@ -0,0 +1,141 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+
+#include "mdns_filter.h"
+#include "mdns_message.h"
+
+namespace dns_message {
+
+static const std::size_t kHeaderLength = 12;
+
+static bool equal_nocase(const unsigned char* a, const unsigned char* b,
+                         std::size_t len)
+{
+  for (std::size_t i = 0; i < len; i++) {
+    if (fold_case(a[i]) != fold_case(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DNSPacketFilter::AddName(const char* const name, std::size_t len)
+{
+  // Validate the name once here, so Classify can trust it
+  std::size_t pos = 0;
+  bool terminated = false;
+  if (name == nullptr) {
+    return false;
+  }
+  while (!terminated && pos < len) {
+    const std::uint8_t nlen = name[pos];
+    if (nlen > 63) {
+      return false;
+    }
+    pos += nlen + 1;
+    terminated = (nlen == 0);
+  }
+  if (!terminated || pos != len) {
+    return false;
+  }
+  mNames.emplace_back(name, len);
+  return true;
+}
+
+// name: the first name of the packet, in place and uncompressed
+// len: octets from name up to and including its root label
+bool DNSPacketFilter::MatchName(const unsigned char* name,
+                                std::size_t len) const
+{
+  // Try each label boundary of the name as the start of a suffix
+  std::size_t pos = 0;
+  while (pos < len) {
+    const std::size_t suffix_len = len - pos;
+    for (const std::string& ours : mNames) {
+      if (ours.size() == suffix_len &&
+          equal_nocase(name + pos,
+                       reinterpret_cast<const unsigned char*>(ours.data()),
+                       suffix_len)) {
+        return true;
+      }
+    }
+    pos += name[pos] + 1;
+  }
+  return false;
+}
+
+// m: a received packet, not yet parsed
+// mlen: length of m
+DNSPacketFilter::eVerdict DNSPacketFilter::Classify(const char* const m,
+                                                    std::size_t mlen)
+{
+  const unsigned char* const p = reinterpret_cast<const unsigned char*>(m);
+  eVerdict verdict = ACCEPT;
+
+  if (m == nullptr || mlen < kHeaderLength) {
+    verdict = DROP_TOO_SHORT;
+  } else if (((p[2] >> 3) & 0xF) != 0) {
+    verdict = DROP_OPCODE;
+  } else if ((p[3] & 0xF) != 0) {
+    verdict = DROP_RCODE;
+  } else if (!mNames.empty()) {
+    const std::uint16_t qdcount = (p[4] << 8) | p[5];
+    const std::uint16_t ancount = (p[6] << 8) | p[7];
+    if (qdcount == 0 && ancount == 0) {
+      verdict = DROP_NO_NAME;
+    } else {
+      // The first question, or the first answer when there are no
+      // questions, begins right after the header. There is nothing
+      // before it to point at, so it is never compressed.
+      std::size_t pos = kHeaderLength;
+      while (pos < mlen && p[pos] != 0 && p[pos] <= 63) {
+        pos += p[pos] + 1;
+      }
+      if (pos >= mlen || p[pos] != 0) {
+        verdict = DROP_MALFORMED_NAME;
+      } else if (!MatchName(p + kHeaderLength, pos + 1 - kHeaderLength)) {
+        verdict = DROP_NAME;
+      }
+    }
+  }
+  mCounters[verdict]++;
+  return verdict;
+}
+
+void DNSPacketFilter::ResetCounters()
+{
+  std::memset(mCounters, 0, sizeof(mCounters));
+}
+
+const char* DNSPacketFilter::VerdictName(eVerdict v)
+{
+  switch (v) {
+    case ACCEPT: return "accept";
+    case DROP_TOO_SHORT: return "too short";
+    case DROP_OPCODE: return "opcode";
+    case DROP_RCODE: return "rcode";
+    case DROP_NO_NAME: return "no name";
+    case DROP_MALFORMED_NAME: return "malformed name";
+    case DROP_NAME: return "name";
+    case VERDICT_COUNT: ;
+  }
+  return "unknown";
+}
+
+} // namespace dns_message
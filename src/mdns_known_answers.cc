@@ -0,0 +1,136 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "mdns_known_answers.h"
+
+namespace dns_message {
+
+constexpr std::uint64_t DNSKnownAnswerAccumulator::kMinDelayMs;
+constexpr std::uint64_t DNSKnownAnswerAccumulator::kMaxDelayMs;
+constexpr DNSKnownAnswerAccumulator::Id DNSKnownAnswerAccumulator::kNone;
+
+/* Fine enough for the 100 ms jitter window */
+static const std::uint64_t kTickMs = 10;
+
+// The interface and the raw source address, port included. The kernel
+// zeroes the padding of the addresses it returns.
+static std::string SourceKey(const struct sockaddr* src, socklen_t srclen,
+                             unsigned ifindex)
+{
+  std::string key(reinterpret_cast<const char*>(&ifindex), sizeof(ifindex));
+  key.append(reinterpret_cast<const char*>(src), srclen);
+  return key;
+}
+
+DNSKnownAnswerAccumulator::DNSKnownAnswerAccumulator(std::uint64_t now_ms,
+                                                     std::size_t max_pending,
+                                                     std::uint32_t seed)
+    : mMaxPending(max_pending), mWheel(now_ms, kTickMs), mRandom(seed)
+{
+}
+
+void DNSKnownAnswerAccumulator::Close(Id id, std::uint64_t now_ms)
+{
+  Entry& e = mEntries[id];
+  mSources.erase(e.mSource);
+  e.mSource.clear();
+  mWheel.Schedule(id, now_ms);
+}
+
+DNSKnownAnswerAccumulator::eAction
+DNSKnownAnswerAccumulator::Add(const DNSMessage& msg,
+                               const struct sockaddr* src, socklen_t srclen,
+                               unsigned ifindex, std::uint64_t known,
+                               std::uint64_t now_ms)
+{
+  const DNSHeader& header = msg.GetHeader();
+  std::string key = SourceKey(src, srclen, ifindex);
+  const auto it = mSources.find(key);
+  const Id open = it == mSources.end() ? kNone : it->second;
+
+  if (header.GetQDCount() == 0) {
+    // Only known answers, for the query this source is sending
+    if (open == kNone) {
+      return IGNORED;
+    }
+    Query& q = mEntries[open].mQuery;
+    q.mKnown |= known;
+    q.mPackets++;
+    if (!header.GetTCField()) {
+      Close(open, now_ms);
+    }
+    return MERGED;
+  }
+  // A new query: the one before it from this source has all it will get
+  if (open != kNone) {
+    Close(open, now_ms);
+  }
+  if (!header.GetTCField()) {
+    return ANSWER_NOW;
+  }
+  if (mCount >= mMaxPending || srclen > sizeof(Query::mSrcAddr)) {
+    mRefused++;
+    return ANSWER_NOW;
+  }
+
+  Id id = mFree;
+  if (id != kNone) {
+    mFree = mEntries[id].mNextFree;
+  } else {
+    id = mEntries.size();
+    mEntries.emplace_back();
+  }
+  Entry& e = mEntries[id];
+  Query& q = e.mQuery;
+  std::memcpy(&q.mSrcAddr, src, srclen);
+  q.mSrcAddrLen = srclen;
+  q.mIfIndex = ifindex;
+  q.mMessage.assign(msg.GetMessage().data(),
+                    msg.GetMessage().data() + msg.GetMessage().size());
+  q.mKnown = known;
+  q.mPackets = 1;
+  e.mSource = key;
+  mSources.emplace(std::move(key), id);
+  mCount++;
+
+  std::uniform_int_distribution<std::uint64_t> delay(kMinDelayMs,
+                                                     kMaxDelayMs);
+  mWheel.Schedule(id, now_ms + delay(mRandom));
+  return HELD;
+}
+
+std::size_t DNSKnownAnswerAccumulator::Release(std::uint64_t now_ms,
+                                               std::vector<Query>& out)
+{
+  mExpired.clear();
+  mWheel.Advance(now_ms, mExpired);
+  for (Id id : mExpired) {
+    Entry& e = mEntries[id];
+    if (!e.mSource.empty()) {
+      mSources.erase(e.mSource);
+      e.mSource.clear();
+    }
+    out.push_back(std::move(e.mQuery));
+    e.mNextFree = mFree;
+    mFree = id;
+    mCount--;
+  }
+  return mExpired.size();
+}
+
+} // namespace dns_message
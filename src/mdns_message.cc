@@ -14,6 +14,7 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <cstdio>
@@ -22,97 +23,153 @@
 
 namespace dns_message {
 
-// m: string for parsing
+// m: string for parsing, copied into the message
 // mlen: length of m
-DNSMessage::DNSMessage(const char* const m, const std::size_t mlen) : mHeader(new DNSHeader),
-                                                                      mRawMsg(m, mlen)
+DNSMessage::DNSMessage(const char* const m, const std::size_t mlen) : DNSMessage(gsl::span<const char>())
 {
+  mRawMsg.assign(m, mlen);
+  mMsg = gsl::span<const char>(mRawMsg.data(), mRawMsg.size());
 }
 
 // Delegating constructor
 // m: string for parsing, cannot contain nul characters
 DNSMessage::DNSMessage(const char* const m) : DNSMessage(m, std::strlen(m)) { }
 
+// m: the received message, parsed in place without being copied
+// arena: where parsed objects are allocated, or nullptr for the heap
+DNSMessage::DNSMessage(gsl::span<const char> m, arena::Arena* arena) :
+    mQuestions(arena::ArenaAllocator<DNSQuestion>(arena)),
+    mRRSection{DNSRRs(arena::ArenaAllocator<DNSRR>(arena)),
+               DNSRRs(arena::ArenaAllocator<DNSRR>(arena)),
+               DNSRRs(arena::ArenaAllocator<DNSRR>(arena))},
+    mMsg(m)
+{
+}
+
 // Process each section of the dns packet until any failure occurs or the
 // message is parsed successfully.
 bool DNSMessage::ProcessMessage()
 {
-  const std::uint8_t header_length = 12;
-  const std::uint8_t an_section = 0;
-  const std::uint8_t ns_section = 1;
-  const std::uint8_t ar_section = 2;
-  std::size_t offset = 0;
-  if (!mHeader->ProcessHeader(mRawMsg.c_str(), mRawMsg.length())) {
-    return false;
-  }
-  if (mHeader->GetQDCount() > 0 &&
-      !ProcessQuestions(mRawMsg.c_str() + header_length,
-                        mRawMsg.length() - header_length,
-                        mHeader->GetQDCount(), offset)) {
-    return false;
-  }
-  if (mHeader->GetANCount() > 0 &&
-      !ProcessRRs(mRawMsg.c_str() + header_length,
-                  mRawMsg.length() - header_length,
-                  mHeader->GetANCount(), offset, an_section)) {
-    return false;
+  return ProcessMessageLazily() && ProcessSections(SECTION_AR);
+}
+
+// Process the header, leaving the sections until they are asked for.
+bool DNSMessage::ProcessMessageLazily()
+{
+  mNameMemo.Clear();
+  mQuestions.clear();
+  for (DNSRRs& rrs : mRRSection) {
+    rrs.clear();
   }
-  if (mHeader->GetNSCount() > 0 &&
-      !ProcessRRs(mRawMsg.c_str() + header_length,
-                  mRawMsg.length() - header_length,
-                  mHeader->GetNSCount(), offset, ns_section)) {
+  mSectionsParsed = 0;
+  mParseError = false;
+  // Sections are parsed against the complete message because compression
+  // pointers are relative to its first octet
+  mReader = DNSWireReader(mMsg);
+  mHeaderParsed = mHeader.ProcessHeader(mReader);
+  return mHeaderParsed;
+}
+
+// Parse every section up to and including last, unless it already was.
+// Sections can only be found by parsing the ones before them.
+bool DNSMessage::ProcessSections(eSection last) const
+{
+  if (!mHeaderParsed) {
     return false;
   }
-  if (mHeader->GetARCount() > 0 &&
-      !ProcessRRs(mRawMsg.c_str() + header_length,
-                  mRawMsg.length() - header_length,
-                  mHeader->GetARCount(), offset, ar_section)) {
-    return false;
+  while (!mParseError && mSectionsParsed <= last) {
+    bool result;
+    switch (mSectionsParsed) {
+      case SECTION_QD:
+        result = ProcessQuestions(mReader, mHeader.GetQDCount());
+        break;
+      case SECTION_AN:
+        result = ProcessRRs(mReader, mHeader.GetANCount(), 0);
+        break;
+      case SECTION_NS:
+        result = ProcessRRs(mReader, mHeader.GetNSCount(), 1);
+        break;
+      default:
+        result = ProcessRRs(mReader, mHeader.GetARCount(), 2);
+        break;
+    }
+    if (!result) {
+      mParseError = true;
+      return false;
+    }
+    mSectionsParsed++;
   }
-  return true;
+  return !mParseError;
+}
+
+const DNSQuestions& DNSMessage::GetQuestions() const
+{
+  ProcessSections(SECTION_QD);
+  return mQuestions;
+}
+
+const DNSRRs& DNSMessage::GetAnswers() const
+{
+  ProcessSections(SECTION_AN);
+  return mRRSection[0];
+}
+
+const DNSRRs& DNSMessage::GetAuthorities() const
+{
+  ProcessSections(SECTION_NS);
+  return mRRSection[1];
+}
+
+const DNSRRs& DNSMessage::GetAdditionals() const
+{
+  ProcessSections(SECTION_AR);
+  return mRRSection[2];
 }
 
 // Parse the question section of the message
-// m: string for parsing
-// mlen: length of m
+// r: cursor at the start of the section, advanced past it
 // qcount: number of questions encapsulated in this section
-// offset: Tracks position within m of processing
-bool DNSMessage::ProcessQuestions(const char* const m, std::size_t mlen,
-                                  std::uint16_t qcount, std::size_t& offset)
+bool DNSMessage::ProcessQuestions(DNSWireReader& r,
+                                  std::uint16_t qcount) const
 {
+  // A question is at least five octets, so a bogus qcount cannot make us
+  // reserve more than the message could hold
+  const std::size_t minimum_qlen = 1 + 2 + 2;
   std::size_t i;
-  std::vector<DNSQuestion> qs;
+  mQuestions.clear();
+  mQuestions.reserve(std::min<std::size_t>(qcount, r.Remaining() / minimum_qlen));
   for (i = 0; i < qcount; i++) {
     DNSQuestion question;
-    if (!question.ProcessQuestion(m, mlen, offset)) {
+    if (!question.ProcessQuestion(r, &mNameMemo)) {
+      mQuestions.clear();
       return false;
     }
-    qs.push_back(std::move(question));
+    mQuestions.push_back(std::move(question));
   }
-  mQuestions = std::move(qs);
   return true;
 }
 
 // Parse the resource record sections of the message
-// m: string for parsing
-// mlen: length of m
-// count: number of questions encapsulated in this section
-// offset: Tracks position within m of processing
+// r: cursor at the start of the section, advanced past it
+// count: number of records encapsulated in this section
 // section: Specifies the section of the message (0: an, 1: ns, 2: ar)
-bool DNSMessage::ProcessRRs(const char* const m, std::size_t mlen,
-                            std::uint16_t count, std::size_t& offset,
-                            std::uint8_t section)
+bool DNSMessage::ProcessRRs(DNSWireReader& r, std::uint16_t count,
+                            std::uint8_t section) const
 {
+  // Likewise a record is at least eleven octets
+  const std::size_t minimum_rr_length = 1 + 10;
   std::size_t i;
-  std::vector<DNSRR> rrs;
+  DNSRRs& rrs = mRRSection[section];
+  rrs.clear();
+  rrs.reserve(std::min<std::size_t>(count, r.Remaining() / minimum_rr_length));
   for (i = 0; i < count; i++) {
     DNSRR rr;
-    if (!rr.ProcessRR(m, mlen, offset)) {
+    if (!rr.ProcessRR(r, &mNameMemo)) {
+      rrs.clear();
       return false;
     }
     rrs.push_back(std::move(rr));
   }
-  mRRSection[section] = std::move(rrs);
   return true;
 }
 
@@ -150,40 +207,51 @@ bool DNSMessage::ProcessName(const char* const m, std::size_t mlen,
   return true;
 }
 
+// static - Decompress a name that ends with a compression pointer
+// m: the complete message
+// mlen: length of m
+// name: the compressed name, its final two octets are the pointer
+// ref: string ref where the labels the pointer refers to are returned,
+//      separated by '.', on success
 bool DNSMessage::DecompressName(const char* const m, const std::size_t mlen,
                                 const std::string& name, std::string& ref)
 {
-  std::string ptrstr;
-  std::uint8_t nlen;
-  const char last_byte2 = name.at(name.size()-2);
-  const char last_byte1 = name.at(name.size()-1);
-
   if (m == nullptr) {
     return false;
   }
+  if (name.size() < 2) {
+    return false;
+  }
+  const std::uint8_t last_byte2 = name.at(name.size()-2);
+  const std::uint8_t last_byte1 = name.at(name.size()-1);
   if ((last_byte2 & 0xC0) != 0xC0) {
     return false;
   }
   // Last byte is a pointer, using message compression
-  std::uint16_t ptr = ((last_byte2 & 0x3F) << 8);
+  std::size_t ptr = ((last_byte2 & 0x3F) << 8);
   ptr |= last_byte1;
-  if (mlen < ptr) {
+  if (mlen <= ptr) {
     return false;
   }
-  if (!ProcessName(m + ptr, mlen - ptr, ptrstr, nlen)) {
+  // Any further pointers in the chain are followed by DNSName
+  DNSName target;
+  if (!target.ProcessName(gsl::span<const char>(m, mlen), ptr)) {
     return false;
   }
-  if (nlen > 1 && (ptrstr.at(nlen-2) & 0xC0) == 0xC0) {
-    // TODO We're not supporting pointer-to-pointer chaining right now.
-    return false;
+  std::string decompressed;
+  for (const std::string& label : target.GetLabels()) {
+    if (!decompressed.empty()) {
+      decompressed += '.';
+    }
+    decompressed += label;
   }
-  ref = std::move(ptrstr);
+  ref = std::move(decompressed);
   return true;
 }
 
 const std::string DNSMessage::Stringify() const
 {
-  return mHeader->Stringify();
+  return mHeader.Stringify();
 }
 
 } // namespace dns_message
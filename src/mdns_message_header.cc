@@ -21,10 +21,11 @@
 namespace dns_message {
 
 // Parse the header of the message
-// m: string for parsing
-// mlen: length of m
-bool DNSHeader::ProcessHeader(const char* const m, const std::size_t mlen)
+// r: cursor at the start of the message, on success it is advanced past
+//    the header
+bool DNSHeader::ProcessHeader(DNSWireReader& r)
 {
+  const std::size_t header_length = 12;
   std::uint16_t id;
   bool qr;
   std::uint8_t opcode;
@@ -32,74 +33,46 @@ bool DNSHeader::ProcessHeader(const char* const m, const std::size_t mlen)
   std::uint8_t rcode;
   std::uint16_t qdcount, ancount, nscount, arcount;
 
-  if (mlen < 12) {
+  if (!r.Has(header_length)) {
     return false;
   }
-  if (m == nullptr) {
-    return false;
-  }
-  const std::string header = std::string(m, mlen);
-  {
-    const std::string id_bytes = header.substr(0, 2);
-    const char* id_bytes_c = id_bytes.c_str();
-    id = (id_bytes_c[0] << 8) | (id_bytes_c[1]);
-  }
+  // Fields are read in place, the header is never copied out of m
+  id = r.U16();
 
   {
-    const std::string byte = header.substr(2, 1);
-    const char* byte_c = byte.c_str();
-    qr = (std::uint8_t(*byte_c) >> 7) == 1;
+    const std::uint8_t byte = r.U8();
+    qr = (byte >> 7) == 1;
     // Drop the lower three bit fields, AND the top bit with 0
-    opcode = (*byte_c >> 3) & 0xF;
-    aa = ((*byte_c >> 2) & 0x1) == 1;
-    tc = ((*byte_c >> 1) & 0x1) == 1;
-    rd = (*byte_c & 0x1) == 1;
+    opcode = (byte >> 3) & 0xF;
+    aa = ((byte >> 2) & 0x1) == 1;
+    tc = ((byte >> 1) & 0x1) == 1;
+    rd = (byte & 0x1) == 1;
   }
 
   {
-    const std::string byte = header.substr(3, 1);
-    const char* byte_c = byte.c_str();
-    ra = (*byte_c >> 7);
-    std::uint8_t z = (*byte_c >> 6) & 0x1;
+    const std::uint8_t byte = r.U8();
+    ra = (byte >> 7);
+    std::uint8_t z = (byte >> 6) & 0x1;
     if (z != 0) {
       return false;
     }
 
-    ad = (*byte_c >> 5) & 0x1;
-    cd = (*byte_c >> 4) & 0x1;
+    ad = (byte >> 5) & 0x1;
+    cd = (byte >> 4) & 0x1;
     // The spec says we should ignore these
     (void)ad;
     (void)cd;
-    rcode = (*byte_c & 0xF);
+    rcode = (byte & 0xF);
     // We should silently ignore messages with non-zero rcode
     if (rcode != 0) {
       return false;
     }
   }
 
-  {
-    const std::string qd_str = header.substr(4, 2);
-    const char* qd_c = qd_str.c_str();
-    qdcount = (qd_c[0] << 8) | qd_c[1];
-  }
-
-  {
-    const std::string an_str = header.substr(6, 2);
-    const char* an_c = an_str.c_str();
-    ancount = (an_c[0] << 8) | an_c[1];
-  }
-
-  {
-    const std::string ns_str = header.substr(8, 2);
-    const char* ns_c = ns_str.c_str();
-    nscount = (ns_c[0] << 8) | ns_c[1];
-  }
-
-  {
-    const std::string ar_str = header.substr(10, 2);
-    const char* ar_c = ar_str.c_str();
-    arcount = (ar_c[0] << 8) | ar_c[1];
-  }
+  qdcount = r.U16();
+  ancount = r.U16();
+  nscount = r.U16();
+  arcount = r.U16();
 
   mMsgID = id;
   mOpCode = opcode;
@@ -117,6 +90,17 @@ bool DNSHeader::ProcessHeader(const char* const m, const std::size_t mlen)
   return true;
 }
 
+// m: string for parsing
+// mlen: length of m
+bool DNSHeader::ProcessHeader(const char* const m, const std::size_t mlen)
+{
+  if (m == nullptr) {
+    return false;
+  }
+  DNSWireReader r(gsl::span<const char>(m, mlen));
+  return ProcessHeader(r);
+}
+
 bool DNSHeader::ProcessHeader(const char* const m)
 {
   return ProcessHeader(m, strlen(m));
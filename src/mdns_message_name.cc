@@ -0,0 +1,251 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+/* RFC 1035:
+     labels          63 octets or less
+     names           255 octets or less
+*/
+static const std::size_t kMaxNameLength = 255;
+
+// Chromecast responses chain PTR -> instance -> service -> domain, anything
+// much deeper than that is not a real name
+static const std::uint8_t kMaxPointerDepth = 16;
+
+void DNSNameMemo::Clear()
+{
+  for (Entry& e : mEntries) {
+    e.mOffset = kEmpty;
+  }
+}
+
+bool DNSNameMemo::Find(std::uint16_t offset, std::uint8_t& length,
+                       std::uint8_t& label_count) const
+{
+  std::size_t slot = Slot(offset);
+  for (std::size_t i = 0; i < kSize; i++) {
+    const Entry& e = mEntries[(slot + i) & (kSize - 1)];
+    if (e.mOffset == kEmpty) {
+      return false;
+    }
+    if (e.mOffset == offset) {
+      length = e.mLength;
+      label_count = e.mLabelCount;
+      return true;
+    }
+  }
+  return false;
+}
+
+void DNSNameMemo::Insert(std::uint16_t offset, std::uint8_t length,
+                         std::uint8_t label_count)
+{
+  std::size_t slot = Slot(offset);
+  for (std::size_t i = 0; i < kSize; i++) {
+    Entry& e = mEntries[(slot + i) & (kSize - 1)];
+    if (e.mOffset == kEmpty || e.mOffset == offset) {
+      e.mOffset = offset;
+      e.mLength = length;
+      e.mLabelCount = label_count;
+      return;
+    }
+  }
+}
+
+// Parse the name starting at offset. The labels are validated in place and
+// nothing is copied out of m.
+//
+// RFC 1035 4.1.4:
+//   In order to reduce the size of messages, the domain system utilizes a
+//   compression scheme which eliminates the repetition of domain names in
+//   a message. In this scheme, an entire domain name or a list of labels
+//   at the end of a domain name is replaced with a pointer to a prior
+//   occurance of the same name.
+//
+// Pointers are followed until the root label. Each one must point before
+// the labels it terminates, which guarantees the chain cannot loop, and
+// the chain is also limited to kMaxPointerDepth pointers.
+//
+// r: cursor at the name within the complete message, on success it is
+//    advanced past the name as it appears on the wire
+// memo: suffixes already decompressed from the message, may be nullptr
+bool DNSName::ProcessName(DNSWireReader& r, DNSNameMemo* memo)
+{
+  const gsl::span<const char> m = r.GetMessage();
+  const std::size_t mlen = m.size();
+  const std::size_t offset = r.GetOffset();
+  // The pointers followed, and the length and label count decompressed
+  // before each of them, so their suffixes can be memoized
+  std::uint16_t targets[kMaxPointerDepth];
+  std::size_t length_before[kMaxPointerDepth];
+  std::size_t labels_before[kMaxPointerDepth];
+  std::uint8_t depth = 0;
+  std::size_t length = 0;
+  std::size_t labels = 0;
+  std::size_t wire_end = 0;
+  std::size_t run_start = offset;
+  std::size_t pos = offset;
+
+  if (m.data() == nullptr) {
+    return false;
+  }
+  // Offsets are stored in 16 bits, no datagram is larger than this
+  if (mlen > UINT16_MAX) {
+    return false;
+  }
+  for (;;) {
+    if (pos >= mlen) {
+      // Running past the end of the message without finding a zero
+      // length label
+      return false;
+    }
+    const std::uint8_t nlen = r.At(pos);
+    if ((nlen & 0xC0) == 0xC0) {
+      if (mlen - pos < 2) {
+        return false;
+      }
+      if (wire_end == 0) {
+        // The name ends on the wire with its first pointer
+        wire_end = pos + 2;
+      }
+      const std::uint16_t target = ((nlen & 0x3F) << 8) | r.At(pos + 1);
+      if (target >= run_start || depth == kMaxPointerDepth) {
+        return false;
+      }
+      std::uint8_t suffix_length, suffix_labels;
+      if (memo != nullptr &&
+          memo->Find(target, suffix_length, suffix_labels)) {
+        length += suffix_length;
+        labels += suffix_labels;
+        if (length > kMaxNameLength) {
+          return false;
+        }
+        break;
+      }
+      targets[depth] = target;
+      length_before[depth] = length;
+      labels_before[depth] = labels;
+      depth++;
+      pos = target;
+      run_start = target;
+      continue;
+    }
+    if ((nlen & 0xC0) != 0) {
+      // The 01 and 10 label types are reserved
+      return false;
+    }
+    length += nlen + 1;
+    if (length > kMaxNameLength) {
+      return false;
+    }
+    if (nlen == 0) {
+      if (wire_end == 0) {
+        wire_end = pos + 1;
+      }
+      break;
+    }
+    labels++;
+    pos += nlen + 1;
+  }
+
+  if (memo != nullptr) {
+    for (std::uint8_t i = 0; i < depth; i++) {
+      memo->Insert(targets[i], length - length_before[i],
+                   labels - labels_before[i]);
+    }
+  }
+  mMsg = m;
+  mOffset = offset;
+  mWireLength = wire_end - offset;
+  mLength = length;
+  mLabelCount = labels;
+  r.Seek(wire_end);
+  return true;
+}
+
+// m: the complete message
+// offset: position within m where the name begins, on success it is
+//         advanced past the name as it appears on the wire
+// memo: suffixes already decompressed from m, may be nullptr
+bool DNSName::ProcessName(gsl::span<const char> m, std::size_t& offset,
+                          DNSNameMemo* memo)
+{
+  DNSWireReader r(m, offset);
+  if (!ProcessName(r, memo)) {
+    return false;
+  }
+  offset = r.GetOffset();
+  return true;
+}
+
+std::vector<std::string> DNSName::GetLabels() const
+{
+  std::vector<std::string> labels;
+  if (mWireLength == 0) {
+    return labels;
+  }
+  // The name was validated when it was parsed, including every pointer
+  const unsigned char* const p =
+      reinterpret_cast<const unsigned char*>(mMsg.data());
+  std::size_t pos = mOffset;
+  labels.reserve(mLabelCount);
+  for (;;) {
+    const std::uint8_t nlen = p[pos];
+    if ((nlen & 0xC0) == 0xC0) {
+      pos = ((nlen & 0x3F) << 8) | p[pos + 1];
+      continue;
+    }
+    if (nlen == 0) {
+      break;
+    }
+    labels.emplace_back(mMsg.data() + pos + 1, nlen);
+    pos += nlen + 1;
+  }
+  return labels;
+}
+
+std::size_t DNSName::CopyTo(char* out, std::size_t outlen) const
+{
+  if (mWireLength == 0 || out == nullptr || outlen < mLength) {
+    return 0;
+  }
+  const unsigned char* const p =
+      reinterpret_cast<const unsigned char*>(mMsg.data());
+  std::size_t pos = mOffset;
+  std::size_t len = 0;
+  for (;;) {
+    const std::uint8_t nlen = p[pos];
+    if ((nlen & 0xC0) == 0xC0) {
+      pos = ((nlen & 0x3F) << 8) | p[pos + 1];
+      continue;
+    }
+    std::memcpy(out + len, p + pos, nlen + 1);
+    len += nlen + 1;
+    if (nlen == 0) {
+      break;
+    }
+    pos += nlen + 1;
+  }
+  return len;
+}
+
+} // namespace dns_message
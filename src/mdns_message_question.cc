@@ -20,54 +20,50 @@ namespace dns_message {
 
 DNSQuestion::DNSQuestion(DNSQuestion&& q)
 {
-  mQNames = std::move(q.mQNames);
+  mQName = q.mQName;
   mQType = q.mQType;
   mQClass = q.mQClass;
 }
 
 // Parse the question from the message
+// r: cursor at the question, on success it is advanced past it
+// memo: decompressed names of this message, may be nullptr
+bool DNSQuestion::ProcessQuestion(DNSWireReader& r, DNSNameMemo* memo)
+{
+  const std::uint8_t minimum_qlen = 1 + 2 + 2;
+  const std::size_t start = r.GetOffset();
+  if (!r.Has(minimum_qlen)) {
+    return false;
+  }
+  DNSName qname;
+  if (!qname.ProcessName(r, memo)) {
+    return false;
+  }
+  // The name was either terminated by a nul byte or a pointer. In either
+  // case the remaining bytes are the meta fields
+  if (!r.Has(4)) {
+    r.Seek(start);
+    return false;
+  }
+  mQName = qname;
+  mQType = r.U16();
+  mQClass = r.U16();
+  return true;
+}
+
 // m: string for parsing
 // mlen: length of m
 // offset: position within m where parsing should begin
+// memo: decompressed names of this message, may be nullptr
 bool DNSQuestion::ProcessQuestion(const char* const m, std::size_t mlen,
-                                  std::size_t& offset)
+                                  std::size_t& offset, DNSNameMemo* memo)
 {
-  const std::uint8_t minimum_qlen = 1 + 2 + 2;
-  if (mlen < minimum_qlen) {
+  DNSWireReader r(gsl::span<const char>(m, mlen), offset);
+  if (!ProcessQuestion(r, memo)) {
     return false;
   }
-  std::vector<std::string> qnames;
-  std::string name;
-  std::uint8_t nlen;
-  std::uint16_t next_label = offset;
-  while (DNSMessage::ProcessName(m + next_label,
-                                 mlen - next_label,
-                                 name,
-                                 nlen)) {
-    bool is_ptr = (nlen == 1 && ((name[0] & 0xc0) == 0xc0));
-    qnames.push_back(std::move(name));
-    next_label += nlen + 1;
-    if (nlen == 0 || is_ptr) {
-      // This was either a nul byte or a pointer. In either case the question
-      // is complete and the remaining bytes are the meta fields
-      if (mlen - next_label < 4) {
-        return false;
-      }
-      mQNames = std::move(qnames);
-      mQType = (std::uint8_t(m[next_label++]) << 8);
-      mQType |= std::uint8_t(m[next_label++]);
-      mQClass = (std::uint8_t(m[next_label++]) << 8);
-      mQClass |= std::uint8_t(m[next_label++]);
-      offset = next_label;
-      return true;
-    }
-    // If we didn't find a zero length label, but we are running past the
-    // end of the message, then processing failed.
-    if (mlen < next_label) {
-      return false;
-    }
-  }
-  return false;
+  offset = r.GetOffset();
+  return true;
 }
 
 } // namespace dns_messge
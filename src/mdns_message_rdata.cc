@@ -0,0 +1,317 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+// Decode the RDATA of a resource record
+// r: cursor at the RDATA within the complete message, names in the RDATA
+//    may point into it. On success it is advanced past the RDATA.
+// type: the RR type, selecting the decoder
+// rdlength: length of the RDATA
+// memo: decompressed names of this message, may be nullptr
+bool DNSRData::ProcessRData(DNSWireReader& r, std::uint16_t type,
+                            std::uint16_t rdlength, DNSNameMemo* memo)
+{
+  const std::size_t start = r.GetOffset();
+  bool result;
+
+  if (r.GetMessage().data() == nullptr) {
+    return false;
+  }
+  // The only bounds check the fixed size fields below need
+  if (!r.Has(rdlength)) {
+    return false;
+  }
+  mType = type;
+  switch (type) {
+    case DNSRR::RR_PTR:
+      // At least the root label
+      result = (rdlength >= 1) && mName.ProcessName(r, memo);
+      break;
+    case DNSRR::RR_A:
+      // RFC 1035: A 32 bit Internet address.
+      result = (rdlength == 4) && r.ReadSpan(rdlength, mData);
+      break;
+    case DNSRR::RR_AAAA:
+      // RFC 3596: A 128 bit IPv6 address is encoded in the data portion
+      // of an AAAA resource record in network byte order.
+      result = (rdlength == 16) && r.ReadSpan(rdlength, mData);
+      break;
+    case DNSRR::RR_SRV:
+      result = ProcessSrv(r, rdlength, memo);
+      break;
+    case DNSRR::RR_TXT:
+      result = ProcessTxt(r, rdlength);
+      break;
+    case DNSRR::RR_NSEC:
+      result = ProcessNsec(r, rdlength, memo);
+      break;
+    case DNSRR::RR_NS:
+    case DNSRR::RR_MD:
+    case DNSRR::RR_MF:
+    case DNSRR::RR_CNAME:
+    case DNSRR::RR_SOA:
+    case DNSRR::RR_MB:
+    case DNSRR::RR_MG:
+    case DNSRR::RR_MR:
+    case DNSRR::RR_MINFO:
+    case DNSRR::RR_MX:
+    case DNSRR::RR_RP:
+    case DNSRR::RR_AFSDB:
+    case DNSRR::RR_RT:
+    case DNSRR::RR_PX:
+    case DNSRR::RR_KX:
+    case DNSRR::RR_DNAME:
+      result = ProcessNames(r, rdlength, *GetNameLayout(type), memo);
+      break;
+    default:
+      // Kept as is, so a record we do not understand does not cost us
+      // the rest of the message. It may be empty, as an EDNS OPT record
+      // without options is.
+      result = r.ReadSpan(rdlength, mData);
+      break;
+  }
+  // The decoded fields must account for exactly rdlength octets
+  if (!result || r.GetOffset() - start != rdlength) {
+    r.Seek(start);
+    return false;
+  }
+  return true;
+}
+
+// m: the complete message
+// offset: position within m where the RDATA begins, on success it is
+//         advanced past the RDATA
+bool DNSRData::ProcessRData(gsl::span<const char> m, std::size_t& offset,
+                            std::uint16_t type, std::uint16_t rdlength,
+                            DNSNameMemo* memo)
+{
+  DNSWireReader r(m, offset);
+  if (!ProcessRData(r, type, rdlength, memo)) {
+    return false;
+  }
+  offset = r.GetOffset();
+  return true;
+}
+
+/* RFC 2782:
+     The format of the SRV RR
+
+       _Service._Proto.Name TTL Class SRV Priority Weight Port Target
+
+   RFC 6762:
+     Unicast DNS does not allow name compression for the target host in
+     an SRV record [...] Multicast DNS allows name compression in the
+     rdata of SRV records.
+*/
+bool DNSRData::ProcessSrv(DNSWireReader& r, std::uint16_t rdlength,
+                          DNSNameMemo* memo)
+{
+  // Three 16 bit fields and at least the root label
+  const std::uint16_t minimum_srv_length = 2 + 2 + 2 + 1;
+  if (rdlength < minimum_srv_length) {
+    return false;
+  }
+  mPriority = r.U16();
+  mWeight = r.U16();
+  mPort = r.U16();
+  return mName.ProcessName(r, memo);
+}
+
+const DNSRData::NameLayout* DNSRData::GetNameLayout(std::uint16_t type)
+{
+  static const NameLayout kName = { false, 1, 0 };
+  static const NameLayout kPreferenceName = { true, 1, 0 };
+  static const NameLayout kTwoNames = { false, 2, 0 };
+  static const NameLayout kPreferenceTwoNames = { true, 2, 0 };
+  // RFC 1035: MNAME RNAME SERIAL REFRESH RETRY EXPIRE MINIMUM
+  static const NameLayout kSoa = { false, 2, 5 * 4 };
+  switch (type) {
+    case DNSRR::RR_NS:
+    case DNSRR::RR_MD:
+    case DNSRR::RR_MF:
+    case DNSRR::RR_CNAME:
+    case DNSRR::RR_MB:
+    case DNSRR::RR_MG:
+    case DNSRR::RR_MR:
+    case DNSRR::RR_DNAME:
+      return &kName;
+    case DNSRR::RR_MX:
+    case DNSRR::RR_AFSDB:
+    case DNSRR::RR_RT:
+    case DNSRR::RR_KX:
+      return &kPreferenceName;
+    case DNSRR::RR_MINFO:
+    case DNSRR::RR_RP:
+      return &kTwoNames;
+    case DNSRR::RR_PX:
+      return &kPreferenceTwoNames;
+    case DNSRR::RR_SOA:
+      return &kSoa;
+    default:
+      return nullptr;
+  }
+}
+
+// Names are decompressed through the message like any other, so the
+// record can be written into a message of its own
+bool DNSRData::ProcessNames(DNSWireReader& r, std::uint16_t rdlength,
+                            const NameLayout& layout, DNSNameMemo* memo)
+{
+  const std::size_t end = r.GetOffset() + rdlength;
+  if (layout.mPreference) {
+    if (rdlength < 2) {
+      return false;
+    }
+    mPriority = r.U16();
+  }
+  // Every name is at least the root label
+  if (r.GetOffset() >= end || !mName.ProcessName(r, memo)) {
+    return false;
+  }
+  if (layout.mNames == 2 &&
+      (r.GetOffset() >= end || !mName2.ProcessName(r, memo))) {
+    return false;
+  }
+  if (r.GetOffset() > end || end - r.GetOffset() != layout.mFixed) {
+    return false;
+  }
+  return r.ReadSpan(layout.mFixed, mData);
+}
+
+bool DNSRData::IsOpaque() const
+{
+  switch (mType) {
+    case DNSRR::RR_PTR:
+    case DNSRR::RR_SRV:
+    case DNSRR::RR_NSEC:
+    /* RFC 3597 4:
+         Receiving servers MUST decompress domain names in RRs of
+         well-known type, and SHOULD also decompress RRs of type RP,
+         AFSDB, RT, SIG, PX, NXT, NAPTR, and SRV.
+    */
+    case DNSRR::RR_SIG:
+    case DNSRR::RR_NXT:
+    case DNSRR::RR_NAPTR:
+      return false;
+    default:
+      return GetNameLayout(mType) == nullptr;
+  }
+}
+
+/* RFC 1035:
+     TXT-DATA        One or more <character-string>s.
+
+   RFC 6763:
+     The format of each constituent string within the DNS TXT record is
+     a single length byte, followed by 0-255 bytes of text data.
+*/
+bool DNSRData::ProcessTxt(DNSWireReader& r, std::uint16_t rdlength)
+{
+  /* RFC 6763 6.1:
+       a TXT record containing zero strings is disallowed by RFC 1035,
+       [...] If a DNS-SD implementation receives such a record, it is
+       treated as if it were a single empty string.
+  */
+  static const char kEmptyTxt[] = {0};
+  if (rdlength == 0) {
+    mData = gsl::span<const char>(kEmptyTxt, sizeof(kEmptyTxt));
+    return true;
+  }
+  const std::size_t start = r.GetOffset();
+  const std::size_t end = start + rdlength;
+  std::size_t pos = start;
+  while (pos < end) {
+    pos += r.At(pos) + 1;
+  }
+  if (pos != end) {
+    return false;
+  }
+  return r.ReadSpan(rdlength, mData);
+}
+
+/* RFC 4034:
+     The RDATA of the NSEC RR is as shown below:
+
+       Next Domain Name, Type Bit Maps
+
+     The Type Bit Maps field identifies the RRset types that exist at
+     the NSEC RR's owner name. [...] Each block has the form
+     (Window Block # | Bitmap Length | Bitmap), where the bitmap length
+     is from 1 to 32 octets.
+
+   RFC 6762:
+     The Next Domain Name field contains the record's own name. [...]
+     Multicast DNS allows name compression in the rdata of NSEC
+     records.
+*/
+bool DNSRData::ProcessNsec(DNSWireReader& r, std::uint16_t rdlength,
+                           DNSNameMemo* memo)
+{
+  const std::size_t end = r.GetOffset() + rdlength;
+  // At least the root label for the next domain name
+  if (rdlength < 1 || !mName.ProcessName(r, memo) || r.GetOffset() > end) {
+    return false;
+  }
+  const std::size_t bitmaps = r.GetOffset();
+  std::size_t pos = bitmaps;
+  int last_window = -1;
+  while (pos < end) {
+    if (end - pos < 2) {
+      return false;
+    }
+    const std::uint8_t window = r.At(pos);
+    const std::uint8_t length = r.At(pos + 1);
+    // Blocks appear in increasing window order
+    if (window <= last_window || length == 0 || length > 32) {
+      return false;
+    }
+    last_window = window;
+    pos += 2 + length;
+  }
+  if (pos != end) {
+    return false;
+  }
+  return r.ReadSpan(end - bitmaps, mData);
+}
+
+// Whether the NSEC type bit maps include type
+bool DNSRData::HasType(std::uint16_t type) const
+{
+  const unsigned char* const p =
+      reinterpret_cast<const unsigned char*>(mData.data());
+  const std::size_t len = mData.size();
+  const std::uint8_t window = type >> 8;
+  const std::uint8_t bit = type & 0xFF;
+  std::size_t pos = 0;
+  if (mType != DNSRR::RR_NSEC) {
+    return false;
+  }
+  // Validated when it was decoded
+  while (pos < len) {
+    const std::uint8_t length = p[pos + 1];
+    if (p[pos] == window) {
+      return (bit / 8) < length && (p[pos + 2 + bit / 8] & (0x80 >> (bit % 8)));
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+} // namespace dns_message
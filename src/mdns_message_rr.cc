@@ -18,156 +18,66 @@
 
 namespace dns_message {
 
-// Parse the names from the message
-// m: string for parsing
-// mlen: length of m
-// offset: position within m where parsing should begin
-// aName: vector containing the successfully parsed names
-static bool processNames(const char* const m, std::size_t mlen,
-                       std::size_t& offset, std::vector<std::string>& aName)
-{
-  std::vector<std::string> names;
-  std::string name;
-  std::uint8_t nlen;
-  std::uint16_t next_label = offset;
-  while (DNSMessage::ProcessName(m + next_label,
-                                 mlen - next_label,
-                                 name,
-                                 nlen)) {
-    next_label += nlen + 1;
-    if (nlen == 0) {
-      aName = std::move(names);
-      offset = next_label;
-      return true;
-    }
-    // If we didn't find a zero length label, but we are running past the
-    // end of the message, then processing failed.
-    if (mlen < next_label) {
-      return false;
-    }
-    names.push_back(std::move(name));
-  }
-
-  return false;
-}
-
-bool DNSRR::ProcessPtrRData(DNSRData** rdata, const char* const m,
-                            std::size_t mlen, std::size_t& offset,
-                            std::uint16_t rrdlength)
-{
-  const std::size_t saved_offset = offset;
-  std::vector<std::string> dnames;
-  if (!processNames(m, mlen, offset, dnames)) {
-    return false;
-  }
-
-  if ((offset - saved_offset) != rrdlength) {
-    return false;
-  }
-  *rdata = new DNSPtrRData(std::move(dnames));
-  return true;
-}
-
-bool DNSRR::ProcessRData(DNSRData** rdata, const char* const m,
-                         std::size_t mlen, std::size_t& offset,
-                         eRRType type, std::uint16_t rrdlength)
-{
-  if (m == nullptr) {
-    return false;
-  }
-  if (rrdlength == 0) {
-    return false;
-  }
-  switch (type) {
-    case RR_PTR: {
-      return ProcessPtrRData(rdata, m, mlen, offset, rrdlength);
-    }
-    case RR_A:
-    case RR_NS:
-    case RR_MD:
-    case RR_MF:
-    case RR_CNAME:
-    case RR_SOA:
-    case RR_MB:
-    case RR_MG:
-    case RR_MR:
-    case RR_NULL:
-    case RR_WKS:
-    case RR_HINFO:
-    case RR_MINFO:
-    case RR_MX:
-    case RR_TXT:
-      ;
-  }
-  return false;
-}
-
 // Parse the resource record section of the message
-// m: string for parsing
-// mlen: length of m
-// offset: position within m where parsing should begin
-bool DNSRR::ProcessRR(const char* const m, std::size_t mlen,
-                      std::size_t& offset)
+// r: cursor at the record, on success it is advanced past it
+// memo: decompressed names of this message, may be nullptr
+bool DNSRR::ProcessRR(DNSWireReader& r, DNSNameMemo* memo)
 {
   // Assuming 1 byte for 0 length plus 10 bytes for meta fields
   const uint8_t minimum_name_length = 1;
   const uint8_t rr_meta_length = 10;
   const uint8_t minimum_rr_length = rr_meta_length + minimum_name_length;
-  std::vector<std::string> name;
+  const std::size_t start = r.GetOffset();
+  DNSName name;
   std::uint16_t rrtype;
   std::uint16_t rrclass;
   std::uint32_t rrttl;
   std::uint16_t rrdlength;
-  DNSRData* rdata;
-  eRRType rrtype_e;
+  DNSRData rdata;
 
-  if (mlen < minimum_rr_length) {
-    return false;
-  }
-  if (!processNames(m, mlen, offset, name)) {
+  if (!r.Has(minimum_rr_length)) {
     return false;
   }
-  if (mlen - offset < rr_meta_length) {
+  if (!name.ProcessName(r, memo)) {
     return false;
   }
-
-  rrtype = m[offset++] << 8;
-  rrtype |= m[offset++];
-
-  rrclass = m[offset++] << 8;
-  rrclass |= m[offset++];
-
-  rrttl = m[offset++] << 8;
-  rrttl |= m[offset++];
-  rrttl <<= 16;
-  rrttl = m[offset++] << 8;
-  rrttl |= m[offset++];
-
-  rrdlength = m[offset++] << 8;
-  rrdlength |= m[offset++];
-
-  rrtype_e = eRRType(rrtype);
-
-  if (!ProcessRData(&rdata, m, mlen, offset, rrtype_e, rrdlength)) {
+  // TYPE, CLASS, TTL and RDLENGTH are checked together
+  if (!r.Has(rr_meta_length)) {
+    r.Seek(start);
     return false;
   }
+  rrtype = r.U16();
+  rrclass = r.U16();
+  rrttl = r.U32();
+  rrdlength = r.U16();
 
-  if (rdata == nullptr) {
+  if (!rdata.ProcessRData(r, rrtype, rrdlength, memo)) {
+    r.Seek(start);
     return false;
   }
 
-  mName = std::move(name);
-  mRRType = rrtype_e;
+  mName = name;
+  mRRType = eRRType(rrtype);
   mRRClass = rrclass;
   mTTL = rrttl;
   mRDLength = rrdlength;
-  mRData.reset(rdata);
+  mRData = rdata;
   return true;
 }
 
-void DNSPtrRData::AddPtrNames(const std::vector<std::string>&& names)
+// m: string for parsing
+// mlen: length of m
+// offset: position within m where parsing should begin
+// memo: decompressed names of this message, may be nullptr
+bool DNSRR::ProcessRR(const char* const m, std::size_t mlen,
+                      std::size_t& offset, DNSNameMemo* memo)
 {
-  mPtrDName = names;
+  DNSWireReader r(gsl::span<const char>(m, mlen), offset);
+  if (!ProcessRR(r, memo)) {
+    return false;
+  }
+  offset = r.GetOffset();
+  return true;
 }
 
 } // namespace dns_message
@@ -0,0 +1,147 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+/* RFC 6763 6.3:
+     The key MUST be at least one character. DNS-SD TXT record strings
+     beginning with an '=' character (i.e., the key is missing) MUST be
+     silently ignored.
+
+   RFC 6763 6.4:
+     If there is no '=' in a DNS-SD TXT record string, then it is a
+     boolean attribute, simply identified as being present, with no
+     value.
+
+     If a client receives a TXT record containing the same key more than
+     once, then the client MUST silently ignore all but the first
+     occurrence of that attribute.
+*/
+void DNSTxtIndex::ProcessTxt(gsl::span<const char> txt)
+{
+  const char* const p = txt.data();
+  const std::size_t len = txt.size();
+  std::size_t pos = 0;
+
+  mCount = 0;
+  mTruncated = false;
+  while (pos < len) {
+    const std::uint8_t slen = p[pos];
+    const char* const str = p + pos + 1;
+    if (slen > len - pos - 1) {
+      // The last string overruns the span, keep what was read so far
+      mTruncated = true;
+      break;
+    }
+    pos += slen + 1;
+    if (slen == 0 || str[0] == '=') {
+      continue;
+    }
+    const char* const eq =
+        static_cast<const char*>(std::memchr(str, '=', slen));
+    const std::size_t keylen = eq == nullptr ? slen : eq - str;
+    if (FindEntry(str, keylen) != nullptr) {
+      continue;
+    }
+    if (mCount == kMaxEntries) {
+      mTruncated = true;
+      break;
+    }
+    Entry& e = mEntries[mCount++];
+    e.mKey = gsl::span<const char>(str, keylen);
+    e.mHasValue = (eq != nullptr);
+    if (e.mHasValue) {
+      e.mValue = gsl::span<const char>(eq + 1, slen - keylen - 1);
+    } else {
+      e.mValue = gsl::span<const char>();
+    }
+  }
+}
+
+bool DNSTxtIndex::ProcessTxt(const DNSRData& rdata)
+{
+  if (rdata.GetType() != DNSRR::RR_TXT) {
+    return false;
+  }
+  ProcessTxt(rdata.GetTxtData());
+  return true;
+}
+
+const DNSTxtIndex::Entry* DNSTxtIndex::FindEntry(const char* key,
+                                                 std::size_t keylen) const
+{
+  for (std::size_t i = 0; i < mCount; i++) {
+    const Entry& e = mEntries[i];
+    if (std::size_t(e.mKey.size()) != keylen) {
+      continue;
+    }
+    std::size_t j = 0;
+    while (j < keylen && fold_case(e.mKey.data()[j]) == fold_case(key[j])) {
+      j++;
+    }
+    if (j == keylen) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+
+bool DNSTxtIndex::HasKey(const char* key) const
+{
+  return FindEntry(key, std::strlen(key)) != nullptr;
+}
+
+bool DNSTxtIndex::Find(const char* key, gsl::span<const char>& value) const
+{
+  return Find(key, std::strlen(key), value);
+}
+
+bool DNSTxtIndex::Find(const char* key, std::size_t keylen,
+                       gsl::span<const char>& value) const
+{
+  const Entry* e = FindEntry(key, keylen);
+  if (e == nullptr) {
+    return false;
+  }
+  value = e->mValue;
+  return true;
+}
+
+// static
+bool DNSTxtIndex::Equal(gsl::span<const char> a, gsl::span<const char> b)
+{
+  return a.size() == b.size() &&
+         (a.size() == 0 || std::memcmp(a.data(), b.data(), a.size()) == 0);
+}
+
+// static - 64 bit FNV-1a over the RDATA, so a cache can remember what it
+// last saw without keeping the packet
+std::uint64_t DNSTxtIndex::Digest(gsl::span<const char> txt)
+{
+  std::uint64_t h = 0xcbf29ce484222325ULL;
+  for (const char c : txt) {
+    h ^= std::uint8_t(c);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+} // namespace dns_message
@@ -0,0 +1,572 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <cstring>
+
+#include "mdns_message.h"
+
+namespace dns_message {
+
+static const std::size_t kHeaderLength = 12;
+static const std::size_t kMaxNameLength = 255;
+static const std::size_t kMaxLabels = kMaxNameLength / 2;
+static const std::uint8_t kMaxPointerDepth = 16;
+
+/* RFC 1035 4.1.4:
+     The OFFSET field specifies an offset from the start of the message
+     (i.e., the first octet of the ID field in the domain header).
+
+   It is 14 bits wide, a suffix written past it cannot be pointed to.
+*/
+static const std::size_t kMaxPointerTarget = 0x3FFF;
+
+static const std::uint32_t kFnvBasis = 2166136261u;
+static const std::uint32_t kFnvPrime = 16777619u;
+
+DNSMessageWriter::DNSMessageWriter(gsl::span<char> buf, std::uint16_t msgid,
+                                   std::uint16_t flags)
+    : mBuf(buf)
+{
+  Reset(msgid, flags);
+}
+
+void DNSMessageWriter::Reset(std::uint16_t msgid, std::uint16_t flags)
+{
+  for (Suffix& s : mSuffixes) {
+    s.mOffset = 0;
+  }
+  mSuffixCount = 0;
+  mLength = kHeaderLength;
+  mMsgID = msgid;
+  mFlags = flags;
+  for (std::uint16_t& c : mCounts) {
+    c = 0;
+  }
+  mSection = DNSMessage::SECTION_QD;
+  mRRSection = DNSMessage::SECTION_QD;
+  mRRStart = 0;
+  mRDataStart = 0;
+}
+
+bool DNSMessageWriter::Put(const void* data, std::size_t len)
+{
+  if (mLength > std::size_t(mBuf.size()) ||
+      std::size_t(mBuf.size()) - mLength < len) {
+    return false;
+  }
+  std::memcpy(mBuf.data() + mLength, data, len);
+  mLength += len;
+  return true;
+}
+
+bool DNSMessageWriter::PutU16(std::uint16_t v)
+{
+  const unsigned char b[2] = {
+    static_cast<unsigned char>(v >> 8),
+    static_cast<unsigned char>(v),
+  };
+  return Put(b, sizeof(b));
+}
+
+bool DNSMessageWriter::PutU32(std::uint32_t v)
+{
+  const unsigned char b[4] = {
+    static_cast<unsigned char>(v >> 24),
+    static_cast<unsigned char>(v >> 16),
+    static_cast<unsigned char>(v >> 8),
+    static_cast<unsigned char>(v),
+  };
+  return Put(b, sizeof(b));
+}
+
+// True if the name written at offset, after following its pointers, is
+// the uncompressed name. Names are compared without case, like RFC 6762
+// compares them. An entry of the suffix table may be stale after a
+// record was aborted, so nothing about offset is trusted.
+bool DNSMessageWriter::MatchSuffix(std::size_t offset,
+                                   const unsigned char* name) const
+{
+  const unsigned char* const p =
+      reinterpret_cast<const unsigned char*>(mBuf.data());
+  std::size_t pos = offset;
+  std::size_t run_start = offset;
+  std::uint8_t depth = 0;
+
+  for (;;) {
+    if (pos >= mLength) {
+      return false;
+    }
+    const std::uint8_t nlen = p[pos];
+    if ((nlen & 0xC0) == 0xC0) {
+      if (mLength - pos < 2) {
+        return false;
+      }
+      const std::size_t target = ((nlen & 0x3F) << 8) | p[pos + 1];
+      if (target >= run_start || depth == kMaxPointerDepth) {
+        return false;
+      }
+      depth++;
+      pos = target;
+      run_start = target;
+      continue;
+    }
+    if (nlen != name[0]) {
+      return false;
+    }
+    if (nlen == 0) {
+      return true;
+    }
+    if (mLength - pos < std::size_t(nlen) + 1) {
+      return false;
+    }
+    for (std::size_t i = 1; i <= nlen; i++) {
+      if (fold_case(p[pos + i]) != fold_case(name[i])) {
+        return false;
+      }
+    }
+    pos += nlen + 1;
+    name += nlen + 1;
+  }
+}
+
+std::uint16_t DNSMessageWriter::FindSuffix(std::uint32_t hash,
+                                           const unsigned char* name) const
+{
+  const std::size_t slot = hash & (kSuffixTableSize - 1);
+  for (std::size_t i = 0; i < kSuffixTableSize; i++) {
+    const Suffix& s = mSuffixes[(slot + i) & (kSuffixTableSize - 1)];
+    if (s.mOffset == 0) {
+      return 0;
+    }
+    if (s.mHash == hash && MatchSuffix(s.mOffset, name)) {
+      return s.mOffset;
+    }
+  }
+  return 0;
+}
+
+void DNSMessageWriter::InsertSuffix(std::uint32_t hash, std::uint16_t offset)
+{
+  // Keep some slots empty so a miss ends quickly. Once the table is full
+  // later names are still written, only without being pointed to.
+  if (mSuffixCount >= kSuffixTableSize * 3 / 4) {
+    return;
+  }
+  const std::size_t slot = hash & (kSuffixTableSize - 1);
+  for (std::size_t i = 0; i < kSuffixTableSize; i++) {
+    Suffix& s = mSuffixes[(slot + i) & (kSuffixTableSize - 1)];
+    if (s.mOffset == 0) {
+      s.mHash = hash;
+      s.mOffset = offset;
+      mSuffixCount++;
+      return;
+    }
+  }
+}
+
+// Write an uncompressed name, replacing its longest suffix that was
+// already written by a pointer.
+//
+// RFC 1035 4.1.4:
+//   The compression scheme allows a domain name in a message to be
+//   represented as either:
+//     - a sequence of labels ending in a zero octet
+//     - a pointer
+//     - a sequence of labels ending with a pointer
+//
+// Every suffix of the name is hashed once, from the root up, so finding
+// the longest known suffix costs one table probe per label.
+bool DNSMessageWriter::PutName(gsl::span<const char> name)
+{
+  const unsigned char* const n =
+      reinterpret_cast<const unsigned char*>(name.data());
+  const std::size_t nlen = name.size();
+  std::size_t starts[kMaxLabels];
+  std::uint32_t hashes[kMaxLabels];
+  std::uint16_t offsets[kMaxLabels];
+  std::size_t count = 0;
+  std::size_t pos = 0;
+
+  if (n == nullptr) {
+    return false;
+  }
+  for (;;) {
+    if (pos >= nlen) {
+      return false;
+    }
+    const std::uint8_t len = n[pos];
+    if (len > 63 || pos + len + 1 > kMaxNameLength) {
+      return false;
+    }
+    if (len == 0) {
+      break;
+    }
+    starts[count++] = pos;
+    pos += len + 1;
+  }
+
+  std::uint32_t hash = kFnvBasis;
+  for (std::size_t i = count; i-- > 0;) {
+    const unsigned char* const label = n + starts[i];
+    hash = (hash ^ label[0]) * kFnvPrime;
+    for (std::size_t j = 1; j <= label[0]; j++) {
+      hash = (hash ^ fold_case(label[j])) * kFnvPrime;
+    }
+    hashes[i] = hash;
+  }
+
+  const std::size_t start = mLength;
+  std::size_t written = 0;
+  bool result = true;
+  std::size_t i;
+  for (i = 0; i < count; i++) {
+    const std::uint16_t target = FindSuffix(hashes[i], n + starts[i]);
+    if (target != 0) {
+      result = PutU16(0xC000 | target);
+      break;
+    }
+    offsets[written++] = mLength;
+    if (!Put(n + starts[i], n[starts[i]] + 1)) {
+      result = false;
+      break;
+    }
+  }
+  if (result && i == count) {
+    result = Put("", 1);
+  }
+  if (!result) {
+    mLength = start;
+    return false;
+  }
+  for (std::size_t j = 0; j < written; j++) {
+    if (offsets[j] <= kMaxPointerTarget) {
+      InsertSuffix(hashes[j], offsets[j]);
+    }
+  }
+  return true;
+}
+
+bool DNSMessageWriter::AddQuestion(gsl::span<const char> qname,
+                                   std::uint16_t qtype, std::uint16_t qclass)
+{
+  if (mSection != DNSMessage::SECTION_QD || mRRStart != 0 ||
+      mCounts[DNSMessage::SECTION_QD] == UINT16_MAX) {
+    return false;
+  }
+  const std::size_t start = mLength;
+  if (!PutName(qname) || !PutU16(qtype) || !PutU16(qclass)) {
+    mLength = start;
+    return false;
+  }
+  mCounts[DNSMessage::SECTION_QD]++;
+  return true;
+}
+
+bool DNSMessageWriter::AddQuestion(const DNSName& qname, std::uint16_t qtype,
+                                   std::uint16_t qclass)
+{
+  char name[kMaxNameLength];
+  const std::size_t len = qname.CopyTo(name, sizeof(name));
+  if (len == 0) {
+    return false;
+  }
+  return AddQuestion(gsl::span<const char>(name, len), qtype, qclass);
+}
+
+bool DNSMessageWriter::BeginRR(DNSMessage::eSection section,
+                               gsl::span<const char> name,
+                               std::uint16_t type, std::uint16_t rrclass,
+                               std::uint32_t ttl)
+{
+  if (section == DNSMessage::SECTION_QD || section < mSection ||
+      mRRStart != 0 || mCounts[section] == UINT16_MAX) {
+    return false;
+  }
+  const std::size_t start = mLength;
+  // RDLENGTH is filled in by EndRR
+  if (!PutName(name) || !PutU16(type) || !PutU16(rrclass) || !PutU32(ttl) ||
+      !PutU16(0)) {
+    mLength = start;
+    return false;
+  }
+  mRRSection = section;
+  mRRStart = start;
+  mRDataStart = mLength;
+  return true;
+}
+
+bool DNSMessageWriter::BeginRR(DNSMessage::eSection section,
+                               const DNSName& name, std::uint16_t type,
+                               std::uint16_t rrclass, std::uint32_t ttl)
+{
+  char owner[kMaxNameLength];
+  const std::size_t len = name.CopyTo(owner, sizeof(owner));
+  if (len == 0) {
+    return false;
+  }
+  return BeginRR(section, gsl::span<const char>(owner, len), type, rrclass,
+                 ttl);
+}
+
+bool DNSMessageWriter::WriteRData(gsl::span<const char> data)
+{
+  if (mRRStart == 0) {
+    return false;
+  }
+  return Put(data.data(), data.size());
+}
+
+bool DNSMessageWriter::WriteRDataU16(std::uint16_t v)
+{
+  if (mRRStart == 0) {
+    return false;
+  }
+  return PutU16(v);
+}
+
+bool DNSMessageWriter::WriteRDataName(gsl::span<const char> name)
+{
+  if (mRRStart == 0) {
+    return false;
+  }
+  return PutName(name);
+}
+
+bool DNSMessageWriter::WriteRDataName(const DNSName& name)
+{
+  char rdname[kMaxNameLength];
+  const std::size_t len = name.CopyTo(rdname, sizeof(rdname));
+  if (len == 0) {
+    return false;
+  }
+  return WriteRDataName(gsl::span<const char>(rdname, len));
+}
+
+bool DNSMessageWriter::EndRR()
+{
+  if (mRRStart == 0) {
+    return false;
+  }
+  const std::size_t rdlength = mLength - mRDataStart;
+  if (rdlength > UINT16_MAX) {
+    return false;
+  }
+  mBuf[mRDataStart - 2] = static_cast<char>(rdlength >> 8);
+  mBuf[mRDataStart - 1] = static_cast<char>(rdlength);
+  mCounts[mRRSection]++;
+  mSection = mRRSection;
+  mRRStart = 0;
+  return true;
+}
+
+void DNSMessageWriter::AbortRR()
+{
+  if (mRRStart == 0) {
+    return;
+  }
+  // Suffixes written by the record stay in the table, MatchSuffix
+  // rejects them once they are overwritten
+  mLength = mRRStart;
+  mRRStart = 0;
+}
+
+bool DNSMessageWriter::AddRR(DNSMessage::eSection section,
+                             gsl::span<const char> name, std::uint16_t type,
+                             std::uint16_t rrclass, std::uint32_t ttl,
+                             gsl::span<const char> rdata)
+{
+  if (!BeginRR(section, name, type, rrclass, ttl)) {
+    return false;
+  }
+  if (WriteRData(rdata) && EndRR()) {
+    return true;
+  }
+  AbortRR();
+  return false;
+}
+
+bool DNSMessageWriter::AddPtr(DNSMessage::eSection section,
+                              gsl::span<const char> name,
+                              std::uint16_t rrclass, std::uint32_t ttl,
+                              gsl::span<const char> ptrdname)
+{
+  if (!BeginRR(section, name, DNSRR::RR_PTR, rrclass, ttl)) {
+    return false;
+  }
+  if (WriteRDataName(ptrdname) && EndRR()) {
+    return true;
+  }
+  AbortRR();
+  return false;
+}
+
+bool DNSMessageWriter::AddSrv(DNSMessage::eSection section,
+                              gsl::span<const char> name,
+                              std::uint16_t rrclass, std::uint32_t ttl,
+                              std::uint16_t priority, std::uint16_t weight,
+                              std::uint16_t port,
+                              gsl::span<const char> target)
+{
+  if (!BeginRR(section, name, DNSRR::RR_SRV, rrclass, ttl)) {
+    return false;
+  }
+  if (WriteRDataU16(priority) && WriteRDataU16(weight) &&
+      WriteRDataU16(port) && WriteRDataName(target) && EndRR()) {
+    return true;
+  }
+  AbortRR();
+  return false;
+}
+
+bool DNSMessageWriter::AddTxt(DNSMessage::eSection section,
+                              gsl::span<const char> name,
+                              std::uint16_t rrclass, std::uint32_t ttl,
+                              gsl::span<const char> txt)
+{
+  /* RFC 6763 6.1:
+       An empty TXT record containing zero strings is not allowed
+       [RFC1035]. DNS-SD implementations MUST NOT emit empty TXT
+       records. ... a TXT record containing a single zero byte.
+  */
+  static const char kEmptyTxt[] = { 0 };
+  if (txt.empty()) {
+    txt = gsl::span<const char>(kEmptyTxt, sizeof(kEmptyTxt));
+  }
+  return AddRR(section, name, DNSRR::RR_TXT, rrclass, ttl, txt);
+}
+
+bool DNSMessageWriter::AddAddress(DNSMessage::eSection section,
+                                  gsl::span<const char> name,
+                                  std::uint16_t rrclass, std::uint32_t ttl,
+                                  gsl::span<const char> address)
+{
+  std::uint16_t type;
+  if (address.size() == 4) {
+    type = DNSRR::RR_A;
+  } else if (address.size() == 16) {
+    type = DNSRR::RR_AAAA;
+  } else {
+    return false;
+  }
+  return AddRR(section, name, type, rrclass, ttl, address);
+}
+
+/* RFC 6762 6.1:
+     The type bitmaps used in Multicast DNS are restricted to the
+     first 256 types, so only Window Block 0 is ever present, and the
+     bitmap is only as long as the highest type present needs.
+*/
+bool DNSMessageWriter::AddNsec(DNSMessage::eSection section,
+                               gsl::span<const char> name,
+                               std::uint16_t rrclass, std::uint32_t ttl,
+                               const std::uint16_t* types,
+                               std::size_t ntypes)
+{
+  char bitmap[2 + 32] = { 0 };
+  std::size_t len = 0;
+  for (std::size_t i = 0; i < ntypes; i++) {
+    if (types[i] > 255) {
+      return false;
+    }
+    bitmap[2 + types[i] / 8] |= 0x80 >> (types[i] % 8);
+    if (std::size_t(types[i] / 8 + 1) > len) {
+      len = types[i] / 8 + 1;
+    }
+  }
+  bitmap[1] = static_cast<char>(len);
+
+  if (!BeginRR(section, name, DNSRR::RR_NSEC, rrclass, ttl)) {
+    return false;
+  }
+  // The Next Domain Name is the record's own name
+  if (WriteRDataName(name) &&
+      (len == 0 || WriteRData(gsl::span<const char>(bitmap, 2 + len))) &&
+      EndRR()) {
+    return true;
+  }
+  AbortRR();
+  return false;
+}
+
+bool DNSMessageWriter::AddRR(DNSMessage::eSection section, const DNSRR& rr)
+{
+  const DNSRData& rdata = rr.GetRData();
+  if (!BeginRR(section, rr.GetOwnerName(), rr.GetRRType(), rr.GetRRClass(),
+               rr.GetTTL())) {
+    return false;
+  }
+  const DNSRData::NameLayout* const layout =
+      DNSRData::GetNameLayout(rdata.GetType());
+  bool result;
+  switch (rdata.GetType()) {
+    case DNSRR::RR_PTR:
+      result = WriteRDataName(rdata.GetPtrDName());
+      break;
+    case DNSRR::RR_SRV:
+      result = WriteRDataU16(rdata.GetPriority()) &&
+               WriteRDataU16(rdata.GetWeight()) &&
+               WriteRDataU16(rdata.GetPort()) &&
+               WriteRDataName(rdata.GetTarget());
+      break;
+    case DNSRR::RR_NSEC:
+      result = WriteRDataName(rdata.GetNextDomainName()) &&
+               WriteRData(rdata.GetTypeBitMaps());
+      break;
+    default:
+      if (layout != nullptr) {
+        // Names are written again, any pointer they had led into the
+        // message they were parsed from
+        result = (!layout->mPreference ||
+                  WriteRDataU16(rdata.GetPreference())) &&
+                 WriteRDataName(rdata.GetFirstName()) &&
+                 (layout->mNames < 2 ||
+                  WriteRDataName(rdata.GetSecondName())) &&
+                 WriteRData(rdata.GetFixed());
+      } else {
+        // Addresses, TXT strings and opaque types are copied as is. A
+        // type that may hold a name we did not decode cannot be.
+        result = rdata.IsOpaque() && WriteRData(rdata.GetRaw());
+      }
+      break;
+  }
+  if (result && EndRR()) {
+    return true;
+  }
+  AbortRR();
+  return false;
+}
+
+std::size_t DNSMessageWriter::Finish()
+{
+  if (mBuf.size() < std::ptrdiff_t(kHeaderLength) || mRRStart != 0) {
+    return 0;
+  }
+  unsigned char* const p = reinterpret_cast<unsigned char*>(mBuf.data());
+  const std::uint16_t words[6] = {
+    mMsgID, mFlags,
+    mCounts[DNSMessage::SECTION_QD], mCounts[DNSMessage::SECTION_AN],
+    mCounts[DNSMessage::SECTION_NS], mCounts[DNSMessage::SECTION_AR],
+  };
+  for (std::size_t i = 0; i < 6; i++) {
+    p[2 * i] = words[i] >> 8;
+    p[2 * i + 1] = words[i] & 0xFF;
+  }
+  return mLength;
+}
+
+} // namespace dns_message
@@ -0,0 +1,305 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+
+#include <algorithm>
+#include <cstring>
+
+#include "mdns_cache.h"
+#include "mdns_response.h"
+
+namespace dns_message {
+
+static const std::size_t kHeaderLength = 12;
+static const std::size_t kSrvFixedLength = 6;
+static const std::size_t kMaxNameLength = 255;
+
+static inline void put_u16(char* p, std::uint16_t v)
+{
+  p[0] = static_cast<char>(v >> 8);
+  p[1] = static_cast<char>(v);
+}
+
+static inline void put_u32(char* p, std::uint32_t v)
+{
+  p[0] = static_cast<char>(v >> 24);
+  p[1] = static_cast<char>(v >> 16);
+  p[2] = static_cast<char>(v >> 8);
+  p[3] = static_cast<char>(v);
+}
+
+static inline std::uint16_t get_u16(const char* p)
+{
+  return std::uint16_t(std::uint8_t(p[0]) << 8) | std::uint8_t(p[1]);
+}
+
+bool DNSResponseTemplate::Compile(gsl::span<const char> msg)
+{
+  mWire.assign(msg.data(), msg.data() + msg.size());
+  mRecords.clear();
+  mMaxTTL = kKeepTTL;
+  mCacheFlush = true;
+
+  // Parse our own copy, so the offsets found are offsets into mWire
+  DNSMessage parsed{gsl::span<const char>(mWire.data(), mWire.size())};
+  if (mWire.size() > UINT16_MAX || !parsed.ProcessMessage()) {
+    mWire.clear();
+    return false;
+  }
+  mMsgID = parsed.GetHeader().GetMsgID();
+  const DNSRRs* const sections[] = {
+    &parsed.GetAnswers(), &parsed.GetAuthorities(), &parsed.GetAdditionals(),
+  };
+  for (const DNSRRs* rrs : sections) {
+    for (const DNSRR& rr : *rrs) {
+      const DNSName& owner = rr.GetOwnerName();
+      Record r;
+      // TYPE comes between the owner name and CLASS
+      r.mClassOffset = owner.GetOffset() + owner.GetWireLength() + 2;
+      r.mRRClass = rr.GetRRClass();
+      r.mTTL = rr.GetTTL();
+      mRecords.push_back(r);
+    }
+  }
+  return true;
+}
+
+void DNSResponseTemplate::SetMsgID(std::uint16_t msgid)
+{
+  if (mWire.empty() || msgid == mMsgID) {
+    return;
+  }
+  put_u16(mWire.data(), msgid);
+  mMsgID = msgid;
+}
+
+void DNSResponseTemplate::SetMaxTTL(std::uint32_t ttl)
+{
+  if (ttl == mMaxTTL) {
+    return;
+  }
+  for (const Record& r : mRecords) {
+    put_u32(mWire.data() + r.mClassOffset + 2, std::min(r.mTTL, ttl));
+  }
+  mMaxTTL = ttl;
+}
+
+void DNSResponseTemplate::SetCacheFlush(bool flush)
+{
+  if (flush == mCacheFlush) {
+    return;
+  }
+  for (const Record& r : mRecords) {
+    const std::uint16_t rrclass =
+        flush ? r.mRRClass : r.mRRClass & ~DNSMessageWriter::kCacheFlush;
+    put_u16(mWire.data() + r.mClassOffset, rrclass);
+  }
+  mCacheFlush = flush;
+}
+
+std::size_t DNSResponseTemplate::CopyTo(char* out, std::size_t outlen) const
+{
+  if (mWire.empty() || outlen < mWire.size()) {
+    return 0;
+  }
+  std::memcpy(out, mWire.data(), mWire.size());
+  return mWire.size();
+}
+
+bool DNSResponseCache::AddRecord(DNSMessage::eSection section,
+                                 gsl::span<const char> name,
+                                 std::uint16_t type, std::uint16_t rrclass,
+                                 std::uint32_t ttl,
+                                 gsl::span<const char> rdata,
+                                 std::size_t& id)
+{
+  if (section == DNSMessage::SECTION_QD || section > DNSMessage::SECTION_AR ||
+      mRecords.size() == kMaxRecords) {
+    return false;
+  }
+  if (type == DNSRR::RR_SRV && std::size_t(rdata.size()) <= kSrvFixedLength) {
+    return false;
+  }
+  Record r;
+  r.mName.assign(name.data(), name.size());
+  r.mRData.assign(rdata.data(), rdata.size());
+  r.mTTL = ttl;
+  r.mType = type;
+  r.mRRClass = rrclass;
+  r.mSection = section;
+  id = mRecords.size();
+  mRecords.push_back(std::move(r));
+  mIndex[DNSRecordCache::HashKey(name, type,
+                                 rrclass & ~DNSMessageWriter::kCacheFlush)] |=
+      std::uint64_t(1) << id;
+  // No existing set can contain the new id, so nothing goes stale
+  return true;
+}
+
+bool DNSResponseCache::UpdateRData(std::size_t id,
+                                   gsl::span<const char> rdata)
+{
+  if (id >= mRecords.size()) {
+    return false;
+  }
+  Record& r = mRecords[id];
+  if (r.mType == DNSRR::RR_SRV &&
+      std::size_t(rdata.size()) <= kSrvFixedLength) {
+    return false;
+  }
+  if (r.mRData.size() == std::size_t(rdata.size()) &&
+      std::memcmp(r.mRData.data(), rdata.data(), rdata.size()) == 0) {
+    return true;
+  }
+  r.mRData.assign(rdata.data(), rdata.size());
+  mGeneration++;
+  return true;
+}
+
+bool DNSResponseCache::UpdateTTL(std::size_t id, std::uint32_t ttl)
+{
+  if (id >= mRecords.size()) {
+    return false;
+  }
+  if (mRecords[id].mTTL != ttl) {
+    mRecords[id].mTTL = ttl;
+    mGeneration++;
+  }
+  return true;
+}
+
+std::uint64_t DNSResponseCache::GetKnownAnswers(const DNSMessage& query) const
+{
+  std::uint64_t known = 0;
+  char namebuf[kMaxNameLength];
+  std::string rdata;
+  for (const DNSRR& rr : query.GetAnswers()) {
+    const std::size_t namelen =
+        rr.GetOwnerName().CopyTo(namebuf, sizeof(namebuf));
+    if (namelen == 0) {
+      continue;
+    }
+    const gsl::span<const char> name(namebuf, namelen);
+    const std::uint16_t rrclass =
+        rr.GetRRClass() & ~DNSMessageWriter::kCacheFlush;
+    const auto it = mIndex.find(
+        DNSRecordCache::HashKey(name, rr.GetRRType(), rrclass));
+    if (it == mIndex.end() || (it->second & ~known) == 0 ||
+        !DNSRecordCache::CanonicalRData(rr, rdata)) {
+      continue;
+    }
+    for (std::size_t id = 0; id < mRecords.size(); id++) {
+      const std::uint64_t bit = std::uint64_t(1) << id;
+      if ((it->second & ~known & bit) == 0) {
+        continue;
+      }
+      const Record& r = mRecords[id];
+      if (r.mType == rr.GetRRType() &&
+          (r.mRRClass & ~DNSMessageWriter::kCacheFlush) == rrclass &&
+          r.mRData == rdata &&
+          std::uint64_t(rr.GetTTL()) * 2 >= r.mTTL &&
+          DNSRecordCache::NameEqual(name, r.mName)) {
+        known |= bit;
+      }
+    }
+  }
+  return known;
+}
+
+bool DNSResponseCache::WriteRecord(DNSMessageWriter& writer,
+                                   const Record& r) const
+{
+  const gsl::span<const char> name(r.mName.data(), r.mName.size());
+  const gsl::span<const char> rdata(r.mRData.data(), r.mRData.size());
+  switch (r.mType) {
+    case DNSRR::RR_PTR:
+      return writer.AddPtr(r.mSection, name, r.mRRClass, r.mTTL, rdata);
+    case DNSRR::RR_SRV:
+      return writer.AddSrv(r.mSection, name, r.mRRClass, r.mTTL,
+                           get_u16(rdata.data()), get_u16(rdata.data() + 2),
+                           get_u16(rdata.data() + 4),
+                           rdata.subspan(kSrvFixedLength));
+    case DNSRR::RR_TXT:
+      return writer.AddTxt(r.mSection, name, r.mRRClass, r.mTTL, rdata);
+    default:
+      return writer.AddRR(r.mSection, name, r.mType, r.mRRClass, r.mTTL,
+                          rdata);
+  }
+}
+
+bool DNSResponseCache::Compile(std::uint64_t set, DNSResponseTemplate& t)
+{
+  mScratch.resize(kMaxMessageLength);
+  DNSMessageWriter writer(gsl::span<char>(mScratch.data(), mScratch.size()),
+                          0, DNSMessageWriter::kFlagQR |
+                             DNSMessageWriter::kFlagAA);
+  // The writer wants its records in section order
+  for (std::uint8_t s = DNSMessage::SECTION_AN; s <= DNSMessage::SECTION_AR;
+       s++) {
+    for (std::size_t id = 0; id < mRecords.size(); id++) {
+      const Record& r = mRecords[id];
+      if ((set & (std::uint64_t(1) << id)) == 0 || r.mSection != s) {
+        continue;
+      }
+      if (!WriteRecord(writer, r)) {
+        return false;
+      }
+    }
+  }
+  const std::size_t len = writer.Finish();
+  if (len <= kHeaderLength ||
+      !t.Compile(gsl::span<const char>(mScratch.data(), len))) {
+    return false;
+  }
+  t.mGeneration = mGeneration;
+  return true;
+}
+
+DNSResponseTemplate* DNSResponseCache::GetTemplate(std::uint64_t set)
+{
+  if (set == 0 ||
+      (mRecords.size() < kMaxRecords && (set >> mRecords.size()) != 0)) {
+    return nullptr;
+  }
+  auto it = mTemplates.find(set);
+  if (it == mTemplates.end()) {
+    if (mTemplates.size() >= kMaxTemplates) {
+      // Only a miss on a full table scans it, and a miss compiles anyway
+      auto oldest = mTemplates.begin();
+      for (auto e = mTemplates.begin(); e != mTemplates.end(); ++e) {
+        if (e->second.mLastUse < oldest->second.mLastUse) {
+          oldest = e;
+        }
+      }
+      mTemplates.erase(oldest);
+    }
+    it = mTemplates.emplace(set, Entry()).first;
+  }
+  Entry* entry = &it->second;
+  entry->mLastUse = ++mUseClock;
+  if (entry->mTemplate.mGeneration == mGeneration) {
+    return &entry->mTemplate;
+  }
+  if (!Compile(set, entry->mTemplate)) {
+    entry->mTemplate.mWire.clear();
+    entry->mTemplate.mGeneration = 0;
+    return nullptr;
+  }
+  return &entry->mTemplate;
+}
+
+} // namespace dns_message
@@ -0,0 +1,178 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "mdns_scheduler.h"
+
+namespace dns_message {
+
+static const std::size_t kHeaderLength = 12;
+/* TYPE, CLASS, TTL and RDLENGTH */
+static const std::size_t kRRFixedLength = 10;
+
+static inline std::size_t CountBits(std::uint64_t set)
+{
+  std::size_t n = 0;
+  for (; set != 0; set &= set - 1) {
+    n++;
+  }
+  return n;
+}
+
+DNSResponseScheduler::DNSResponseScheduler(DNSResponseCache& cache,
+                                           Sender sender,
+                                           DNSDuplicateSuppressor* duplicates,
+                                           std::size_t mtu,
+                                           std::uint32_t seed)
+    : mCache(cache), mSender(std::move(sender)), mDuplicates(duplicates),
+      mMTU(mtu), mRandom(seed)
+{
+}
+
+DNSResponseScheduler::Pending& DNSResponseScheduler::Find(unsigned ifindex)
+{
+  for (Pending& p : mPending) {
+    if (p.mIfIndex == ifindex) {
+      return p;
+    }
+  }
+  mPending.push_back(Pending{ifindex, 0, kHeaderLength, 0, 0});
+  return mPending.back();
+}
+
+std::size_t DNSResponseScheduler::GetRecordSize(std::size_t id) const
+{
+  const DNSResponseCache::Record& r = mCache.GetRecord(id);
+  // An empty TXT is written as one empty string
+  return r.mName.size() + kRRFixedLength +
+         std::max<std::size_t>(r.mRData.size(), 1);
+}
+
+void DNSResponseScheduler::Send(Pending& p, std::uint64_t now_ms)
+{
+  std::uint64_t set = p.mSet;
+  p.mSet = 0;
+  p.mSize = kHeaderLength;
+  if (mDuplicates != nullptr) {
+    for (std::size_t id = 0; id < mCache.GetRecordCount(); id++) {
+      const std::uint64_t bit = std::uint64_t(1) << id;
+      if ((set & bit) == 0) {
+        continue;
+      }
+      const DNSResponseCache::Record& r = mCache.GetRecord(id);
+      if (mDuplicates->SuppressAnswer(
+              gsl::span<const char>(r.mName.data(), r.mName.size()),
+              r.mType, r.mRRClass,
+              gsl::span<const char>(r.mRData.data(), r.mRData.size()),
+              r.mTTL, now_ms)) {
+        set &= ~bit;
+      }
+    }
+  }
+  DNSResponseTemplate* t = set != 0 ? mCache.GetTemplate(set) : nullptr;
+  if (t == nullptr) {
+    return;
+  }
+  // Another user of the cache may have left other patches on it
+  t->SetMsgID(0);
+  t->SetMaxTTL(DNSResponseTemplate::kKeepTTL);
+  t->SetCacheFlush(true);
+  mSender(p.mIfIndex, t->GetMessage());
+  mPacketsSent++;
+  mRecordsSent += CountBits(set);
+}
+
+void DNSResponseScheduler::Schedule(unsigned ifindex, std::uint64_t set,
+                                    std::uint64_t now_ms)
+{
+  if (set == 0) {
+    return;
+  }
+  Pending& p = Find(ifindex);
+  mRecordsMerged += CountBits(set & p.mSet);
+  set &= ~p.mSet;
+  if (set == 0) {
+    return;
+  }
+  bool shared = false;
+  std::size_t size = 0;
+  for (std::size_t id = 0; id < mCache.GetRecordCount(); id++) {
+    if ((set & (std::uint64_t(1) << id)) == 0) {
+      continue;
+    }
+    if ((mCache.GetRecord(id).mRRClass & DNSMessageWriter::kCacheFlush) ==
+        0) {
+      shared = true;
+    }
+    size += GetRecordSize(id);
+  }
+  if (p.mSet != 0 && p.mSize + size > mMTU) {
+    // Full: what is pending goes now, and this answer starts the next
+    Send(p, now_ms);
+  }
+  std::uint64_t deadline = now_ms;
+  if (shared) {
+    std::uniform_int_distribution<std::uint64_t> delay(kMinSharedDelayMs,
+                                                       kMaxSharedDelayMs);
+    deadline += delay(mRandom);
+  }
+  if (p.mSet == 0) {
+    p.mOpenedMs = now_ms;
+    p.mDeadlineMs = deadline;
+  } else {
+    // Never later than an answer already waiting, nor than the
+    // aggregation allows
+    p.mDeadlineMs = std::min({p.mDeadlineMs, deadline,
+                              p.mOpenedMs + kMaxAggregateMs});
+  }
+  p.mSet |= set;
+  p.mSize += size;
+}
+
+std::size_t DNSResponseScheduler::Flush(std::uint64_t now_ms)
+{
+  const std::uint64_t sent = mPacketsSent;
+  for (Pending& p : mPending) {
+    if (p.mSet != 0 && p.mDeadlineMs <= now_ms) {
+      Send(p, now_ms);
+    }
+  }
+  return mPacketsSent - sent;
+}
+
+std::uint64_t DNSResponseScheduler::GetNextDeadline() const
+{
+  std::uint64_t next = 0;
+  for (const Pending& p : mPending) {
+    if (p.mSet != 0 && (next == 0 || p.mDeadlineMs < next)) {
+      next = p.mDeadlineMs;
+    }
+  }
+  return next;
+}
+
+std::uint64_t DNSResponseScheduler::GetPending(unsigned ifindex) const
+{
+  for (const Pending& p : mPending) {
+    if (p.mIfIndex == ifindex) {
+      return p.mSet;
+    }
+  }
+  return 0;
+}
+
+} // namespace dns_message
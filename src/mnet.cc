@@ -17,18 +17,22 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <net/if.h>
+#include <ifaddrs.h>
 #include <string>
 #include <cstring>
 #include <unistd.h>
 #include <cerrno>
 #include <poll.h>
+#include <arpa/inet.h>
 
 #include "mnet.h"
 
 namespace mnet {
 
 // Returns -1 on failure, >= 0 on success
-static bool find_usable_socket(const char* node, const char* service,
+static bool find_usable_socket(int family, const char* node,
+                              const char* service, bool reuseport,
                               std::string& err, int *fd)
 {
   struct addrinfo hints;
@@ -38,7 +42,7 @@ static bool find_usable_socket(const char* node, const char* service,
   const int sock_flags = MSG_DONTWAIT | MSG_CMSG_CLOEXEC | MSG_PEEK;
 
   memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_UNSPEC;
+  hints.ai_family = family;
   hints.ai_socktype = SOCK_DGRAM;
   hints.ai_protocol = 0;
   hints.ai_flags = AI_NUMERICSERV|AI_CANONNAME;
@@ -56,6 +60,15 @@ static bool find_usable_socket(const char* node, const char* service,
     if (sfd == -1)
       continue;
 
+    // Leave the IPv4 port to the IPv4 socket
+    const int on = 1;
+    if (rp->ai_family == AF_INET6) {
+      setsockopt(sfd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+    }
+    setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reuseport) {
+      setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
     ssize_t r = recvfrom(sfd, &buf, sizeof buf, sock_flags, nullptr, 0);
     if (bind(sfd, rp->ai_addr, rp->ai_addrlen) == 0) {
       if (r == 0) {
@@ -83,21 +96,111 @@ bool MNet::CreateSocket(std::string& errmsg)
 {
   std::string errmsg_r;
   int socket;
-  if (!find_usable_socket(mdns_addr, mdns_port, errmsg_r, &socket)) {
+  if (!find_usable_socket(mFamily, bind_addr, mdns_port, mReusePort,
+                          errmsg_r, &socket)) {
     errmsg = "Failure while searching for usable socket: " + errmsg_r;
     return false;
   }
+  // Tells us which interface every datagram arrived on
+  const int on = 1;
+  int res;
+  if (mFamily == AF_INET6) {
+    res = setsockopt(socket, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on,
+                     sizeof(on));
+  } else {
+    res = setsockopt(socket, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+  }
+  if (res != 0) {
+    errmsg = std::string("Enabling packet info failed: ") + strerror(errno);
+    close(socket);
+    return false;
+  }
+  /* RFC 6762 11:
+       All Multicast DNS responses (including responses sent via unicast)
+       SHOULD be sent with IP TTL set to 255.
+  */
+  const int ttl = 255;
+  if (mFamily == AF_INET6) {
+    setsockopt(socket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(ttl));
+    setsockopt(socket, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &ttl, sizeof(ttl));
+  } else {
+    setsockopt(socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(socket, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+  }
   mFd = socket;
   return true;
 }
 
+bool MNet::AttachSharding(std::uint32_t shards, std::uint32_t shard,
+                          std::string& errmsg)
+{
+  if (shards == 0 || shard >= shards) {
+    errmsg = "No such shard";
+    return false;
+  }
+  mShards = shards;
+  mShard = shard;
+  if (!AttachFilter(errmsg)) {
+    return false;
+  }
+  // Any socket of the group may attach it, the last one wins and they
+  // are all the same
+  const BpfProgram steering = ReuseportSteeringProgram(mFamily, shards);
+  struct sock_fprog prog = steering.GetProg();
+  if (setsockopt(mFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                 sizeof(prog)) != 0) {
+    errmsg = std::string("Attaching the reuseport program failed: ") +
+             strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool MNet::SetFilter(const MdnsSocketFilter& filter, std::string& errmsg)
+{
+  mFilter = filter;
+  return AttachFilter(errmsg);
+}
+
+bool MNet::AttachFilter(std::string& errmsg)
+{
+  // SO_ATTACH_FILTER replaces an attached program in one step, there is
+  // no need to detach it first
+  const BpfProgram filter =
+      MdnsFilterProgram(mFamily, mFilter, mShards, mShard);
+  struct sock_fprog prog = filter.GetProg();
+  if (setsockopt(mFd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+                 sizeof(prog)) != 0) {
+    errmsg = std::string("Attaching the socket filter failed: ") +
+             strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+void MNet::Close()
+{
+  if (mFd != -1) {
+    close(mFd);
+    mFd = -1;
+  }
+}
+
 // Disable message loop
 // Add mdns_addr membership
 bool MNet::DisableMulticastLoop(std::string& errmsg)
 {
-  const uint8_t loop = 0;
-  if (setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_LOOP,
-                 &loop, sizeof(loop)) != 0) {
+  int res;
+  if (mFamily == AF_INET6) {
+    const unsigned loop = 0;
+    res = setsockopt(mFd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP,
+                     &loop, sizeof(loop));
+  } else {
+    const uint8_t loop = 0;
+    res = setsockopt(mFd, IPPROTO_IP, IP_MULTICAST_LOOP,
+                     &loop, sizeof(loop));
+  }
+  if (res != 0) {
     errmsg = "Disabling multicast loop failed: ";
     errmsg += std::string(strerror(errno));
     return false;
@@ -105,100 +208,431 @@ bool MNet::DisableMulticastLoop(std::string& errmsg)
   return true;
 }
 
-bool MNet::AddMulticastMembership(std::string& errmsg)
+bool MNet::IsEligibleInterface(unsigned flags)
 {
-  struct sockaddr_in sin;
-  socklen_t sin_len = sizeof(sin);
-  if (getsockname(mFd, reinterpret_cast<sockaddr*>(&sin), &sin_len)) {
-    errmsg = std::string("getsockname() failed: ") + strerror(errno);
-    return false;
-  }
+  const unsigned required = IFF_UP | IFF_MULTICAST;
+  return (flags & required) == required && !(flags & IFF_LOOPBACK);
+}
 
-  const struct ip_mreqn mrq{sin.sin_addr.s_addr, INADDR_ANY, 0};
-  if (setsockopt(mFd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
-                 &mrq, sizeof(mrq)) != 0) {
+bool MNet::AddMulticastMembership(unsigned ifindex, std::string& errmsg)
+{
+  int res;
+  if (mFamily == AF_INET6) {
+    struct ipv6_mreq mrq;
+    inet_pton(AF_INET6, mdns_addr, &mrq.ipv6mr_multiaddr);
+    mrq.ipv6mr_interface = ifindex;
+    res = setsockopt(mFd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mrq, sizeof(mrq));
+  } else {
+    struct in_addr group;
+    inet_pton(AF_INET, mdns_addr, &group);
+    const struct ip_mreqn mrq{group, {INADDR_ANY}, int(ifindex)};
+    res = setsockopt(mFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mrq, sizeof(mrq));
+  }
+  if (res != 0) {
     errmsg = "Joining the multicast group failed: ";
     errmsg += std::string(strerror(errno));
     return false;
   }
+  return true;
+}
 
-  char srcaddr[NI_MAXHOST], srcport[NI_MAXSERV];
-  errmsg = std::string("Multicast membership added for ");
+bool MNet::AddMulticastMembership(std::string& errmsg)
+{
+  struct ifaddrs* ifas;
+  std::string joinerr;
+  if (getifaddrs(&ifas) != 0) {
+    errmsg = std::string("getifaddrs() failed: ") + strerror(errno);
+    return false;
+  }
 
-  int res = getnameinfo(reinterpret_cast<sockaddr*>(&sin), sin_len,
-                        srcaddr, NI_MAXHOST,
-                        srcport, NI_MAXSERV,
-                        NI_NUMERICHOST | NI_NUMERICSERV);
-  if (res == 0) {
-    errmsg += std::string(srcaddr) + ":" + srcport;
-  } else {
-    errmsg += std::string("<unknown address>: ") + gai_strerror(res);
+  mInterfaces.clear();
+  errmsg = std::string("Multicast membership added on");
+  for (struct ifaddrs* ifa = ifas; ifa != nullptr; ifa = ifa->ifa_next) {
+    if (ifa->ifa_addr == nullptr || ifa->ifa_addr->sa_family != mFamily ||
+        !IsEligibleInterface(ifa->ifa_flags)) {
+      continue;
+    }
+    const unsigned index = if_nametoindex(ifa->ifa_name);
+    bool joined = false;
+    // One entry per address, an interface may have several
+    for (const MNetInterface& i : mInterfaces) {
+      joined |= i.mIndex == index;
+    }
+    if (index == 0 || joined) {
+      continue;
+    }
+    if (!AddMulticastMembership(index, joinerr)) {
+      continue;
+    }
+    mInterfaces.push_back(MNetInterface{index, ifa->ifa_name, {}});
+    memcpy(&mInterfaces.back().mAddr, ifa->ifa_addr,
+           mFamily == AF_INET6 ? sizeof(struct sockaddr_in6)
+                               : sizeof(struct sockaddr_in));
+    errmsg += std::string(" ") + ifa->ifa_name;
+  }
+  freeifaddrs(ifas);
+
+  if (mInterfaces.empty()) {
+    errmsg = "No interface to join the multicast group on";
+    if (!joinerr.empty()) {
+      errmsg += ": " + joinerr;
+    }
+    return false;
   }
   return true;
 }
 
-bool MNet::Poll(std::string& errmsg) const
+eNetError MNet::Poll(short& revents) const
 {
   struct pollfd pfd {mFd, POLLIN|POLLOUT, 0};
-  int count = poll(&pfd, 1, 0);
+  revents = 0;
+  if (mFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  if (poll(&pfd, 1, 0) == -1) {
+    return NET_ERR_POLL;
+  }
+  revents = pfd.revents;
+  return NET_OK;
+}
+
+unsigned InterfaceFromControl(const struct msghdr& hdr)
+{
+  for (struct cmsghdr* c = CMSG_FIRSTHDR(&hdr); c != nullptr;
+       c = CMSG_NXTHDR(const_cast<struct msghdr*>(&hdr), c)) {
+    if (c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_PKTINFO) {
+      struct in_pktinfo info;
+      memcpy(&info, CMSG_DATA(c), sizeof(info));
+      return info.ipi_ifindex;
+    }
+    if (c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_PKTINFO) {
+      struct in6_pktinfo info;
+      memcpy(&info, CMSG_DATA(c), sizeof(info));
+      return info.ipi6_ifindex;
+    }
+  }
+  return 0;
+}
+
+void SetSendInterface(struct msghdr& hdr, char* control, unsigned ifindex)
+{
+  if (ifindex == 0) {
+    hdr.msg_control = nullptr;
+    hdr.msg_controllen = 0;
+    return;
+  }
+  // An interface in the packet info takes the place of IP_MULTICAST_IF
+  // for this datagram only, so one socket serves every interface
+  const bool v6 =
+      static_cast<const struct sockaddr*>(hdr.msg_name)->sa_family ==
+      AF_INET6;
+  struct in_pktinfo info;
+  struct in6_pktinfo info6;
+  const std::size_t len = v6 ? sizeof(info6) : sizeof(info);
+  hdr.msg_control = control;
+  hdr.msg_controllen = CMSG_SPACE(len);
+  struct cmsghdr* c = CMSG_FIRSTHDR(&hdr);
+  c->cmsg_len = CMSG_LEN(len);
+  if (v6) {
+    memset(&info6, 0, sizeof(info6));
+    info6.ipi6_ifindex = ifindex;
+    c->cmsg_level = IPPROTO_IPV6;
+    c->cmsg_type = IPV6_PKTINFO;
+    memcpy(CMSG_DATA(c), &info6, sizeof(info6));
+  } else {
+    memset(&info, 0, sizeof(info));
+    info.ipi_ifindex = ifindex;
+    c->cmsg_level = IPPROTO_IP;
+    c->cmsg_type = IP_PKTINFO;
+    memcpy(CMSG_DATA(c), &info, sizeof(info));
+  }
+}
+
+// On success pkt holds the received datagram, or an empty buffer if there
+// was nothing to read. The datagram is received straight into a buffer
+// from pool, large enough for any mDNS message.
+eNetError MNet::Read(BufferPool& pool, MNetPacket& pkt) const
+{
+  alignas(struct cmsghdr) char control[MNetBatch::kControlLength];
+  struct iovec iov;
+  struct msghdr hdr;
+  ssize_t count;
+
+  if (mFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  pkt.mBuffer = pool.Acquire(BufferPool::CLASS_JUMBO);
+  iov.iov_base = pkt.mBuffer.GetData();
+  iov.iov_len = pkt.mBuffer.GetCapacity();
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_name = &pkt.mSrcAddr;
+  hdr.msg_namelen = sizeof(pkt.mSrcAddr);
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control;
+  hdr.msg_controllen = sizeof(control);
+
+  count = recvmsg(mFd, &hdr, MSG_DONTWAIT | MSG_TRUNC);
   if (count == -1) {
-    errmsg = "poll() failed with error: " + std::string(strerror(errno));
-    return false;
-  } else if (count == 0) {
-    errmsg = "poll() says there's nothing new";
+    pkt.mBuffer.Reset();
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return NET_OK;
+    }
+    return NET_ERR_RECV;
+  }
+  pkt.mTruncated = (hdr.msg_flags & MSG_TRUNC) != 0;
+  pkt.mLength = pkt.mTruncated ? iov.iov_len : count;
+  pkt.mBuffer.SetLength(pkt.mLength);
+  pkt.mData = pkt.mBuffer.GetData();
+  pkt.mSrcAddrLen = hdr.msg_namelen;
+  pkt.mIfIndex = InterfaceFromControl(hdr);
+  return NET_OK;
+}
+
+void MNetBatch::Prepare()
+{
+  for (std::size_t i = 0; i < kMaxPackets; i++) {
+    // Drop our own reference first, so a buffer still shared afterwards
+    // is one the caller kept
+    mPackets[i].mBuffer.Reset();
+    if (mBuffers[i].IsEmpty() || mBuffers[i].IsShared()) {
+      mBuffers[i] = mPool.Acquire(mClass);
+    }
+    mIov[i].iov_base = mBuffers[i].GetData();
+    mIov[i].iov_len = mBuffers[i].GetCapacity();
+    memset(&mMsgs[i].msg_hdr, 0, sizeof(mMsgs[i].msg_hdr));
+    // The source address lands in the packet descriptor itself
+    mMsgs[i].msg_hdr.msg_name = &mPackets[i].mSrcAddr;
+    mMsgs[i].msg_hdr.msg_namelen = sizeof(mPackets[i].mSrcAddr);
+    mMsgs[i].msg_hdr.msg_iov = &mIov[i];
+    mMsgs[i].msg_hdr.msg_iovlen = 1;
+    mMsgs[i].msg_hdr.msg_control = mControl[i];
+    mMsgs[i].msg_hdr.msg_controllen = kControlLength;
+    mMsgs[i].msg_len = 0;
+  }
+  mCount = 0;
+}
+
+// On success the batch holds the datagrams received, possibly none. They
+// stay valid until the batch is read into again.
+eNetError MNet::ReadBatch(MNetBatch& batch) const
+{
+  if (mFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  batch.Prepare();
+  // MSG_TRUNC reports the real length of a datagram that did not fit
+  int count = recvmmsg(mFd, batch.mMsgs, MNetBatch::kMaxPackets,
+                       MSG_DONTWAIT | MSG_TRUNC, nullptr);
+  if (count == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return NET_OK;
+    }
+    return NET_ERR_RECV;
+  }
+  for (int i = 0; i < count; i++) {
+    MNetPacket& p = batch.mPackets[i];
+    const struct msghdr& hdr = batch.mMsgs[i].msg_hdr;
+    const std::size_t capacity = batch.mBuffers[i].GetCapacity();
+    p.mTruncated = (hdr.msg_flags & MSG_TRUNC) != 0;
+    p.mLength = p.mTruncated ? capacity : batch.mMsgs[i].msg_len;
+    batch.mBuffers[i].SetLength(p.mLength);
+    p.mBuffer = batch.mBuffers[i];
+    p.mData = p.mBuffer.GetData();
+    p.mSrcAddrLen = hdr.msg_namelen;
+    p.mIfIndex = InterfaceFromControl(hdr);
+    if (p.mTruncated) {
+      batch.mTruncatedCount++;
+    }
+  }
+  batch.mCount = count;
+  return NET_OK;
+}
+
+eNetError MNet::Send(const MNetSendQueue::Datagram& d) const
+{
+  alignas(struct cmsghdr) char control[MNetBatch::kControlLength];
+  struct iovec iov;
+  struct msghdr hdr;
+
+  if (mFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  iov.iov_base = d.mBuffer.GetData();
+  iov.iov_len = d.mBuffer.GetLength();
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_name = const_cast<struct sockaddr_storage*>(&d.mDst);
+  hdr.msg_namelen = d.mDstLen;
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  SetSendInterface(hdr, control, d.mIfIndex);
+  if (sendmsg(mFd, &hdr, MSG_DONTWAIT) == -1) {
+    return NET_ERR_SEND;
+  }
+  return NET_OK;
+}
+
+eNetError MNet::Flush(MNetSendQueue& queue, std::size_t& sent) const
+{
+  MNetSendQueue::Datagram out[kFlushBatch];
+  alignas(struct cmsghdr)
+      char control[kFlushBatch][MNetBatch::kControlLength];
+  struct iovec iov[kFlushBatch];
+  struct mmsghdr msgs[kFlushBatch];
+  eNetError err = NET_OK;
+
+  sent = 0;
+  if (mFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  while (queue.GetPending() > 0) {
+    const std::size_t count = queue.Pop(out, kFlushBatch);
+    memset(msgs, 0, sizeof(msgs[0]) * count);
+    for (std::size_t i = 0; i < count; i++) {
+      struct msghdr& hdr = msgs[i].msg_hdr;
+      iov[i].iov_base = out[i].mBuffer.GetData();
+      iov[i].iov_len = out[i].mBuffer.GetLength();
+      hdr.msg_name = &out[i].mDst;
+      hdr.msg_namelen = out[i].mDstLen;
+      hdr.msg_iov = &iov[i];
+      hdr.msg_iovlen = 1;
+      SetSendInterface(hdr, control[i], out[i].mIfIndex);
+    }
+    std::size_t done = 0;
+    while (done < count) {
+      const int n = sendmmsg(mFd, msgs + done, count - done, MSG_DONTWAIT);
+      queue.mSendCalls++;
+      if (n > 0) {
+        done += n;
+        sent += n;
+        queue.mSent += n;
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Not a failure, the next flush picks them up
+        queue.Requeue(out + done, count - done);
+        return err;
+      }
+      // sendmmsg() only fails when the first datagram does, skip it
+      done++;
+      queue.mSendErrors++;
+      err = NET_ERR_SEND;
+    }
+  }
+  return err;
+}
+
+MNetSendQueue::Queue* MNetSendQueue::Find(unsigned ifindex)
+{
+  for (Queue& q : mQueues) {
+    if (q.mIfIndex == ifindex) {
+      return &q;
+    }
+  }
+  return nullptr;
+}
+
+bool MNetSendQueue::Push(Datagram&& d)
+{
+  Queue* q = Find(d.mIfIndex);
+  if (q == nullptr) {
+    // Interfaces are few, and a queue stays once its interface was seen
+    mQueues.push_back(Queue{d.mIfIndex, {}, 0});
+    q = &mQueues.back();
+  }
+  if (q->mPending.size() >= mDepth) {
+    q->mDropped++;
     return false;
   }
-  errmsg = "Poll() says we should ";
-  errmsg += (pfd.revents&POLLIN)?"read() ":"not read";
-  errmsg += " and should ";
-  errmsg += (pfd.revents&POLLOUT)?"write()":"not write()";
+  q->mPending.push_back(std::move(d));
+  mPending++;
   return true;
 }
 
-// Returns true on success, false on failure
-// Error message is stored in errmsg
-// On success, *msg contains a buffer with the recevied bytes
-// If *msg contains bytes, then msglen specifies the number of bytes
-// On successful return, the caller owns msg.
-bool MNet::Read(char** msg, size_t& msglen, std::string& errmsg) const
+std::size_t MNetSendQueue::Pop(Datagram* out, std::size_t max)
 {
-  struct sockaddr src_addr;
-  socklen_t addrlen = sizeof(src_addr);
-  ssize_t count;
-  int flags = MSG_DONTWAIT;
-  // DNS supports up to 512 bytes, MDNS supports whatever is the LAN's MTU
-  // Let's assume 1500
-  char buf[1500];
-
-  count = recvfrom(mFd, buf, sizeof(buf) / sizeof(buf[0]), flags,
-                   &src_addr, &addrlen);
-  if (count == -1 && errno != EAGAIN) {
-    errmsg = std::string("recvfrom() failed with error: ") + strerror(errno);
-    return false;
-  } else if (count == 0) {
-    errmsg = "recvfrom() returned 0 count";
-    msglen = 0;
-    return true;
-  } else if (count == -1  && errno == EAGAIN) {
-    errmsg = "recvfrom() returned EAGAIN";
-    msglen = 0;
-    return true;
-  }
-  *msg = new char[count];
-  if (*msg == nullptr) {
-    errmsg = std::string("Couldn't allocate a buffer: ") + strerror(errno);
-    return false;
+  std::size_t n = 0;
+  std::size_t idle = 0;
+  // Stop once a whole round found every queue empty
+  while (n < max && mPending > 0 && idle < mQueues.size()) {
+    Queue& q = mQueues[mNext];
+    mNext = (mNext + 1) % mQueues.size();
+    if (q.mPending.empty()) {
+      idle++;
+      continue;
+    }
+    idle = 0;
+    out[n++] = std::move(q.mPending.front());
+    q.mPending.pop_front();
+    mPending--;
   }
-  char srcaddr[NI_MAXHOST], srcport[NI_MAXSERV];
-  if (getnameinfo(&src_addr, addrlen, srcaddr, NI_MAXHOST, srcport, NI_MAXSERV,
-                  NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
-    errmsg = std::string("Received message from: ") + srcaddr + ":" + srcport;
-  } else {
-    errmsg = "Received message from unknown peer";
+  return n;
+}
+
+void MNetSendQueue::Requeue(Datagram* d, std::size_t count)
+{
+  // Back to front, so each queue ends up in the original order
+  for (std::size_t i = count; i > 0; i--) {
+    Queue* q = Find(d[i - 1].mIfIndex);
+    q->mPending.push_front(std::move(d[i - 1]));
+    mPending++;
   }
-  msglen = count;
-  memmove(*msg, buf, msglen);
-  return true;
+}
+
+std::size_t MNetSendQueue::GetPending(unsigned ifindex) const
+{
+  for (const Queue& q : mQueues) {
+    if (q.mIfIndex == ifindex) {
+      return q.mPending.size();
+    }
+  }
+  return 0;
+}
+
+std::size_t MNetSendQueue::GetDropped(unsigned ifindex) const
+{
+  for (const Queue& q : mQueues) {
+    if (q.mIfIndex == ifindex) {
+      return q.mDropped;
+    }
+  }
+  return 0;
+}
+
+const char* NetErrorName(eNetError err)
+{
+  switch (err) {
+    case NET_OK:
+      return "no error";
+    case NET_ERR_POLL:
+      return "poll() failed";
+    case NET_ERR_RECV:
+      return "receive failed";
+    case NET_ERR_SEND:
+      return "send failed";
+    case NET_ERR_CLOSED:
+      return "not open";
+    case NET_ERR_RING:
+      return "io_uring_enter() failed";
+    case NET_ERR_QUEUE_FULL:
+      return "send queue full";
+    case NET_ERR_ADDRESS:
+      return "address too long";
+  }
+  return "unknown error";
+}
+
+std::string FormatAddress(const struct sockaddr_storage& addr,
+                          socklen_t addrlen)
+{
+  char host[NI_MAXHOST], port[NI_MAXSERV];
+  int res = getnameinfo(reinterpret_cast<const sockaddr*>(&addr), addrlen,
+                        host, sizeof(host), port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV);
+  if (res != 0) {
+    return std::string("<unknown address>: ") + gai_strerror(res);
+  }
+  return std::string(host) + ":" + port;
 }
 
 } // namespace mnet
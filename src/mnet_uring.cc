@@ -0,0 +1,461 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "mnet_uring.h"
+
+namespace mnet {
+
+/* user_data of the receive, sends use kSendTag plus their slot */
+static const std::uint64_t kRecvTag = 1;
+static const std::uint64_t kSendTag = 1 << 16;
+
+/* The buffer group our receive buffers are provided in */
+static const std::uint16_t kBufferGroup = 0;
+
+// glibc has no wrappers for these, and we do not depend on liburing
+static int uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags)
+{
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                 nullptr, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg,
+                          unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+MNetUring::~MNetUring()
+{
+  Close();
+}
+
+bool MNetUring::IsSupported()
+{
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = uring_setup(1, &p);
+  if (fd == -1) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+bool MNetUring::Open(const MNet& net, BufferPool& pool, std::string& errmsg,
+                     BufferPool::eSizeClass size_class)
+{
+  struct io_uring_params p;
+  if (mRingFd != -1) {
+    errmsg = "The ring is already open";
+    return false;
+  }
+  if (BufferPool::kClassSizes[size_class] <=
+      sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) +
+          MNetBatch::kControlLength) {
+    errmsg = "Receive buffers are too small";
+    return false;
+  }
+  memset(&p, 0, sizeof(p));
+  // Every receive buffer and every send may complete before we reap
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = 2 * (kRecvBuffers + kQueueDepth);
+  mRingFd = uring_setup(kQueueDepth, &p);
+  if (mRingFd == -1) {
+    errmsg = std::string("io_uring_setup() failed: ") + strerror(errno);
+    return false;
+  }
+
+  mSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  mCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+  }
+  mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+  if (mSqRing == MAP_FAILED) {
+    mSqRing = nullptr;
+    errmsg = std::string("Mapping the submission queue failed: ") +
+             strerror(errno);
+    Close();
+    return false;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    mCqRing = mSqRing;
+  } else {
+    mCqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+    if (mCqRing == MAP_FAILED) {
+      mCqRing = nullptr;
+      errmsg = std::string("Mapping the completion queue failed: ") +
+               strerror(errno);
+      Close();
+      return false;
+    }
+  }
+  mSqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    errmsg = std::string("Mapping the submission entries failed: ") +
+             strerror(errno);
+    Close();
+    return false;
+  }
+  mSqes = static_cast<struct io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(mSqRing);
+  char* cq = static_cast<char*>(mCqRing);
+  mSqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  mSqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  mSqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  mSqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  mSqEntries = p.sq_entries;
+  mCqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  mCqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  mCqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  mCqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+  mToSubmit = 0;
+
+  // Linux 5.19. The ring MUST be page aligned, which mmap gives us.
+  mBufRingSize = kRecvBuffers * sizeof(struct io_uring_buf);
+  void* bufring = mmap(nullptr, mBufRingSize, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufring == MAP_FAILED) {
+    errmsg = std::string("Allocating the buffer ring failed: ") +
+             strerror(errno);
+    Close();
+    return false;
+  }
+  mBufRing = static_cast<struct io_uring_buf_ring*>(bufring);
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<std::uintptr_t>(mBufRing);
+  reg.ring_entries = kRecvBuffers;
+  reg.bgid = kBufferGroup;
+  if (uring_register(mRingFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    errmsg = std::string("Registering the buffer ring failed: ") +
+             strerror(errno);
+    Close();
+    return false;
+  }
+
+  mNet = &net;
+  mPool = &pool;
+  mClass = size_class;
+  mBufTail = 0;
+  for (std::uint16_t bid = 0; bid < kRecvBuffers; bid++) {
+    mRecvBuffers[bid] = pool.Acquire(size_class);
+    ProvideBuffer(bid);
+  }
+  mLentCount = 0;
+  mFreeSendCount = 0;
+  for (std::uint16_t i = kQueueDepth; i > 0; i--) {
+    mFreeSends[mFreeSendCount++] = i - 1;
+  }
+  memset(&mRecvHdr, 0, sizeof(mRecvHdr));
+  mRecvHdr.msg_namelen = sizeof(struct sockaddr_storage);
+  mRecvHdr.msg_controllen = MNetBatch::kControlLength;
+
+  // Multishot recvmsg is Linux 6.0. Older kernels reject it as soon as it
+  // is submitted, so the completion is already waiting.
+  ArmRecv();
+  if (Enter(0) != NET_OK) {
+    errmsg = std::string("io_uring_enter() failed: ") + strerror(errno);
+    Close();
+    return false;
+  }
+  const unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+  for (unsigned head = *mCqHead; head != tail; head++) {
+    const struct io_uring_cqe* cqe = &mCqes[head & mCqMask];
+    if (cqe->user_data == kRecvTag && cqe->res < 0 &&
+        !(cqe->flags & IORING_CQE_F_MORE)) {
+      errmsg = std::string("Multishot recvmsg failed: ") +
+               strerror(-cqe->res);
+      Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void MNetUring::Close()
+{
+  // Closing the ring cancels the receive that is still posted
+  if (mRingFd != -1) {
+    close(mRingFd);
+    mRingFd = -1;
+  }
+  if (mSqes != nullptr) {
+    munmap(mSqes, mSqesSize);
+    mSqes = nullptr;
+  }
+  if (mCqRing != nullptr && mCqRing != mSqRing) {
+    munmap(mCqRing, mCqRingSize);
+  }
+  mCqRing = nullptr;
+  if (mSqRing != nullptr) {
+    munmap(mSqRing, mSqRingSize);
+    mSqRing = nullptr;
+  }
+  if (mBufRing != nullptr) {
+    munmap(mBufRing, mBufRingSize);
+    mBufRing = nullptr;
+  }
+  for (Buffer& b : mRecvBuffers) {
+    b.Reset();
+  }
+  for (SendSlot& s : mSends) {
+    s.mBuffer.Reset();
+  }
+  mLentCount = 0;
+  mRecvArmed = false;
+  mNet = nullptr;
+}
+
+// The next free submission entry, zeroed, or nullptr if the queue is full
+struct io_uring_sqe* MNetUring::GetSqe()
+{
+  const unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+  const unsigned tail = *mSqTail + mToSubmit;
+  if (tail - head >= mSqEntries) {
+    return nullptr;
+  }
+  const unsigned idx = tail & mSqMask;
+  mSqArray[idx] = idx;
+  mToSubmit++;
+  memset(&mSqes[idx], 0, sizeof(mSqes[idx]));
+  return &mSqes[idx];
+}
+
+eNetError MNetUring::Enter(unsigned min_complete)
+{
+  // The kernel reads the entries once it sees the new tail
+  __atomic_store_n(mSqTail, *mSqTail + mToSubmit, __ATOMIC_RELEASE);
+  if (mToSubmit == 0 && min_complete == 0) {
+    return NET_OK;
+  }
+  mEnterCalls++;
+  int ret = uring_enter(mRingFd, mToSubmit, min_complete,
+                        min_complete > 0 ? IORING_ENTER_GETEVENTS : 0);
+  if (ret == -1) {
+    if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+      // The kernel did not take them all, they go with the next call
+      mToSubmit = *mSqTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+      return NET_OK;
+    }
+    return NET_ERR_RING;
+  }
+  mToSubmit = 0;
+  return NET_OK;
+}
+
+void MNetUring::ProvideBuffer(std::uint16_t bid)
+{
+  // Not through bufs, the flexible array is padded out of place when the
+  // kernel header is compiled as C++
+  struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(mBufRing) +
+                             (mBufTail & (kRecvBuffers - 1));
+  buf->addr = reinterpret_cast<std::uintptr_t>(mRecvBuffers[bid].GetData());
+  buf->len = mRecvBuffers[bid].GetCapacity();
+  buf->bid = bid;
+  mBufTail++;
+  __atomic_store_n(&mBufRing->tail, mBufTail, __ATOMIC_RELEASE);
+}
+
+void MNetUring::ArmRecv()
+{
+  struct io_uring_sqe* sqe = GetSqe();
+  if (sqe == nullptr) {
+    // Retried on the next Reap()
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = mNet->GetFd();
+  sqe->addr = reinterpret_cast<std::uintptr_t>(&mRecvHdr);
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = kBufferGroup;
+  sqe->user_data = kRecvTag;
+  mRecvArmed = true;
+}
+
+eNetError MNetUring::Reap(MNetBatch& batch)
+{
+  if (mRingFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  // Give the kernel back the buffers of the last batch. One the caller
+  // still holds is swapped for a fresh one, like MNetBatch::Prepare().
+  for (std::size_t i = 0; i < batch.mCount; i++) {
+    batch.mPackets[i].mBuffer.Reset();
+  }
+  batch.mCount = 0;
+  for (std::size_t i = 0; i < mLentCount; i++) {
+    Buffer& b = mRecvBuffers[mLent[i]];
+    if (b.IsShared()) {
+      b = mPool->Acquire(mClass);
+    }
+    ProvideBuffer(mLent[i]);
+  }
+  mLentCount = 0;
+  if (!mRecvArmed) {
+    ArmRecv();
+  }
+  if (Enter(0) != NET_OK) {
+    return NET_ERR_RING;
+  }
+
+  const std::size_t offset = sizeof(struct io_uring_recvmsg_out) +
+                             mRecvHdr.msg_namelen + mRecvHdr.msg_controllen;
+  eNetError err = NET_OK;
+  unsigned head = *mCqHead;
+  const unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+  while (head != tail && batch.mCount < MNetBatch::kMaxPackets) {
+    const struct io_uring_cqe* cqe = &mCqes[head & mCqMask];
+    head++;
+    if (cqe->user_data >= kSendTag) {
+      SendSlot& slot = mSends[cqe->user_data - kSendTag];
+      if (cqe->res < 0) {
+        mSendErrors++;
+      }
+      slot.mBuffer.Reset();
+      mFreeSends[mFreeSendCount++] = cqe->user_data - kSendTag;
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+      // The receive ended, it is posted again below
+      mRecvArmed = false;
+    }
+    if (cqe->res < 0) {
+      // ENOBUFS only means every buffer was in use
+      if (cqe->res != -ENOBUFS) {
+        errno = -cqe->res;
+        err = NET_ERR_RECV;
+      }
+      continue;
+    }
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+      continue;
+    }
+    const std::uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    Buffer& b = mRecvBuffers[bid];
+    const struct io_uring_recvmsg_out* out =
+        reinterpret_cast<const struct io_uring_recvmsg_out*>(b.GetData());
+    MNetBatch::Packet& pkt = batch.mPackets[batch.mCount++];
+    const std::size_t received = std::size_t(cqe->res) - offset;
+    b.SetLength(cqe->res);
+    pkt.mBuffer = b;
+    pkt.mData = b.GetData() + offset;
+    pkt.mTruncated = (out->flags & MSG_TRUNC) != 0;
+    pkt.mLength = std::min<std::size_t>(out->payloadlen, received);
+    pkt.mSrcAddrLen = std::min<socklen_t>(out->namelen,
+                                          mRecvHdr.msg_namelen);
+    memcpy(&pkt.mSrcAddr, b.GetData() + sizeof(*out), pkt.mSrcAddrLen);
+    // The control messages sit between the name and the payload
+    struct msghdr control;
+    memset(&control, 0, sizeof(control));
+    control.msg_control = b.GetData() + sizeof(*out) + mRecvHdr.msg_namelen;
+    control.msg_controllen = std::min<std::size_t>(out->controllen,
+                                                   mRecvHdr.msg_controllen);
+    pkt.mIfIndex = InterfaceFromControl(control);
+    if (pkt.mTruncated) {
+      batch.mTruncatedCount++;
+    }
+    mLent[mLentCount++] = bid;
+  }
+  __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+
+  // Post the receive again right away, so datagrams are not left waiting
+  // on the socket until the next completion wakes us
+  if (!mRecvArmed) {
+    ArmRecv();
+    if (Enter(0) != NET_OK) {
+      return NET_ERR_RING;
+    }
+  }
+  return err;
+}
+
+eNetError MNetUring::QueueSend(const Buffer& msg,
+                               const struct sockaddr* dst, socklen_t dstlen,
+                               unsigned ifindex)
+{
+  if (mRingFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  if (mFreeSendCount == 0) {
+    return NET_ERR_QUEUE_FULL;
+  }
+  if (dstlen > sizeof(struct sockaddr_storage)) {
+    return NET_ERR_ADDRESS;
+  }
+  struct io_uring_sqe* sqe = GetSqe();
+  if (sqe == nullptr) {
+    // Only unsubmitted entries fill the queue, make room for this one
+    if (Enter(0) != NET_OK) {
+      return NET_ERR_RING;
+    }
+    sqe = GetSqe();
+    if (sqe == nullptr) {
+      return NET_ERR_QUEUE_FULL;
+    }
+  }
+  const std::uint16_t i = mFreeSends[--mFreeSendCount];
+  SendSlot& slot = mSends[i];
+  slot.mBuffer = msg;
+  memcpy(&slot.mDst, dst, dstlen);
+  slot.mIov.iov_base = slot.mBuffer.GetData();
+  slot.mIov.iov_len = slot.mBuffer.GetLength();
+  memset(&slot.mHdr, 0, sizeof(slot.mHdr));
+  slot.mHdr.msg_name = &slot.mDst;
+  slot.mHdr.msg_namelen = dstlen;
+  slot.mHdr.msg_iov = &slot.mIov;
+  slot.mHdr.msg_iovlen = 1;
+  SetSendInterface(slot.mHdr, slot.mControl, ifindex);
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = mNet->GetFd();
+  sqe->addr = reinterpret_cast<std::uintptr_t>(&slot.mHdr);
+  sqe->len = 1;
+  sqe->user_data = kSendTag + i;
+  return NET_OK;
+}
+
+eNetError MNetUring::Submit()
+{
+  if (mRingFd == -1) {
+    return NET_ERR_CLOSED;
+  }
+  return Enter(0);
+}
+
+} // namespace mnet
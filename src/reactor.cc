@@ -0,0 +1,361 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include "reactor.h"
+
+namespace mnet {
+
+/* epoll data of the descriptors the reactor owns, registered sources use
+   their index */
+static const std::uint64_t kTimerToken = UINT64_MAX;
+static const std::uint64_t kSignalToken = UINT64_MAX - 1;
+
+static const int kMaxEvents = 16;
+
+static const std::uint64_t kNsPerMs = 1000000;
+static const std::uint64_t kNsPerSec = 1000000000;
+
+Reactor::~Reactor()
+{
+  Close();
+}
+
+std::uint64_t Reactor::Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return std::uint64_t(ts.tv_sec) * kNsPerSec + ts.tv_nsec;
+}
+
+bool Reactor::Open(std::string& errmsg, bool handle_signals)
+{
+  struct epoll_event ev;
+  if (mEpollFd != -1) {
+    errmsg = "Reactor is already open";
+    return false;
+  }
+  mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (mEpollFd == -1) {
+    errmsg = std::string("epoll_create1() failed: ") + strerror(errno);
+    return false;
+  }
+  mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (mTimerFd == -1) {
+    errmsg = std::string("timerfd_create() failed: ") + strerror(errno);
+    Close();
+    return false;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u64 = kTimerToken;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &ev) != 0) {
+    errmsg = std::string("Adding the timerfd failed: ") + strerror(errno);
+    Close();
+    return false;
+  }
+
+  mStopping = false;
+  mStopSignal = 0;
+  if (!handle_signals) {
+    return true;
+  }
+
+  // The signals are only delivered through the signalfd once they are
+  // blocked
+  sigemptyset(&mSignals);
+  sigaddset(&mSignals, SIGINT);
+  sigaddset(&mSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &mSignals, &mSavedMask);
+  mSignalsBlocked = true;
+  mSignalFd = signalfd(-1, &mSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (mSignalFd == -1) {
+    errmsg = std::string("signalfd() failed: ") + strerror(errno);
+    Close();
+    return false;
+  }
+  ev.events = EPOLLIN;
+  ev.data.u64 = kSignalToken;
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mSignalFd, &ev) != 0) {
+    errmsg = std::string("Adding the signalfd failed: ") + strerror(errno);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void Reactor::Close()
+{
+  if (mSignalFd != -1) {
+    close(mSignalFd);
+    mSignalFd = -1;
+  }
+  if (mSignalsBlocked) {
+    pthread_sigmask(SIG_SETMASK, &mSavedMask, nullptr);
+    mSignalsBlocked = false;
+  }
+  if (mTimerFd != -1) {
+    close(mTimerFd);
+    mTimerFd = -1;
+  }
+  if (mEpollFd != -1) {
+    close(mEpollFd);
+    mEpollFd = -1;
+  }
+  mSources.clear();
+  mSenders.clear();
+  mFlushRetry = 0;
+  mTimers.clear();
+  mArmedDeadline = 0;
+}
+
+bool Reactor::Register(int fd, std::uint32_t events, Source&& source,
+                       std::string& errmsg)
+{
+  struct epoll_event ev;
+  if (mEpollFd == -1) {
+    errmsg = "Reactor is not open";
+    return false;
+  }
+  ev.events = events;
+  ev.data.u64 = mSources.size();
+  if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    errmsg = std::string("epoll_ctl() failed: ") + strerror(errno);
+    return false;
+  }
+  mSources.emplace_back(new Source(std::move(source)));
+  return true;
+}
+
+bool Reactor::AddSocket(const MNet& net, MNetBatch& batch,
+                        BatchHandler handler, std::string& errmsg)
+{
+  Source source{net.GetFd(), &net, nullptr, &batch, std::move(handler),
+                nullptr};
+  return Register(net.GetFd(), EPOLLIN, std::move(source), errmsg);
+}
+
+bool Reactor::AddRing(MNetUring& ring, MNetBatch& batch,
+                      BatchHandler handler, std::string& errmsg)
+{
+  Source source{ring.GetFd(), nullptr, &ring, &batch, std::move(handler),
+                nullptr};
+  return Register(ring.GetFd(), EPOLLIN, std::move(source), errmsg);
+}
+
+bool Reactor::AddSendQueue(const MNet& net, MNetSendQueue& queue,
+                           std::string& errmsg)
+{
+  if (mEpollFd == -1) {
+    errmsg = "Reactor is not open";
+    return false;
+  }
+  mSenders.push_back(Sender{&net, &queue});
+  return true;
+}
+
+bool Reactor::AddFd(int fd, std::uint32_t events, FdHandler handler,
+                    std::string& errmsg)
+{
+  Source source{fd, nullptr, nullptr, nullptr, nullptr, std::move(handler)};
+  return Register(fd, events, std::move(source), errmsg);
+}
+
+Reactor::TimerId Reactor::AddTimer(std::uint64_t delay_ms,
+                                   TimerHandler handler)
+{
+  const TimerId id = mNextTimerId++;
+  const std::uint64_t deadline = Now() + delay_ms * kNsPerMs;
+  mTimers.emplace(std::make_pair(deadline, id), std::move(handler));
+  ArmTimer();
+  return id;
+}
+
+bool Reactor::CancelTimer(TimerId id)
+{
+  // Cancelling is rare next to firing, a walk keeps the map keyed by
+  // deadline
+  for (auto it = mTimers.begin(); it != mTimers.end(); ++it) {
+    if (it->first.second == id) {
+      mTimers.erase(it);
+      // An early wakeup finds nothing due and rearms
+      return true;
+    }
+  }
+  return false;
+}
+
+// Arm the timerfd for the earliest deadline, unless it already is
+void Reactor::ArmTimer()
+{
+  struct itimerspec its;
+  if (mTimerFd == -1) {
+    return;
+  }
+  const std::uint64_t deadline =
+      mTimers.empty() ? 0 : mTimers.begin()->first.first;
+  if (deadline == mArmedDeadline) {
+    return;
+  }
+  memset(&its, 0, sizeof(its));
+  // An all zero it_value disarms the timer, a deadline that already
+  // passed must still fire
+  if (deadline != 0) {
+    its.it_value.tv_sec = deadline / kNsPerSec;
+    its.it_value.tv_nsec = deadline % kNsPerSec;
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+      its.it_value.tv_nsec = 1;
+    }
+  }
+  timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &its, nullptr);
+  mArmedDeadline = deadline;
+}
+
+void Reactor::RunTimers()
+{
+  std::uint64_t expirations;
+  while (read(mTimerFd, &expirations, sizeof(expirations)) > 0) {
+  }
+  mArmedDeadline = 0;
+  const std::uint64_t now = Now();
+  // A handler may add or cancel timers, so take one at a time
+  while (!mTimers.empty() && mTimers.begin()->first.first <= now) {
+    TimerHandler handler = std::move(mTimers.begin()->second);
+    mTimers.erase(mTimers.begin());
+    handler();
+  }
+  ArmTimer();
+}
+
+void Reactor::DrainSignals()
+{
+  struct signalfd_siginfo info;
+  while (read(mSignalFd, &info, sizeof(info)) == sizeof(info)) {
+    mStopSignal = info.ssi_signo;
+    mStopping = true;
+  }
+}
+
+// Read until the socket is empty. A batch that comes back full means more
+// may be queued.
+void Reactor::DrainSocket(Source& source)
+{
+  for (;;) {
+    if (source.mNet->ReadBatch(*source.mBatch) != NET_OK) {
+      return;
+    }
+    if (source.mBatch->GetCount() == 0) {
+      return;
+    }
+    source.mOnBatch(*source.mBatch);
+    if (source.mBatch->GetCount() < MNetBatch::kMaxPackets || mStopping) {
+      return;
+    }
+  }
+}
+
+// The ring fd stays readable while completions are waiting, a full batch
+// means there may be more
+void Reactor::DrainRing(Source& source)
+{
+  for (;;) {
+    // A failed receive still hands over what was reaped before it
+    const bool ok = source.mRing->Reap(*source.mBatch) == NET_OK;
+    if (source.mBatch->GetCount() == 0) {
+      return;
+    }
+    source.mOnBatch(*source.mBatch);
+    if (!ok || source.mBatch->GetCount() < MNetBatch::kMaxPackets ||
+        mStopping) {
+      return;
+    }
+  }
+}
+
+void Reactor::FlushSenders()
+{
+  bool backlog = false;
+  for (Sender& sender : mSenders) {
+    std::size_t sent;
+    if (sender.mQueue->GetPending() == 0) {
+      continue;
+    }
+    // Errors are counted by the queue, the datagram is gone either way
+    sender.mNet->Flush(*sender.mQueue, sent);
+    if (sender.mQueue->GetPending() > 0) {
+      backlog = true;
+    }
+  }
+  // The timer only wakes the loop, whose iteration ends with a flush
+  if (backlog && mFlushRetry == 0) {
+    mFlushRetry = AddTimer(kFlushRetryMs, [this]() { mFlushRetry = 0; });
+  }
+}
+
+bool Reactor::RunOnce(int timeout_ms, std::string& errmsg)
+{
+  struct epoll_event events[kMaxEvents];
+  if (mEpollFd == -1) {
+    errmsg = "Reactor is not open";
+    return false;
+  }
+  const int count = epoll_wait(mEpollFd, events, kMaxEvents, timeout_ms);
+  if (count == -1) {
+    if (errno == EINTR) {
+      return true;
+    }
+    errmsg = std::string("epoll_wait() failed: ") + strerror(errno);
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    const std::uint64_t token = events[i].data.u64;
+    if (token == kTimerToken) {
+      RunTimers();
+    } else if (token == kSignalToken) {
+      DrainSignals();
+    } else if (token < mSources.size()) {
+      Source& source = *mSources[token];
+      if (source.mNet != nullptr) {
+        DrainSocket(source);
+      } else if (source.mRing != nullptr) {
+        DrainRing(source);
+      } else {
+        source.mOnReady(events[i].events);
+      }
+    }
+  }
+  FlushSenders();
+  return true;
+}
+
+bool Reactor::Run(std::string& errmsg)
+{
+  while (!mStopping) {
+    if (!RunOnce(-1, errmsg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace mnet
@@ -0,0 +1,155 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "receive_workers.h"
+
+namespace mnet {
+
+ReceiveWorkers::Worker::~Worker()
+{
+  if (mWakeFd != -1) {
+    close(mWakeFd);
+  }
+}
+
+static bool DefaultSetup(MNet& net, std::string& errmsg)
+{
+  return net.DisableMulticastLoop(errmsg) &&
+         net.AddMulticastMembership(errmsg);
+}
+
+bool ReceiveWorkers::Start(int family, std::size_t count, bool pin_cpus,
+                           HandlerFactory factory, std::string& errmsg,
+                           SocketSetup setup)
+{
+  if (!mWorkers.empty()) {
+    errmsg = "Workers are already running";
+    return false;
+  }
+  if (count == 0) {
+    errmsg = "No workers";
+    return false;
+  }
+  if (!setup) {
+    setup = DefaultSetup;
+  }
+  const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+  // Every socket is bound and filtered before any thread starts, so a
+  // failure leaves nothing running
+  for (std::size_t i = 0; i < count; i++) {
+    mWorkers.emplace_back(new Worker(family));
+    Worker& w = *mWorkers.back();
+    w.mNet.SetReusePort(true);
+    if (!w.mNet.CreateSocket(errmsg) ||
+        !w.mNet.AttachSharding(count, i, errmsg) ||
+        !setup(w.mNet, errmsg) ||
+        !w.mReactor.Open(errmsg, false)) {
+      mWorkers.clear();
+      return false;
+    }
+    w.mWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w.mWakeFd == -1) {
+      errmsg = std::string("eventfd() failed: ") + strerror(errno);
+      mWorkers.clear();
+      return false;
+    }
+    Reactor& reactor = w.mReactor;
+    const int wakefd = w.mWakeFd;
+    Reactor::BatchHandler handler = factory ? factory(i) : nullptr;
+    std::atomic<std::uint64_t>& packets = w.mPackets;
+    if (!reactor.AddFd(wakefd, EPOLLIN,
+                       [&reactor, wakefd](std::uint32_t) {
+                         std::uint64_t n;
+                         while (read(wakefd, &n, sizeof(n)) > 0) {
+                         }
+                         reactor.Stop();
+                       },
+                       errmsg) ||
+        !reactor.AddSocket(w.mNet, w.mBatch,
+                           [handler, &packets](const MNetBatch& b) {
+                             packets.fetch_add(b.GetCount(),
+                                               std::memory_order_relaxed);
+                             if (handler) {
+                               handler(b);
+                             }
+                           },
+                           errmsg)) {
+      mWorkers.clear();
+      return false;
+    }
+    if (pin_cpus && cpus > 0) {
+      w.mCpu = i % cpus;
+    }
+  }
+  for (std::unique_ptr<Worker>& w : mWorkers) {
+    w->mThread = std::thread(Run, std::ref(*w));
+  }
+  return true;
+}
+
+void ReceiveWorkers::Run(Worker& w)
+{
+  std::string errmsg;
+  if (w.mCpu != -1) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w.mCpu, &set);
+    // Only a hint, an unpinned worker still works
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+  w.mReactor.Run(errmsg);
+}
+
+bool ReceiveWorkers::SetFilter(const MdnsSocketFilter& filter,
+                               std::string& errmsg)
+{
+  for (std::unique_ptr<Worker>& w : mWorkers) {
+    if (!w->mNet.SetFilter(filter, errmsg)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void ReceiveWorkers::Stop()
+{
+  const std::uint64_t one = 1;
+  for (std::unique_ptr<Worker>& w : mWorkers) {
+    if (w->mThread.joinable() &&
+        write(w->mWakeFd, &one, sizeof(one)) != sizeof(one)) {
+      // The counter cannot overflow from one write each
+      abort();
+    }
+  }
+  for (std::unique_ptr<Worker>& w : mWorkers) {
+    if (w->mThread.joinable()) {
+      w->mThread.join();
+    }
+  }
+  mWorkers.clear();
+}
+
+} // namespace mnet
@@ -0,0 +1,176 @@
+/*  5ycast - Google/chromecast implementation
+ *  Copyright (C) 2017  Matthew Finkel
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "timer_wheel.h"
+
+namespace timer_wheel {
+
+constexpr TimerWheel::Id TimerWheel::kNone;
+
+/* The ticks one slot of a level spans */
+static inline std::uint64_t SlotTicks(std::size_t level)
+{
+  return std::uint64_t(1) << (TimerWheel::kSlotBits * level);
+}
+
+TimerWheel::TimerWheel(std::uint64_t now_ms, std::uint64_t tick_ms)
+    : mTickMs(tick_ms), mTick(now_ms / tick_ms)
+{
+  std::fill(mHeads, mHeads + kLevels * kSlots, kNone);
+}
+
+// Put id in the slot its deadline falls in, as seen from mTick
+void TimerWheel::Link(Id id)
+{
+  Node& n = mNodes[id];
+  std::uint64_t deadline = std::max(n.mDeadline, mTick);
+  const std::uint64_t delta = deadline - mTick;
+  std::size_t level = 0;
+  while (level < kLevels - 1 && delta >= SlotTicks(level + 1)) {
+    level++;
+  }
+  if (delta >= SlotTicks(kLevels)) {
+    // Beyond the top level: wait in its furthest slot, and be placed
+    // again from there when it cascades
+    deadline = mTick + SlotTicks(kLevels) - 1;
+  }
+  const std::size_t slot =
+      level * kSlots + ((deadline >> (kSlotBits * level)) & (kSlots - 1));
+  n.mSlot = slot;
+  n.mPrev = kNone;
+  n.mNext = mHeads[slot];
+  if (n.mNext != kNone) {
+    mNodes[n.mNext].mPrev = id;
+  }
+  mHeads[slot] = id;
+}
+
+void TimerWheel::Unlink(Id id)
+{
+  Node& n = mNodes[id];
+  if (n.mPrev != kNone) {
+    mNodes[n.mPrev].mNext = n.mNext;
+  } else {
+    mHeads[n.mSlot] = n.mNext;
+  }
+  if (n.mNext != kNone) {
+    mNodes[n.mNext].mPrev = n.mPrev;
+  }
+  n.mPrev = n.mNext = kNone;
+  n.mSlot = kNoSlot;
+}
+
+void TimerWheel::Schedule(Id id, std::uint64_t deadline_ms)
+{
+  if (id >= mNodes.size()) {
+    mNodes.resize(id + 1);
+  }
+  if (IsScheduled(id)) {
+    Unlink(id);
+  } else {
+    mCount++;
+  }
+  mNodes[id].mDeadline = (deadline_ms + mTickMs - 1) / mTickMs;
+  Link(id);
+}
+
+bool TimerWheel::Cancel(Id id)
+{
+  if (!IsScheduled(id)) {
+    return false;
+  }
+  Unlink(id);
+  mCount--;
+  return true;
+}
+
+void TimerWheel::Cascade(std::size_t level)
+{
+  const std::size_t slot =
+      level * kSlots + ((mTick >> (kSlotBits * level)) & (kSlots - 1));
+  Id id = mHeads[slot];
+  mHeads[slot] = kNone;
+  while (id != kNone) {
+    const Id next = mNodes[id].mNext;
+    Link(id);
+    id = next;
+  }
+}
+
+std::size_t TimerWheel::Advance(std::uint64_t now_ms,
+                                std::vector<Id>& expired)
+{
+  const std::uint64_t target = now_ms / mTickMs;
+  const std::size_t before = expired.size();
+  while (mTick <= target) {
+    // Skip the ticks where nothing cascades or fires
+    const std::uint64_t next = mCount == 0 ? UINT64_MAX : GetNextTick();
+    if (next > target) {
+      mTick = target + 1;
+      break;
+    }
+    mTick = next;
+    // A level cascades when every level below it wrapped
+    for (std::size_t level = 1; level < kLevels; level++) {
+      if ((mTick & (SlotTicks(level) - 1)) != 0) {
+        break;
+      }
+      Cascade(level);
+    }
+    const std::size_t slot = mTick & (kSlots - 1);
+    while (mHeads[slot] != kNone) {
+      const Id id = mHeads[slot];
+      Unlink(id);
+      mCount--;
+      expired.push_back(id);
+    }
+    mTick++;
+  }
+  return expired.size() - before;
+}
+
+std::uint64_t TimerWheel::GetNextTick() const
+{
+  std::uint64_t next = UINT64_MAX;
+  // Level 0 holds exactly the ticks [mTick, mTick + kSlots)
+  for (std::size_t i = 0; i < kSlots; i++) {
+    if (mHeads[(mTick + i) & (kSlots - 1)] != kNone) {
+      next = mTick + i;
+      break;
+    }
+  }
+  // A slot of a higher level is due when it cascades
+  for (std::size_t level = 1; level < kLevels; level++) {
+    const std::uint64_t width = SlotTicks(level);
+    const std::uint64_t wrap = (mTick + width - 1) / width;
+    for (std::size_t i = 0; i < kSlots; i++) {
+      if (mHeads[level * kSlots + ((wrap + i) & (kSlots - 1))] != kNone) {
+        next = std::min(next, (wrap + i) * width);
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+std::uint64_t TimerWheel::GetNextDeadline() const
+{
+  return mCount == 0 ? 0 : GetNextTick() * mTickMs;
+}
+
+} // namespace timer_wheel
@@ -0,0 +1,67 @@
+#ifndef MDNS_TEST_UTIL_H
+#define MDNS_TEST_UTIL_H
+
+#include <cstdint>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "mdns_message.h"
+
+namespace dns_message {
+
+namespace testing {
+
+// The Cast receiver the mDNS tests announce, look up and answer for
+static const char kService[] = "\x0b_googlecast\x04_tcp\x05local";
+static const char kInstance[] =
+    "\x07Kitchen\x0b_googlecast\x04_tcp\x05local";
+static const char kHost[] = "\x07kitchen\x05local";
+static const char kSrv[] = "\0\0\0\0\x1f\x49\x07kitchen\x05local";
+static const char kTxt[] = "\x07id=1234\x0d""fn=Kitchen TV";
+static const char kAddress[] = "\xc0\xa8\x01\x14";
+static const std::uint16_t kIN = 1;
+static const std::uint16_t kFlush = DNSMessageWriter::kCacheFlush | kIN;
+// A question that asks for a unicast response
+static const std::uint16_t kQU = 0x8000 | kIN;
+
+inline gsl::span<const char> Span(const char* s, std::size_t len)
+{
+  return gsl::span<const char>(s, len);
+}
+
+// One message, written through mWriter and parsed by Parse()
+class TestMessage {
+  char mBuf[512];
+  std::unique_ptr<DNSMessage> mMsg;
+
+public:
+  DNSMessageWriter mWriter;
+
+  explicit TestMessage(std::uint16_t flags = DNSMessageWriter::kFlagQR |
+                                             DNSMessageWriter::kFlagAA)
+      : mWriter(gsl::span<char>(mBuf, sizeof(mBuf)), 0, flags) {}
+  TestMessage(const TestMessage&) = delete;
+  TestMessage& operator=(const TestMessage&) = delete;
+
+  // An A record for kHost of 10.0.0.last
+  void AddA(std::uint8_t last, std::uint16_t rrclass, std::uint32_t ttl,
+            DNSMessage::eSection section = DNSMessage::SECTION_AN) {
+    const char address[] = {10, 0, 0, static_cast<char>(last)};
+    EXPECT_TRUE(mWriter.AddAddress(section, Span(kHost, sizeof(kHost)),
+                                   rrclass, ttl,
+                                   Span(address, sizeof(address))));
+  }
+  // Finish the message and parse it, it lives as long as this object
+  const DNSMessage& Parse() {
+    mMsg.reset(new DNSMessage(gsl::span<const char>(mBuf,
+                                                    mWriter.Finish())));
+    EXPECT_TRUE(mMsg->ProcessMessage());
+    return *mMsg;
+  }
+  const DNSMessage& GetMessage() const { return *mMsg; }
+};
+
+} // namespace testing
+} // namespace dns_message
+
+#endif // MDNS_TEST_UTIL_H
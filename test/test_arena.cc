@@ -0,0 +1,131 @@
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "arena.h"
+#include "mdns_message.h"
+
+// Count every heap allocation made by the test binary
+static std::size_t gAllocations = 0;
+
+void* operator new(std::size_t n)
+{
+  ++gAllocations;
+  void* p = std::malloc(n == 0 ? 1 : n);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace arena {
+
+namespace testing {
+
+// Response to a _googlecast._tcp.local PTR question with two answers
+static const std::string kResponse =
+    std::string("\0\0\x84\0\0\x01\0\x02\0\0\0\0", 12) +
+    std::string("\x0b_googlecast\x04_tcp\x05local\0\0\x0c\0\x01", 28) +
+    std::string("\xc0\x0c\0\x0c\0\x01\0\0\x11\x94\0\x0d"
+                "\x0a""Chromecast\xc0\x0c", 25) +
+    std::string("\xc0\x0c\0\x0c\0\x01\0\0\x11\x94\0\x0a"
+                "\x07""Kitchen\xc0\x0c", 22);
+
+TEST(ArenaTest, AllocationsAreAligned) {
+  Arena a(64);
+  void* p;
+
+  a.Allocate(1, 1);
+  p = a.Allocate(8, 8);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % 8);
+  p = a.Allocate(3, 1);
+  p = a.Allocate(16, 16);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % 16);
+}
+
+TEST(ArenaTest, LargeAllocationGetsItsOwnBlock) {
+  Arena a(64);
+  char* p;
+
+  p = static_cast<char*>(a.Allocate(1000));
+  p[0] = 1;
+  p[999] = 1;
+  EXPECT_GE(a.GetAllocated(), 1000u);
+}
+
+TEST(ArenaTest, ResetCoalescesBlocks) {
+  Arena a(64);
+  std::size_t before;
+
+  for (int i = 0; i < 10; i++) {
+    a.Allocate(48);
+  }
+  a.Reset();
+  EXPECT_EQ(0u, a.GetAllocated());
+  before = gAllocations;
+  for (int i = 0; i < 10; i++) {
+    a.Allocate(48);
+  }
+  EXPECT_EQ(before, gAllocations);
+}
+
+TEST(ArenaTest, AllocatorFallsBackToHeap) {
+  ArenaAllocator<int> alloc;
+  std::size_t before;
+  int* p;
+
+  before = gAllocations;
+  p = alloc.allocate(4);
+  EXPECT_EQ(before + 1, gAllocations);
+  alloc.deallocate(p, 4);
+}
+
+TEST(ArenaTest, SteadyStateParseDoesNotAllocate) {
+  Arena a;
+  std::size_t before;
+
+  {
+    // Warm up, the arena's first block comes from the heap
+    dns_message::DNSMessage msg{gsl::span<const char>(kResponse.data(),
+                                                      kResponse.size()), &a};
+    ASSERT_TRUE(msg.ProcessMessage());
+  }
+  a.Reset();
+
+  before = gAllocations;
+  for (int i = 0; i < 100; i++) {
+    dns_message::DNSMessage msg{gsl::span<const char>(kResponse.data(),
+                                                      kResponse.size()), &a};
+    ASSERT_TRUE(msg.ProcessMessage());
+    ASSERT_EQ(1u, msg.GetQuestions().size());
+    ASSERT_EQ(2u, msg.GetAnswers().size());
+    a.Reset();
+  }
+  EXPECT_EQ(before, gAllocations);
+}
+
+TEST(ArenaTest, ParseWithoutArenaAllocates) {
+  std::size_t before;
+
+  before = gAllocations;
+  {
+    dns_message::DNSMessage msg{gsl::span<const char>(kResponse.data(),
+                                                      kResponse.size())};
+    ASSERT_TRUE(msg.ProcessMessage());
+  }
+  EXPECT_LT(before, gAllocations);
+}
+
+} // namespace testing
+} // namespace arena
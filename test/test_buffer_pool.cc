@@ -0,0 +1,89 @@
+#include <cstring>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "buffer_pool.h"
+
+namespace mnet {
+
+namespace testing {
+
+TEST(BufferPoolTest, SizeClasses) {
+  BufferPool::eSizeClass c;
+
+  ASSERT_TRUE(BufferPool::ClassFor(0, c));
+  EXPECT_EQ(BufferPool::CLASS_SMALL, c);
+  ASSERT_TRUE(BufferPool::ClassFor(513, c));
+  EXPECT_EQ(BufferPool::CLASS_STANDARD, c);
+  ASSERT_TRUE(BufferPool::ClassFor(1473, c));
+  EXPECT_EQ(BufferPool::CLASS_JUMBO, c);
+  ASSERT_TRUE(BufferPool::ClassFor(8972, c));
+  EXPECT_FALSE(BufferPool::ClassFor(8973, c));
+
+  BufferPool pool;
+  EXPECT_TRUE(pool.Acquire(std::size_t(8973)).IsEmpty());
+  Buffer b = pool.Acquire(std::size_t(1000));
+  EXPECT_EQ(1472u, b.GetCapacity());
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(b.GetData()) %
+                alignof(std::max_align_t));
+}
+
+TEST(BufferPoolTest, ReleasedBuffersAreReused) {
+  BufferPool pool;
+  char* first;
+
+  {
+    Buffer b = pool.Acquire(BufferPool::CLASS_JUMBO);
+    first = b.GetData();
+    std::memset(first, 'x', b.GetCapacity());
+    b.SetLength(9);
+    EXPECT_EQ(1u, pool.GetInUse(BufferPool::CLASS_JUMBO));
+  }
+  EXPECT_EQ(0u, pool.GetInUse(BufferPool::CLASS_JUMBO));
+  for (int i = 0; i < 100; i++) {
+    Buffer b = pool.Acquire(BufferPool::CLASS_JUMBO);
+    EXPECT_EQ(first, b.GetData());
+    EXPECT_EQ(0u, b.GetLength());
+  }
+  EXPECT_EQ(1u, pool.GetAllocated(BufferPool::CLASS_JUMBO));
+  EXPECT_EQ(0u, pool.GetAllocated(BufferPool::CLASS_STANDARD));
+}
+
+TEST(BufferPoolTest, SharedHandles) {
+  BufferPool pool;
+  Buffer a = pool.Acquire(BufferPool::CLASS_SMALL);
+  EXPECT_FALSE(a.IsShared());
+
+  Buffer b = a;
+  EXPECT_TRUE(a.IsShared());
+  EXPECT_EQ(a.GetData(), b.GetData());
+  a.Reset();
+  EXPECT_TRUE(a.IsEmpty());
+  EXPECT_FALSE(b.IsShared());
+  EXPECT_EQ(1u, pool.GetInUse(BufferPool::CLASS_SMALL));
+
+  Buffer c = std::move(b);
+  EXPECT_TRUE(b.IsEmpty());
+  c = c;
+  EXPECT_EQ(1u, pool.GetInUse(BufferPool::CLASS_SMALL));
+  c = a;
+  EXPECT_EQ(0u, pool.GetInUse(BufferPool::CLASS_SMALL));
+}
+
+TEST(BufferPoolTest, Reserve) {
+  BufferPool pool;
+
+  pool.Reserve(BufferPool::CLASS_STANDARD, 4);
+  EXPECT_EQ(4u, pool.GetAllocated(BufferPool::CLASS_STANDARD));
+  {
+    Buffer a = pool.Acquire(BufferPool::CLASS_STANDARD);
+    Buffer b = pool.Acquire(BufferPool::CLASS_STANDARD);
+    pool.Reserve(BufferPool::CLASS_STANDARD, 4);
+    EXPECT_EQ(6u, pool.GetAllocated(BufferPool::CLASS_STANDARD));
+  }
+  pool.Reserve(BufferPool::CLASS_STANDARD, 4);
+  EXPECT_EQ(6u, pool.GetAllocated(BufferPool::CLASS_STANDARD));
+}
+
+} // namespace testing
+} // namespace mnet
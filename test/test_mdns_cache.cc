@@ -0,0 +1,245 @@
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mdns_cache.h"
+#include "mdns_test_util.h"
+
+namespace dns_message {
+
+namespace testing {
+
+static const char kInstanceLower[] =
+    "\x07kitchen\x0b_googlecast\x04_tcp\x05local";
+
+// The last octet of each address found for kHost at now_ms
+static std::string Addresses(const DNSRecordCache& cache,
+                             std::uint64_t now_ms)
+{
+  const DNSRecordCache::Record* found[8];
+  const std::size_t n = cache.Lookup(Span(kHost, sizeof(kHost)), DNSRR::RR_A,
+                                     kIN, now_ms, found, 8);
+  std::string out;
+  for (std::size_t i = 0; i < n && i < 8; i++) {
+    out.push_back('0' + found[i]->mRData[3]);
+  }
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+TEST(DNSRecordCacheTest, LearnsACastDevice) {
+  DNSRecordCache cache(0);
+  TestMessage r;
+
+  ASSERT_TRUE(r.mWriter.AddPtr(DNSMessage::SECTION_AN,
+                               Span(kService, sizeof(kService)), kIN, 4500,
+                               Span(kInstance, sizeof(kInstance))));
+  ASSERT_TRUE(r.mWriter.AddSrv(DNSMessage::SECTION_AR,
+                               Span(kInstance, sizeof(kInstance)), kFlush,
+                               120, 0, 0, 8009, Span(kHost, sizeof(kHost))));
+  r.AddA(20, kFlush, 120, DNSMessage::SECTION_AR);
+  EXPECT_EQ(3u, cache.AddResponse(r.Parse(), 1000));
+  EXPECT_EQ(3u, cache.GetCount());
+
+  // The PTR target comes back uncompressed, whatever the message did
+  const DNSRecordCache::Record* found[4];
+  ASSERT_EQ(1u, cache.Lookup(Span(kService, sizeof(kService)),
+                             DNSRR::RR_PTR, kIN, 2000, found, 4));
+  EXPECT_EQ(std::string(kInstance, sizeof(kInstance)), found[0]->mRData);
+  EXPECT_EQ(4499u, DNSRecordCache::GetRemainingTTL(*found[0], 2000));
+
+  // Names match without case, and the cache-flush bit is not the class
+  ASSERT_EQ(1u, cache.Lookup(Span(kInstanceLower, sizeof(kInstanceLower)),
+                             DNSRR::RR_SRV, kFlush, 2000, found, 4));
+  EXPECT_EQ(std::string(kSrv, sizeof(kSrv)), found[0]->mRData);
+  EXPECT_EQ(0u, cache.Lookup(Span(kInstance, sizeof(kInstance)),
+                             DNSRR::RR_TXT, kIN, 2000, found, 4));
+
+  // The SRV and A go after their 120 seconds, the PTR stays. The wheel
+  // may wake up early to cascade them.
+  EXPECT_GE(121000u, cache.GetNextExpiry());
+  EXPECT_LT(2000u, cache.GetNextExpiry());
+  EXPECT_EQ(0u, cache.Expire(120999));
+  EXPECT_EQ(2u, cache.Expire(121000));
+  EXPECT_EQ("", Addresses(cache, 121000));
+  EXPECT_EQ(1u, cache.GetCount());
+}
+
+TEST(DNSRecordCacheTest, CacheFlushKeepsTheNewRRSet) {
+  DNSRecordCache cache(0);
+  {
+    // Two addresses in one announcement both stay
+    TestMessage r;
+    r.AddA(1, kFlush, 120);
+    r.AddA(2, kFlush, 120);
+    EXPECT_EQ(2u, cache.AddResponse(r.Parse(), 1000));
+  }
+  EXPECT_EQ("12", Addresses(cache, 1500));
+  {
+    // A shared record does not flush anything
+    TestMessage r;
+    r.AddA(3, kIN, 120);
+    cache.AddResponse(r.Parse(), 5000);
+  }
+  EXPECT_EQ("123", Addresses(cache, 5000));
+  {
+    TestMessage r;
+    r.AddA(2, kFlush, 120);
+    r.AddA(4, kFlush, 120);
+    cache.AddResponse(r.Parse(), 10000);
+  }
+  // The others go one second later, 2 was announced again
+  EXPECT_EQ("1234", Addresses(cache, 10999));
+  EXPECT_EQ("24", Addresses(cache, 11000));
+  EXPECT_EQ(2u, cache.Expire(11000));
+  EXPECT_EQ(2u, cache.GetCount());
+}
+
+TEST(DNSRecordCacheTest, GoodbyeExpiresInOneSecond) {
+  DNSRecordCache cache(0);
+  {
+    TestMessage r;
+    r.AddA(1, kFlush, 120);
+    r.AddA(2, kFlush, 120);
+    cache.AddResponse(r.Parse(), 0);
+  }
+  {
+    TestMessage r;
+    r.AddA(1, kFlush, 0);
+    // Nothing to say goodbye to
+    r.AddA(9, kFlush, 0);
+    cache.AddResponse(r.Parse(), 5000);
+  }
+  EXPECT_EQ("12", Addresses(cache, 5999));
+  EXPECT_EQ(1u, cache.Expire(6000));
+  EXPECT_EQ("2", Addresses(cache, 6000));
+}
+
+TEST(DNSRecordCacheTest, BoundedAndIgnoresQueries) {
+  DNSRecordCache cache(0, 2);
+  {
+    TestMessage r;
+    r.AddA(1, kIN, 120);
+    r.AddA(2, kIN, 120);
+    r.AddA(3, kIN, 120);
+    EXPECT_EQ(2u, cache.AddResponse(r.Parse(), 0));
+  }
+  EXPECT_EQ(1u, cache.GetRefused());
+  EXPECT_EQ(2u, cache.GetCount());
+  // Once expired, the slots are used again
+  EXPECT_EQ(2u, cache.Expire(120000));
+  {
+    TestMessage r;
+    r.AddA(3, kIN, 120);
+    EXPECT_EQ(1u, cache.AddResponse(r.Parse(), 130000));
+  }
+  EXPECT_EQ("3", Addresses(cache, 130000));
+
+  char buf[512];
+  DNSMessageWriter query(gsl::span<char>(buf, sizeof(buf)));
+  const char address[] = {10, 0, 0, 4};
+  ASSERT_TRUE(query.AddAddress(DNSMessage::SECTION_AR,
+                               Span(kHost, sizeof(kHost)), kIN, 120,
+                               Span(address, sizeof(address))));
+  DNSMessage msg{gsl::span<const char>(buf, query.Finish())};
+  ASSERT_TRUE(msg.ProcessMessage());
+  EXPECT_EQ(0u, cache.AddResponse(msg, 130000));
+}
+
+TEST(DNSRecordCacheTest, KeepsNamesInRDataWhole) {
+  DNSRecordCache cache(0);
+  static const char kWww[] = "\x03www\x05local";
+  // The CNAME target and the NAPTR owner point back into the packet
+  static const char kPacket[] =
+      "\0\0\x84\0\0\0\0\x03\0\0\0\0"
+      /* 12: kitchen.local A 10.0.0.1 */
+      "\x07kitchen\x05local\0" "\0\x01\0\x01\0\0\0\x78\0\x04\x0a\0\0\x01"
+      /* 41: www.local CNAME kitchen.local */
+      "\x03www\xc0\x14" "\0\x05\0\x01\0\0\0\x78\0\x02\xc0\x0c"
+      /* 59: local NAPTR 10 100 "S" "" "" kitchen.local */
+      "\xc0\x14" "\0\x23\0\x01\0\0\0\x78\0\x0a\0\x0a\0\x64\x01S\0\0\xc0\x0c";
+  DNSMessage msg{gsl::span<const char>(kPacket, sizeof(kPacket) - 1)};
+  ASSERT_TRUE(msg.ProcessMessage());
+
+  // A NAPTR may hold a pointer we do not follow, it is not learned
+  EXPECT_EQ(2u, cache.AddResponse(msg, 0));
+  const DNSRecordCache::Record* found[1];
+  ASSERT_EQ(1u, cache.Lookup(Span(kWww, sizeof(kWww)), DNSRR::RR_CNAME, kIN,
+                             0, found, 1));
+  EXPECT_EQ(std::string(kHost, sizeof(kHost)), found[0]->mRData);
+
+  // Sent back as a known answer it still names kitchen.local
+  const DNSRecordCache::Question q = {Span(kWww, sizeof(kWww)),
+                                      DNSRR::RR_CNAME, kIN};
+  std::vector<std::vector<char>> packets;
+  ASSERT_EQ(1u, cache.WriteQuery(&q, 1, 0, 1500, packets));
+  DNSMessage query{gsl::span<const char>(packets[0].data(),
+                                         packets[0].size())};
+  ASSERT_TRUE(query.ProcessMessage());
+  ASSERT_EQ(1u, query.GetAnswers().size());
+  const std::vector<std::string> kitchen = { "kitchen", "local" };
+  EXPECT_EQ(kitchen,
+            query.GetAnswers().at(0).GetRData().GetFirstName().GetLabels());
+}
+
+TEST(DNSRecordCacheTest, QueryListsFreshKnownAnswers) {
+  DNSRecordCache cache(0);
+  static const char kA[] = "\x01""A\x0b_googlecast\x04_tcp\x05local";
+  static const char kB[] = "\x01""B\x0b_googlecast\x04_tcp\x05local";
+  static const char kC[] = "\x01""C\x0b_googlecast\x04_tcp\x05local";
+  {
+    TestMessage r;
+    for (const char* instance : {kA, kB}) {
+      ASSERT_TRUE(r.mWriter.AddPtr(DNSMessage::SECTION_AN,
+                                   Span(kService, sizeof(kService)), kIN,
+                                   4500, Span(instance, sizeof(kA))));
+    }
+    // Less than half of it is left by the query
+    ASSERT_TRUE(r.mWriter.AddPtr(DNSMessage::SECTION_AN,
+                                 Span(kService, sizeof(kService)), kIN, 100,
+                                 Span(kC, sizeof(kC))));
+    EXPECT_EQ(3u, cache.AddResponse(r.Parse(), 0));
+  }
+  const DNSRecordCache::Question q = {Span(kService, sizeof(kService)),
+                                      DNSRR::RR_PTR, kIN};
+  std::vector<std::vector<char>> packets;
+
+  ASSERT_EQ(1u, cache.WriteQuery(&q, 1, 60000, 1500, packets));
+  {
+    DNSMessage msg{gsl::span<const char>(packets[0].data(),
+                                         packets[0].size())};
+    ASSERT_TRUE(msg.ProcessMessage());
+    EXPECT_FALSE(msg.GetHeader().GetTCField());
+    EXPECT_EQ(1u, msg.GetQuestions().size());
+    ASSERT_EQ(2u, msg.GetAnswers().size());
+    for (const DNSRR& rr : msg.GetAnswers()) {
+      EXPECT_EQ(4440u, rr.GetTTL());
+    }
+  }
+
+  // One known answer fits with the question, the other follows
+  packets.clear();
+  ASSERT_EQ(2u, cache.WriteQuery(&q, 1, 60000, 60, packets));
+  std::size_t answers = 0;
+  for (std::size_t i = 0; i < 2; i++) {
+    EXPECT_GE(60u, packets[i].size());
+    DNSMessage msg{gsl::span<const char>(packets[i].data(),
+                                         packets[i].size())};
+    ASSERT_TRUE(msg.ProcessMessage());
+    EXPECT_EQ(i == 0, msg.GetHeader().GetTCField());
+    EXPECT_EQ(i == 0 ? 1u : 0u, msg.GetQuestions().size());
+    answers += msg.GetAnswers().size();
+  }
+  EXPECT_EQ(2u, answers);
+
+  // Nothing is written if the question does not fit
+  packets.clear();
+  EXPECT_EQ(0u, cache.WriteQuery(&q, 1, 60000, 20, packets));
+  EXPECT_TRUE(packets.empty());
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -0,0 +1,104 @@
+
+#include <cstring>
+#include <memory>
+
+#include "gtest/gtest.h"
+#include "mdns_duplicates.h"
+#include "mdns_test_util.h"
+
+namespace dns_message {
+
+namespace testing {
+
+static const char kHostUpper[] = "\x07KITCHEN\x05local";
+
+static bool SuppressA(DNSDuplicateSuppressor& dups, const char* name,
+                      std::size_t namelen, std::uint8_t last,
+                      std::uint32_t ttl, std::uint64_t now_ms)
+{
+  const char address[] = {10, 0, 0, static_cast<char>(last)};
+  return dups.SuppressAnswer(Span(name, namelen), DNSRR::RR_A, kIN,
+                             Span(address, sizeof(address)), ttl, now_ms);
+}
+
+TEST(DNSDuplicateSuppressorTest, AnswerJustSentIsNotRepeated) {
+  DNSDuplicateSuppressor dups;
+  TestMessage response;
+  response.AddA(20, kFlush, 120);
+  dups.ObserveResponse(response.Parse(), 0);
+  EXPECT_EQ(1u, dups.GetAnswerCount());
+
+  // The same record, the cache-flush bit and the case aside
+  EXPECT_TRUE(SuppressA(dups, kHostUpper, sizeof(kHostUpper), 20, 120, 500));
+  EXPECT_EQ(1u, dups.GetSuppressedAnswers());
+  // Ours would be cached for longer
+  EXPECT_FALSE(SuppressA(dups, kHost, sizeof(kHost), 20, 4500, 500));
+  EXPECT_FALSE(SuppressA(dups, kHost, sizeof(kHost), 21, 120, 500));
+  // Only for a while
+  EXPECT_FALSE(SuppressA(dups, kHost, sizeof(kHost), 20, 120,
+                         DNSDuplicateSuppressor::kHoldMs));
+  dups.Expire(DNSDuplicateSuppressor::kHoldMs);
+  EXPECT_EQ(0u, dups.GetAnswerCount());
+
+  // A goodbye suppresses nothing
+  TestMessage goodbye;
+  goodbye.AddA(20, kFlush, 0);
+  dups.ObserveResponse(goodbye.Parse(), 2000);
+  EXPECT_FALSE(SuppressA(dups, kHost, sizeof(kHost), 20, 120, 2000));
+}
+
+TEST(DNSDuplicateSuppressorTest, QuestionJustAskedIsNotRepeated) {
+  DNSDuplicateSuppressor dups;
+  {
+    TestMessage query(0);
+    ASSERT_TRUE(query.mWriter.AddQuestion(Span(kService, sizeof(kService)),
+                                          DNSRR::RR_PTR, kIN));
+    // Asked for a unicast answer, which we would not see
+    ASSERT_TRUE(query.mWriter.AddQuestion(Span(kHost, sizeof(kHost)),
+                                          DNSRR::RR_A, kQU));
+    dups.ObserveQuery(query.Parse(), 0);
+  }
+  {
+    // Its known answers may hold back answers we do not have
+    TestMessage query(0);
+    ASSERT_TRUE(query.mWriter.AddQuestion(Span(kInstance, sizeof(kInstance)),
+                                          DNSRR::RR_SRV, kIN));
+    query.AddA(20, kFlush, 120);
+    dups.ObserveQuery(query.Parse(), 0);
+  }
+  EXPECT_EQ(1u, dups.GetQuestionCount());
+  EXPECT_TRUE(dups.SuppressQuestion(Span(kService, sizeof(kService)),
+                                    DNSRR::RR_PTR, kQU, 100));
+  EXPECT_FALSE(dups.SuppressQuestion(Span(kService, sizeof(kService)),
+                                     DNSRR::RR_SRV, kIN, 100));
+  EXPECT_FALSE(dups.SuppressQuestion(Span(kHost, sizeof(kHost)),
+                                     DNSRR::RR_A, kIN, 100));
+  EXPECT_FALSE(dups.SuppressQuestion(Span(kInstance, sizeof(kInstance)),
+                                     DNSRR::RR_SRV, kIN, 100));
+  EXPECT_EQ(1u, dups.GetSuppressedQuestions());
+
+  // Responses are not questions
+  TestMessage response(DNSMessageWriter::kFlagQR);
+  ASSERT_TRUE(response.mWriter.AddQuestion(Span(kHost, sizeof(kHost)),
+                                           DNSRR::RR_A, kIN));
+  dups.ObserveQuery(response.Parse(), 100);
+  EXPECT_EQ(1u, dups.GetQuestionCount());
+}
+
+TEST(DNSDuplicateSuppressorTest, BoundedOldestFirst) {
+  DNSDuplicateSuppressor dups(2);
+  for (std::uint8_t last = 1; last <= 3; last++) {
+    TestMessage response(DNSMessageWriter::kFlagQR);
+    response.AddA(last, kFlush, 120);
+    // Seen again, which must not keep a stale entry around
+    response.AddA(last, kFlush, 120);
+    dups.ObserveResponse(response.Parse(), last);
+  }
+  EXPECT_EQ(2u, dups.GetAnswerCount());
+  EXPECT_FALSE(SuppressA(dups, kHost, sizeof(kHost), 1, 120, 10));
+  EXPECT_TRUE(SuppressA(dups, kHost, sizeof(kHost), 2, 120, 10));
+  EXPECT_TRUE(SuppressA(dups, kHost, sizeof(kHost), 3, 120, 10));
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -0,0 +1,102 @@
+#include <string>
+
+#include "gtest/gtest.h"
+#include "mdns_filter.h"
+
+namespace dns_message {
+
+namespace testing {
+
+static const std::string kGoogleCast("\x0b_googlecast\x04_tcp\x05local\0", 24);
+
+static std::string header(const char* flags, const char* counts)
+{
+  return std::string("\0\0", 2) + std::string(flags, 2) +
+         std::string(counts, 8);
+}
+
+TEST(DNSPacketFilterTest, DropsShortPackets) {
+  DNSPacketFilter filter;
+
+  EXPECT_EQ(DNSPacketFilter::DROP_TOO_SHORT, filter.Classify("\0\0\0", 3));
+  EXPECT_EQ(DNSPacketFilter::DROP_TOO_SHORT, filter.Classify(nullptr, 0));
+  EXPECT_EQ(2u, filter.GetCount(DNSPacketFilter::DROP_TOO_SHORT));
+}
+
+TEST(DNSPacketFilterTest, DropsOpcodeAndRcode) {
+  DNSPacketFilter filter;
+  std::string m;
+
+  m = header("\x08\0", "\0\0\0\0\0\0\0\0");
+  EXPECT_EQ(DNSPacketFilter::DROP_OPCODE, filter.Classify(m.data(), m.size()));
+  m = header("\x84\x03", "\0\0\0\0\0\0\0\0");
+  EXPECT_EQ(DNSPacketFilter::DROP_RCODE, filter.Classify(m.data(), m.size()));
+  m = header("\x84\0", "\0\0\0\0\0\0\0\0");
+  EXPECT_EQ(DNSPacketFilter::ACCEPT, filter.Classify(m.data(), m.size()));
+  EXPECT_EQ(1u, filter.GetCount(DNSPacketFilter::DROP_OPCODE));
+  EXPECT_EQ(1u, filter.GetCount(DNSPacketFilter::DROP_RCODE));
+  EXPECT_EQ(1u, filter.GetCount(DNSPacketFilter::ACCEPT));
+  filter.ResetCounters();
+  EXPECT_EQ(0u, filter.GetCount(DNSPacketFilter::ACCEPT));
+}
+
+TEST(DNSPacketFilterTest, AddNameRejectsMalformed) {
+  DNSPacketFilter filter;
+
+  EXPECT_FALSE(filter.AddName("\x03""foo", 4));
+  EXPECT_FALSE(filter.AddName("\x03""foo\0\0", 6));
+  EXPECT_FALSE(filter.AddName("", 0));
+  EXPECT_TRUE(filter.AddName(kGoogleCast.data(), kGoogleCast.size()));
+}
+
+TEST(DNSPacketFilterTest, MatchesQuestionName) {
+  DNSPacketFilter filter;
+  std::string m;
+
+  ASSERT_TRUE(filter.AddName(kGoogleCast.data(), kGoogleCast.size()));
+  m = header("\0\0", "\0\x01\0\0\0\0\0\0") + kGoogleCast +
+      std::string("\0\x0c\0\x01", 4);
+  EXPECT_EQ(DNSPacketFilter::ACCEPT, filter.Classify(m.data(), m.size()));
+
+  /* Case is ignored */
+  m = header("\0\0", "\0\x01\0\0\0\0\0\0") +
+      std::string("\x0b_GoogleCast\x04_TCP\x05local\0\0\x0c\0\x01", 28);
+  EXPECT_EQ(DNSPacketFilter::ACCEPT, filter.Classify(m.data(), m.size()));
+
+  m = header("\0\0", "\0\x01\0\0\0\0\0\0") +
+      std::string("\x08_airplay\x04_tcp\x05local\0\0\x0c\0\x01", 25);
+  EXPECT_EQ(DNSPacketFilter::DROP_NAME, filter.Classify(m.data(), m.size()));
+}
+
+TEST(DNSPacketFilterTest, MatchesAnswerSubdomain) {
+  DNSPacketFilter filter;
+  std::string m;
+
+  ASSERT_TRUE(filter.AddName(kGoogleCast.data(), kGoogleCast.size()));
+  m = header("\x84\0", "\0\0\0\x01\0\0\0\0") + std::string("\x07Kitchen", 8) +
+      kGoogleCast;
+  EXPECT_EQ(DNSPacketFilter::ACCEPT, filter.Classify(m.data(), m.size()));
+
+  /* A suffix only counts on a label boundary */
+  m = header("\x84\0", "\0\0\0\x01\0\0\0\0") +
+      std::string("\x0cx_googlecast\x04_tcp\x05local\0", 25);
+  EXPECT_EQ(DNSPacketFilter::DROP_NAME, filter.Classify(m.data(), m.size()));
+}
+
+TEST(DNSPacketFilterTest, DropsMissingAndMalformedNames) {
+  DNSPacketFilter filter;
+  std::string m;
+
+  ASSERT_TRUE(filter.AddName(kGoogleCast.data(), kGoogleCast.size()));
+  m = header("\0\0", "\0\0\0\0\0\x01\0\0");
+  EXPECT_EQ(DNSPacketFilter::DROP_NO_NAME, filter.Classify(m.data(), m.size()));
+  m = header("\0\0", "\0\x01\0\0\0\0\0\0") + std::string("\x0b_googlecast", 12);
+  EXPECT_EQ(DNSPacketFilter::DROP_MALFORMED_NAME,
+            filter.Classify(m.data(), m.size()));
+  m = header("\0\0", "\0\x01\0\0\0\0\0\0") + std::string("\xc0\x0c", 2);
+  EXPECT_EQ(DNSPacketFilter::DROP_MALFORMED_NAME,
+            filter.Classify(m.data(), m.size()));
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -0,0 +1,125 @@
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mdns_known_answers.h"
+#include "mdns_test_util.h"
+
+namespace dns_message {
+
+namespace testing {
+
+using Accumulator = DNSKnownAnswerAccumulator;
+
+// A query packet, with the question or only known answers to follow it
+class Packet : public TestMessage {
+public:
+  Packet(bool question, bool truncated)
+      : TestMessage(truncated ? DNSMessageWriter::kFlagTC : 0) {
+    if (question) {
+      EXPECT_TRUE(mWriter.AddQuestion(Span(kService, sizeof(kService)),
+                                      DNSRR::RR_PTR, kIN));
+    }
+    Parse();
+  }
+};
+
+static struct sockaddr_in Source(std::uint8_t last)
+{
+  struct sockaddr_in sin;
+  std::memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(5353);
+  sin.sin_addr.s_addr = htonl(0x0a000000 | last);
+  return sin;
+}
+
+static Accumulator::eAction Add(Accumulator& acc, const Packet& p,
+                                const struct sockaddr_in& src,
+                                std::uint64_t known, std::uint64_t now_ms,
+                                unsigned ifindex = 2)
+{
+  return acc.Add(p.GetMessage(),
+                 reinterpret_cast<const struct sockaddr*>(&src), sizeof(src),
+                 ifindex, known, now_ms);
+}
+
+TEST(DNSKnownAnswerAccumulatorTest, MergesUntilTheDelayIsOver) {
+  Accumulator acc(0, Accumulator::kDefaultMaxPending, 1);
+  const struct sockaddr_in a = Source(1);
+  const Packet first(true, true);
+  const Packet more(false, true);
+  std::vector<Accumulator::Query> out;
+
+  EXPECT_EQ(Accumulator::HELD, Add(acc, first, a, 0x1, 0));
+  EXPECT_EQ(Accumulator::MERGED, Add(acc, more, a, 0x4, 100));
+  // Known answers from another interface are not for this query
+  EXPECT_EQ(Accumulator::IGNORED, Add(acc, more, a, 0x8, 100, 3));
+  EXPECT_EQ(1u, acc.GetCount());
+  EXPECT_LE(Accumulator::kMinDelayMs, acc.GetNextDeadline());
+  EXPECT_GE(Accumulator::kMaxDelayMs + 10, acc.GetNextDeadline());
+
+  EXPECT_EQ(0u, acc.Release(399, out));
+  EXPECT_EQ(1u, acc.Release(510, out));
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(0x5u, out[0].mKnown);
+  EXPECT_EQ(2u, out[0].mPackets);
+  EXPECT_EQ(2u, out[0].mIfIndex);
+  EXPECT_EQ(0, std::memcmp(&a, &out[0].mSrcAddr, sizeof(a)));
+  const gsl::span<const char> wire = first.GetMessage().GetMessage();
+  EXPECT_EQ(std::vector<char>(wire.begin(), wire.end()), out[0].mMessage);
+  EXPECT_EQ(0u, acc.GetCount());
+  EXPECT_EQ(0u, acc.GetNextDeadline());
+
+  // Once released, later known answers have nothing to go to
+  EXPECT_EQ(Accumulator::IGNORED, Add(acc, more, a, 0x2, 600));
+}
+
+TEST(DNSKnownAnswerAccumulatorTest, LastPacketReleasesEarly) {
+  Accumulator acc(0, Accumulator::kDefaultMaxPending, 1);
+  const struct sockaddr_in a = Source(1);
+  const struct sockaddr_in b = Source(2);
+  std::vector<Accumulator::Query> out;
+
+  EXPECT_EQ(Accumulator::ANSWER_NOW, Add(acc, Packet(true, false), a, 0, 0));
+  EXPECT_EQ(Accumulator::HELD, Add(acc, Packet(true, true), a, 0x1, 0));
+  EXPECT_EQ(Accumulator::HELD, Add(acc, Packet(true, true), b, 0x1, 0));
+  // Without TC, the last of the known answers of a
+  EXPECT_EQ(Accumulator::MERGED, Add(acc, Packet(false, false), a, 0x2, 50));
+  EXPECT_GE(60u, acc.GetNextDeadline());
+  EXPECT_EQ(1u, acc.Release(60, out));
+  ASSERT_EQ(1u, out.size());
+  EXPECT_EQ(0x3u, out[0].mKnown);
+
+  // A new query from b ends the known answers of the one before it
+  EXPECT_EQ(Accumulator::HELD, Add(acc, Packet(true, true), b, 0x4, 100));
+  EXPECT_EQ(2u, acc.GetCount());
+  EXPECT_EQ(1u, acc.Release(110, out));
+  ASSERT_EQ(2u, out.size());
+  EXPECT_EQ(0x1u, out[1].mKnown);
+  EXPECT_EQ(Accumulator::MERGED, Add(acc, Packet(false, true), b, 0x8, 120));
+  EXPECT_EQ(1u, acc.Release(1000, out));
+  EXPECT_EQ(0xcu, out[2].mKnown);
+}
+
+TEST(DNSKnownAnswerAccumulatorTest, FullTableAnswersAtOnce) {
+  Accumulator acc(0, 1, 1);
+  std::vector<Accumulator::Query> out;
+
+  EXPECT_EQ(Accumulator::HELD,
+            Add(acc, Packet(true, true), Source(1), 0, 0));
+  EXPECT_EQ(Accumulator::ANSWER_NOW,
+            Add(acc, Packet(true, true), Source(2), 0, 0));
+  EXPECT_EQ(1u, acc.GetRefused());
+  // Its slot is used again once released
+  EXPECT_EQ(1u, acc.Release(1000, out));
+  EXPECT_EQ(Accumulator::HELD,
+            Add(acc, Packet(true, true), Source(2), 0, 1000));
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -2,6 +2,7 @@
 
 #include "gtest/gtest.h"
 #include "mdns_message.h"
+#include "mdns_test_util.h"
 
 
 namespace dns_message {
@@ -127,6 +128,99 @@ TEST(DNSMessageTest, ProcessQuestionsHeaderAnd2Question) {
   EXPECT_TRUE(result);
 }
 
+TEST(DNSMessageTest, ViewModeDoesNotCopy) {
+  const char* input;
+  bool result;
+  std::unique_ptr<DNSMessage> dnsMsg;
+
+  input = "\0\0\0\0\0\x01\0\0\0\0\0\0\x10""0123456789abcdef\0\0\xc\1\0";
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(input, 34)));
+  EXPECT_EQ(input, dnsMsg->GetMessage().data());
+  result = dnsMsg->ProcessMessage();
+  ASSERT_TRUE(result);
+  EXPECT_EQ(std::string(input, 34), dnsMsg->GetRawMessage());
+}
+
+TEST(DNSMessageTest, CopyModeOwnsMessage) {
+  char input[] = "\0\0\0\0\0\0\0\0\0\0\0\0";
+  std::unique_ptr<DNSMessage> dnsMsg;
+
+  dnsMsg.reset(new DNSMessage(input, 12));
+  EXPECT_NE(input, dnsMsg->GetMessage().data());
+  input[5] = 1;
+  EXPECT_TRUE(dnsMsg->ProcessMessage());
+}
+
+TEST(DNSMessageTest, LazyParsesOnlyWhatIsAsked) {
+  const char* input;
+  std::unique_ptr<DNSMessage> dnsMsg;
+
+  /* One question, one PTR answer and a truncated additional record */
+  input = "\0\0\0\0\0\x01\0\x01\0\0\0\x01"
+          "\x01""a\0\0\x0c\0\x01"
+          "\xc0\x0c\0\x0c\0\x01\0\0\0\x78\0\x04\x01""b\xc0\x0c"
+          "\xc0\x0c\0\x0c";
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(input, 39)));
+  ASSERT_TRUE(dnsMsg->ProcessMessageLazily());
+  EXPECT_EQ(1, dnsMsg->GetHeader().GetQDCount());
+  ASSERT_EQ(1u, dnsMsg->GetQuestions().size());
+  EXPECT_EQ(std::string("a"), dnsMsg->GetQuestions().at(0).GetQNames().at(0));
+  EXPECT_FALSE(dnsMsg->HasParseError());
+  ASSERT_EQ(1u, dnsMsg->GetAnswers().size());
+  EXPECT_EQ(0x78u, dnsMsg->GetAnswers().at(0).GetTTL());
+  EXPECT_FALSE(dnsMsg->HasParseError());
+  EXPECT_TRUE(dnsMsg->GetAuthorities().empty());
+  EXPECT_FALSE(dnsMsg->HasParseError());
+  EXPECT_TRUE(dnsMsg->GetAdditionals().empty());
+  EXPECT_TRUE(dnsMsg->HasParseError());
+  /* Earlier sections are kept */
+  EXPECT_EQ(1u, dnsMsg->GetAnswers().size());
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(input, 39)));
+  EXPECT_FALSE(dnsMsg->ProcessMessage());
+}
+
+TEST(DNSMessageTest, LazyAnswersNeedQuestions) {
+  const char* input;
+  std::unique_ptr<DNSMessage> dnsMsg;
+
+  /* The question runs past the end, so no answers can be found */
+  input = "\0\0\0\0\0\x01\0\x01\0\0\0\0\x05""a";
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(input, 14)));
+  ASSERT_TRUE(dnsMsg->ProcessMessageLazily());
+  EXPECT_TRUE(dnsMsg->GetAnswers().empty());
+  EXPECT_TRUE(dnsMsg->HasParseError());
+  EXPECT_TRUE(dnsMsg->GetQuestions().empty());
+}
+
+TEST(DNSNameTest, NameRefersIntoMessage) {
+  const char* input;
+  DNSName name;
+  std::size_t offset;
+
+  input = "\0\x03""foo\x05""local\0\xff";
+  offset = 1;
+  ASSERT_TRUE(name.ProcessName(gsl::span<const char>(input, 13), offset));
+  EXPECT_EQ(12u, offset);
+  EXPECT_EQ(1u, name.GetOffset());
+  EXPECT_EQ(11u, name.GetWireLength());
+  EXPECT_EQ(input + 1, name.GetWire().data());
+  ASSERT_EQ(2u, name.GetLabels().size());
+  EXPECT_EQ(std::string("foo"), name.GetLabels().at(0));
+  EXPECT_EQ(std::string("local"), name.GetLabels().at(1));
+}
+
+TEST(DNSNameTest, NameRunsPastEnd) {
+  const char* input;
+  DNSName name;
+  std::size_t offset;
+
+  input = "\x03""foo\x05""loc";
+  offset = 0;
+  EXPECT_FALSE(name.ProcessName(gsl::span<const char>(input, 8), offset));
+  EXPECT_EQ(0u, offset);
+}
+
 TEST(DNSHeaderTest, ProcessHeaderRawMsgNull) {
   char* input;
   bool result;
@@ -400,13 +494,17 @@ TEST(DNSQuestionTest, TwiceIsBetterThanOnce) {
   std::size_t mlen;
   std::size_t offset;
 
+  /* The pointer is followed, so it must refer to a name earlier in
+     the message. Here that is the root at offset 0. */
   input = const_cast<char*>(
-    "\x10""0123456789abcdef\xc0\1\0\xc\1\0"
+    "\0\x10""0123456789abcdef\xc0\0\0\xc\1\0"
   );
-  mlen = 1 + 0x10 + 2 + 2 + 2;
-  offset = 0;
+  mlen = 1 + 1 + 0x10 + 2 + 2 + 2;
+  offset = 1;
   result = dnsQuestion.ProcessQuestion(input, mlen, offset);
   ASSERT_TRUE(result);
+  EXPECT_EQ(mlen, offset);
+  ASSERT_EQ(dnsQuestion.GetQNames().size(), 1u);
   EXPECT_EQ(dnsQuestion.GetQNames().at(0), std::string("0123456789abcdef"));
   EXPECT_EQ(dnsQuestion.GetQType(), 0x0c);
   EXPECT_EQ(dnsQuestion.GetQClass(), 0x01 << 8);
@@ -612,9 +710,502 @@ TEST(DNSRRTest, WellformedRData) {
   EXPECT_EQ(rr->GetRRClass(), 0x01);
   EXPECT_EQ(rr->GetTTL(), 0x04);
   EXPECT_EQ(rr->GetRDLength(), 0x06);
-  const DNSPtrRData* ptr = static_cast<const DNSPtrRData*>(rr->GetRData());
-  ASSERT_EQ(ptr->GetDName().size(), 1u);
-  EXPECT_EQ(ptr->GetDName().at(0), std::string("\x01\x02\x03\x04", 4));
+  const DNSRData& ptr = rr->GetRData();
+  ASSERT_EQ(ptr.GetDName().size(), 1u);
+  EXPECT_EQ(ptr.GetDName().at(0), std::string("\x01\x02\x03\x04", 4));
+}
+
+TEST(DNSRRTest, TTLWithHighBitsSet) {
+  const char* input;
+  std::unique_ptr<DNSRR> rr;
+  std::size_t offset;
+
+  /* Every octet of the TTL is at least 0x80 */
+  input = "\0\0\x01\x80\x01\xff\xfe\x80\x81\0\x04\x0a\0\0\x01";
+  offset = 0;
+  rr.reset(new DNSRR());
+  ASSERT_TRUE(rr->ProcessRR(input, 15, offset));
+  EXPECT_EQ(15u, offset);
+  EXPECT_EQ(0x8001, rr->GetRRClass());
+  EXPECT_EQ(0xfffe8081u, rr->GetTTL());
+
+  /* Without its last octet the RDATA does not fit, offset stays put */
+  offset = 0;
+  rr.reset(new DNSRR());
+  EXPECT_FALSE(rr->ProcessRR(input, 14, offset));
+  EXPECT_EQ(0u, offset);
+}
+
+TEST(DNSWireReaderTest, ChecksBoundsAndReadsBigEndian) {
+  const char input[] = "\xff\x80\x01\x02\x03\x04\xfe";
+  DNSWireReader r(gsl::span<const char>(input, sizeof(input) - 1));
+  std::uint16_t v16;
+  std::uint32_t v32;
+  gsl::span<const char> span;
+
+  ASSERT_TRUE(r.Has(7));
+  EXPECT_FALSE(r.Has(8));
+  EXPECT_EQ(0xff80u, r.U16());
+  EXPECT_TRUE(r.ReadU32(v32));
+  EXPECT_EQ(0x01020304u, v32);
+  EXPECT_EQ(1u, r.Remaining());
+  EXPECT_FALSE(r.ReadU16(v16));
+  EXPECT_FALSE(r.ReadSpan(2, span));
+  EXPECT_EQ(6u, r.GetOffset());
+  EXPECT_EQ(0xfe, r.U8());
+  EXPECT_EQ(0u, r.Remaining());
+  EXPECT_FALSE(r.Seek(8));
+  ASSERT_TRUE(r.Seek(1));
+  EXPECT_TRUE(r.ReadSpan(2, span));
+  EXPECT_EQ(std::string("\x80\x01"), std::string(span.data(), span.size()));
+  EXPECT_EQ(0xff, r.At(0));
+}
+
+/* A Chromecast response: PTR, then SRV, TXT and A in the additionals */
+static const std::string kCastResponse =
+    std::string("\0\0\x84\0\0\0\0\x01\0\0\0\x03", 12) +
+    /* 12: _googlecast._tcp.local PTR Kitchen._googlecast._tcp.local */
+    std::string("\x0b_googlecast\x04_tcp\x05local\0"
+                "\0\x0c\0\x01\0\0\x11\x94\0\x0a\x07Kitchen\xc0\x0c", 44) +
+    /* 56: Kitchen SRV 0 0 8009 kitchen.local */
+    std::string("\xc0\x2e\0\x21\x80\x01\0\0\0\x78\0\x10"
+                "\0\0\0\0\x1f\x49\x07kitchen\xc0\x1d", 28) +
+    /* 84: Kitchen TXT "id=1234" "fn=Kitchen TV" */
+    std::string("\xc0\x2e\0\x10\x80\x01\0\0\x11\x94\0\x16"
+                "\x07id=1234\x0d""fn=Kitchen TV", 34) +
+    /* 118: kitchen.local A 192.168.1.20 */
+    std::string("\xc0\x4a\0\x01\x80\x01\0\0\0\x78\0\x04"
+                "\xc0\xa8\x01\x14", 16);
+
+TEST(DNSRRTest, CastResponseDecodesEveryRecord) {
+  std::unique_ptr<DNSMessage> dnsMsg;
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(kCastResponse.data(),
+                                                    kCastResponse.size())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  ASSERT_EQ(1u, dnsMsg->GetAnswers().size());
+  ASSERT_EQ(3u, dnsMsg->GetAdditionals().size());
+
+  EXPECT_EQ(4500u, dnsMsg->GetAnswers().at(0).GetTTL());
+  const DNSRData& ptr = dnsMsg->GetAnswers().at(0).GetRData();
+  ASSERT_EQ(DNSRR::RR_PTR, ptr.GetType());
+  ASSERT_EQ(4u, ptr.GetDName().size());
+  EXPECT_EQ(std::string("Kitchen"), ptr.GetDName().at(0));
+
+  const DNSRR& srv = dnsMsg->GetAdditionals().at(0);
+  EXPECT_EQ(DNSRR::RR_SRV, srv.GetRRType());
+  EXPECT_EQ(std::string("Kitchen"), srv.GetName().at(0));
+  EXPECT_EQ(8009, srv.GetRData().GetPort());
+  EXPECT_EQ(0, srv.GetRData().GetPriority());
+  EXPECT_EQ(0, srv.GetRData().GetWeight());
+  ASSERT_EQ(2u, srv.GetRData().GetTarget().GetLabels().size());
+  EXPECT_EQ(std::string("kitchen"), srv.GetRData().GetTarget().GetLabels().at(0));
+
+  const DNSRR& txt = dnsMsg->GetAdditionals().at(1);
+  EXPECT_EQ(DNSRR::RR_TXT, txt.GetRRType());
+  EXPECT_EQ(std::string("\x07id=1234\x0d""fn=Kitchen TV"),
+            std::string(txt.GetRData().GetTxtData().data(),
+                        txt.GetRData().GetTxtData().size()));
+
+  const DNSRR& a = dnsMsg->GetAdditionals().at(2);
+  EXPECT_EQ(DNSRR::RR_A, a.GetRRType());
+  EXPECT_EQ(std::string("kitchen"), a.GetName().at(0));
+  EXPECT_EQ(std::string("\xc0\xa8\x01\x14"),
+            std::string(a.GetRData().GetAddress().data(),
+                        a.GetRData().GetAddress().size()));
+}
+
+// Write the records of kCastResponse, each name given in full
+static bool WriteCastResponse(DNSMessageWriter& writer)
+{
+  return writer.AddPtr(DNSMessage::SECTION_AN,
+                       Span(kService, sizeof(kService)), kIN, 4500,
+                       Span(kInstance, sizeof(kInstance))) &&
+         writer.AddSrv(DNSMessage::SECTION_AR,
+                       Span(kInstance, sizeof(kInstance)), kFlush,
+                       120, 0, 0, 8009, Span(kHost, sizeof(kHost))) &&
+         writer.AddTxt(DNSMessage::SECTION_AR,
+                       Span(kInstance, sizeof(kInstance)), kFlush,
+                       4500, Span(kTxt, sizeof(kTxt) - 1)) &&
+         writer.AddAddress(DNSMessage::SECTION_AR,
+                           Span(kHost, sizeof(kHost)), kFlush, 120,
+                           Span(kAddress, sizeof(kAddress) - 1));
+}
+
+TEST(DNSMessageWriterTest, CompressesLikeACastResponse) {
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR |
+                          DNSMessageWriter::kFlagAA);
+
+  ASSERT_TRUE(WriteCastResponse(writer));
+  ASSERT_EQ(kCastResponse.size(), writer.Finish());
+  EXPECT_EQ(kCastResponse, std::string(buf, writer.GetLength()));
+}
+
+TEST(DNSMessageWriterTest, ReencodesParsedRecords) {
+  std::unique_ptr<DNSMessage> dnsMsg;
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR |
+                          DNSMessageWriter::kFlagAA);
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(kCastResponse.data(),
+                                                    kCastResponse.size())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  for (const DNSRR& rr : dnsMsg->GetAnswers()) {
+    ASSERT_TRUE(writer.AddRR(DNSMessage::SECTION_AN, rr));
+  }
+  for (const DNSRR& rr : dnsMsg->GetAdditionals()) {
+    ASSERT_TRUE(writer.AddRR(DNSMessage::SECTION_AR, rr));
+  }
+  ASSERT_EQ(kCastResponse.size(), writer.Finish());
+  EXPECT_EQ(kCastResponse, std::string(buf, writer.GetLength()));
+}
+
+TEST(DNSMessageWriterTest, RecordThatDoesNotFitIsNotWritten) {
+  std::unique_ptr<DNSMessage> dnsMsg;
+  // Room for the PTR and SRV records only, see kCastResponse
+  char buf[100];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)));
+
+  EXPECT_FALSE(WriteCastResponse(writer));
+  EXPECT_EQ(1u, writer.GetCount(DNSMessage::SECTION_AN));
+  EXPECT_EQ(1u, writer.GetCount(DNSMessage::SECTION_AR));
+  ASSERT_EQ(84u, writer.Finish());
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(buf, writer.GetLength())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  ASSERT_EQ(1u, dnsMsg->GetAdditionals().size());
+  EXPECT_EQ(8009, dnsMsg->GetAdditionals().at(0).GetRData().GetPort());
+}
+
+TEST(DNSMessageWriterTest, SectionsInOrder) {
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)));
+  const gsl::span<const char> name = Span(kHost, sizeof(kHost));
+  const gsl::span<const char> address =
+      Span(kAddress, sizeof(kAddress) - 1);
+
+  EXPECT_TRUE(writer.AddAddress(DNSMessage::SECTION_AR, name, 1, 120,
+                                address));
+  EXPECT_FALSE(writer.AddAddress(DNSMessage::SECTION_AN, name, 1, 120,
+                                 address));
+  EXPECT_FALSE(writer.AddQuestion(name, DNSRR::RR_A, 1));
+  EXPECT_FALSE(writer.AddAddress(DNSMessage::SECTION_QD, name, 1, 120,
+                                 address));
+  // Neither an address of the wrong size nor an unterminated name
+  EXPECT_FALSE(writer.AddAddress(DNSMessage::SECTION_AR, name, 1, 120,
+                                 Span(kAddress, 3)));
+  EXPECT_FALSE(writer.AddAddress(DNSMessage::SECTION_AR,
+                                 Span(kHost, sizeof(kHost) - 1), 1,
+                                 120, address));
+  EXPECT_EQ(1u, writer.GetCount(DNSMessage::SECTION_AR));
+}
+
+TEST(DNSMessageWriterTest, QuestionAndNsecRoundTrip) {
+  std::unique_ptr<DNSMessage> query;
+  std::unique_ptr<DNSMessage> dnsMsg;
+  char qbuf[512];
+  char buf[512];
+  const std::uint16_t types[] = { DNSRR::RR_TXT, DNSRR::RR_SRV };
+  // Suffixes are matched without case
+  static const char kUpperInstance[] =
+      "\x07Kitchen\x0b_GOOGLECAST\x04_tcp\x05LOCAL";
+
+  DNSMessageWriter qwriter(gsl::span<char>(qbuf, sizeof(qbuf)));
+  ASSERT_TRUE(qwriter.AddQuestion(Span(kService, sizeof(kService)),
+                                  DNSRR::RR_PTR, 1));
+  ASSERT_EQ(40u, qwriter.Finish());
+  query.reset(new DNSMessage(gsl::span<const char>(qbuf, 40)));
+  ASSERT_TRUE(query->ProcessMessage());
+  ASSERT_EQ(1u, query->GetQuestions().size());
+
+  // Answer the question with its own name
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR);
+  ASSERT_TRUE(writer.AddQuestion(query->GetQuestions().at(0).GetQName(),
+                                 DNSRR::RR_PTR, 1));
+  ASSERT_TRUE(writer.AddNsec(DNSMessage::SECTION_AN,
+                             Span(kUpperInstance, sizeof(kUpperInstance)),
+                             1, 120, types, 2));
+  // Kitchen, then a pointer to the question, then the NSEC next domain
+  // name as a single pointer
+  EXPECT_EQ(40u + 10u + 10u + 2u + 7u, writer.Finish());
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(buf,
+                                                    writer.GetLength())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  EXPECT_TRUE(dnsMsg->GetHeader().GetQRField());
+  ASSERT_EQ(1u, dnsMsg->GetQuestions().size());
+  ASSERT_EQ(1u, dnsMsg->GetAnswers().size());
+  const DNSRR& nsec = dnsMsg->GetAnswers().at(0);
+  ASSERT_EQ(4u, nsec.GetName().size());
+  EXPECT_EQ(std::string("_googlecast"), nsec.GetName().at(1));
+  EXPECT_TRUE(nsec.GetRData().HasType(DNSRR::RR_TXT));
+  EXPECT_TRUE(nsec.GetRData().HasType(DNSRR::RR_SRV));
+  EXPECT_FALSE(nsec.GetRData().HasType(DNSRR::RR_A));
+}
+
+// Names in RDATA compressed against the records before them
+static const char kCompressedRData[] =
+    "\0\0\x84\0\0\0\0\x04\0\0\0\0"
+    /* 12: kitchen.local A 192.168.1.20 */
+    "\x07kitchen\x05local\0" "\0\x01\0\x01\0\0\0\x78\0\x04\xc0\xa8\x01\x14"
+    /* 41: www.local CNAME kitchen.local */
+    "\x03www\xc0\x14" "\0\x05\0\x01\0\0\0\x78\0\x02\xc0\x0c"
+    /* 59: local MX 10 kitchen.local */
+    "\xc0\x14" "\0\x0f\0\x01\0\0\0\x78\0\x04\0\x0a\xc0\x0c"
+    /* 75: local SOA kitchen.local mail.local 1 2 3 4 5 */
+    "\xc0\x14" "\0\x06\0\x01\0\0\0\x78\0\x1d\xc0\x0c\x04mail\xc0\x14"
+    "\0\0\0\x01\0\0\0\x02\0\0\0\x03\0\0\0\x04\0\0\0\x05";
+
+TEST(DNSMessageWriterTest, ReencodesCompressedNamesInRData) {
+  std::unique_ptr<DNSMessage> source;
+  std::unique_ptr<DNSMessage> dnsMsg;
+  char buf[512];
+  static const char kOther[] = "\x04roku\x05local";
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR);
+
+  source.reset(new DNSMessage(gsl::span<const char>(
+      kCompressedRData, sizeof(kCompressedRData) - 1)));
+  ASSERT_TRUE(source->ProcessMessage());
+  ASSERT_EQ(4u, source->GetAnswers().size());
+
+  // Another name first, so offset 12 of the copy is not kitchen.local
+  ASSERT_TRUE(writer.AddAddress(DNSMessage::SECTION_AN,
+                                Span(kOther, sizeof(kOther)), 1, 120,
+                                Span(kAddress, sizeof(kAddress) - 1)));
+  for (const DNSRR& rr : source->GetAnswers()) {
+    ASSERT_TRUE(writer.AddRR(DNSMessage::SECTION_AN, rr));
+  }
+  ASSERT_NE(0u, writer.Finish());
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(buf,
+                                                    writer.GetLength())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  ASSERT_EQ(5u, dnsMsg->GetAnswers().size());
+  const std::vector<std::string> kitchen = { "kitchen", "local" };
+
+  const DNSRData& cname = dnsMsg->GetAnswers().at(2).GetRData();
+  EXPECT_EQ(DNSRR::RR_CNAME, cname.GetType());
+  EXPECT_EQ(kitchen, cname.GetFirstName().GetLabels());
+
+  const DNSRData& mx = dnsMsg->GetAnswers().at(3).GetRData();
+  EXPECT_EQ(DNSRR::RR_MX, mx.GetType());
+  EXPECT_EQ(10, mx.GetPreference());
+  EXPECT_EQ(kitchen, mx.GetFirstName().GetLabels());
+
+  const DNSRData& soa = dnsMsg->GetAnswers().at(4).GetRData();
+  EXPECT_EQ(DNSRR::RR_SOA, soa.GetType());
+  EXPECT_EQ(kitchen, soa.GetFirstName().GetLabels());
+  const std::vector<std::string> mail = { "mail", "local" };
+  EXPECT_EQ(mail, soa.GetSecondName().GetLabels());
+  ASSERT_EQ(20, soa.GetFixed().size());
+  EXPECT_EQ(5, soa.GetFixed()[19]);
+}
+
+TEST(DNSMessageWriterTest, UndecodedNameTypeIsNotCopied) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)));
+
+  /* NAPTR 10 100 "S" "" "" . may carry a compressed replacement */
+  input = "\0\0\x23\0\x01\0\0\0\x78\0\x09\0\x0a\0\x64\x01S\0\0\0";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 20, offset));
+  EXPECT_FALSE(rr.GetRData().IsOpaque());
+  EXPECT_FALSE(writer.AddRR(DNSMessage::SECTION_AN, rr));
+
+  /* HINFO holds no name */
+  input = "\0\0\x0d\0\x01\0\0\0\x78\0\x04\x01""a\x01""b";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 15, offset));
+  EXPECT_TRUE(rr.GetRData().IsOpaque());
+  EXPECT_TRUE(writer.AddRR(DNSMessage::SECTION_AN, rr));
+  EXPECT_EQ(1u, writer.GetCount(DNSMessage::SECTION_AN));
+}
+
+TEST(DNSTxtIndexTest, CastTxtKeys) {
+  std::unique_ptr<DNSMessage> dnsMsg;
+  DNSTxtIndex index;
+  gsl::span<const char> value;
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(kCastResponse.data(),
+                                                    kCastResponse.size())));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  ASSERT_TRUE(index.ProcessTxt(dnsMsg->GetAdditionals().at(1).GetRData()));
+  EXPECT_EQ(2u, index.GetCount());
+  ASSERT_TRUE(index.Find("fn", value));
+  EXPECT_EQ(std::string("Kitchen TV"), std::string(value.data(), value.size()));
+  /* The value points into the message */
+  EXPECT_GE(value.data(), kCastResponse.data());
+  EXPECT_LT(value.data(), kCastResponse.data() + kCastResponse.size());
+  ASSERT_TRUE(index.Find("ID", value));
+  EXPECT_EQ(std::string("1234"), std::string(value.data(), value.size()));
+  EXPECT_FALSE(index.Find("md", value));
+  EXPECT_FALSE(index.ProcessTxt(dnsMsg->GetAdditionals().at(0).GetRData()));
+}
+
+TEST(DNSTxtIndexTest, BooleanEmptyAndDuplicateKeys) {
+  const char* input;
+  DNSTxtIndex index;
+  gsl::span<const char> value;
+
+  /* "nf" "" "=x" "st=0" "ST=1" "ca=" */
+  input = "\x02nf\0\x02=x\x04st=0\x04ST=1\x03""ca=";
+  index.ProcessTxt(gsl::span<const char>(input, 21));
+  EXPECT_EQ(3u, index.GetCount());
+  EXPECT_TRUE(index.HasKey("nf"));
+  ASSERT_TRUE(index.Find("nf", value));
+  EXPECT_EQ(0, value.size());
+  ASSERT_TRUE(index.Find("st", value));
+  EXPECT_EQ(std::string("0"), std::string(value.data(), value.size()));
+  ASSERT_TRUE(index.Find("ca", value));
+  EXPECT_EQ(0, value.size());
+  EXPECT_FALSE(index.HasKey(""));
+}
+
+TEST(DNSTxtIndexTest, StringOverrunningSpanStops) {
+  DNSTxtIndex index;
+  gsl::span<const char> value;
+
+  /* "fn=a" then a length of 9 with only "md=x" behind it. The buffer is
+     longer than the span so a read past the span would find the '=' */
+  const char input[] = "\x04""fn=a\x09md=x=yyyy";
+  index.ProcessTxt(gsl::span<const char>(input, 10));
+  EXPECT_EQ(1u, index.GetCount());
+  EXPECT_TRUE(index.IsTruncated());
+  ASSERT_TRUE(index.Find("fn", value));
+  EXPECT_EQ(std::string("a"), std::string(value.data(), value.size()));
+  EXPECT_FALSE(index.HasKey("md"));
+
+  // A lone length octet with nothing behind it
+  index.ProcessTxt(gsl::span<const char>(input + 5, 1));
+  EXPECT_EQ(0u, index.GetCount());
+  EXPECT_TRUE(index.IsTruncated());
+}
+
+TEST(DNSTxtIndexTest, CompareWithoutDecoding) {
+  const char* a = "\x04st=0\x02nf";
+  const char* b = "\x04st=1\x02nf";
+
+  EXPECT_TRUE(DNSTxtIndex::Equal(gsl::span<const char>(a, 8),
+                                 gsl::span<const char>(a, 8)));
+  EXPECT_FALSE(DNSTxtIndex::Equal(gsl::span<const char>(a, 8),
+                                  gsl::span<const char>(b, 8)));
+  EXPECT_FALSE(DNSTxtIndex::Equal(gsl::span<const char>(a, 8),
+                                  gsl::span<const char>(a, 5)));
+  EXPECT_EQ(DNSTxtIndex::Digest(gsl::span<const char>(a, 8)),
+            DNSTxtIndex::Digest(gsl::span<const char>(a, 8)));
+  EXPECT_NE(DNSTxtIndex::Digest(gsl::span<const char>(a, 8)),
+            DNSTxtIndex::Digest(gsl::span<const char>(b, 8)));
+}
+
+TEST(DNSRRTest, AAAAMustBe16Octets) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+
+  input = "\0\0\x1c\0\x01\0\0\0\x78\0\x10"
+          "\xfe\x80\0\0\0\0\0\0\0\0\0\0\0\0\0\x01";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 27, offset));
+  EXPECT_EQ(27u, offset);
+  EXPECT_EQ(16u, rr.GetRData().GetAddress().size());
+
+  input = "\0\0\x1c\0\x01\0\0\0\x78\0\x04\x01\x02\x03\x04";
+  offset = 0;
+  EXPECT_FALSE(rr.ProcessRR(input, 15, offset));
+}
+
+TEST(DNSRRTest, TxtStringsMustFillRData) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+
+  /* The second string claims 5 octets, only 3 remain */
+  input = "\0\0\x10\0\x01\0\0\0\x78\0\x06\x01""a\x05""bcd";
+  offset = 0;
+  EXPECT_FALSE(rr.ProcessRR(input, 17, offset));
+}
+
+TEST(DNSRRTest, NsecTypeBitMaps) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+
+  /* NSEC for "a" asserting A, TXT, AAAA and SRV exist */
+  input = "\x01""a\0\0\x2f\0\x01\0\0\0\x78\0\x09\xc0\0"
+          "\0\x05\x40\0\x80\x08\x40";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 22, offset));
+  EXPECT_EQ(DNSRR::RR_NSEC, rr.GetRRType());
+  EXPECT_TRUE(rr.GetRData().HasType(DNSRR::RR_A));
+  EXPECT_TRUE(rr.GetRData().HasType(DNSRR::RR_TXT));
+  EXPECT_TRUE(rr.GetRData().HasType(DNSRR::RR_AAAA));
+  EXPECT_TRUE(rr.GetRData().HasType(DNSRR::RR_SRV));
+  EXPECT_FALSE(rr.GetRData().HasType(DNSRR::RR_PTR));
+  EXPECT_FALSE(rr.GetRData().HasType(DNSRR::RR_NSEC));
+  EXPECT_FALSE(rr.GetRData().HasType(0x0101));
+}
+
+TEST(DNSRRTest, UnknownTypeIsKept) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+
+  /* HINFO */
+  input = "\0\0\x0d\0\x01\0\0\0\x78\0\x04\x01""a\x01""b";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 15, offset));
+  EXPECT_EQ(4u, rr.GetRData().GetRaw().size());
+}
+
+TEST(DNSRRTest, EmptyRData) {
+  const char* input;
+  DNSRR rr;
+  std::size_t offset;
+
+  /* An EDNS OPT record without options, and any other unknown type */
+  input = "\0\0\x29\x05\xa0\0\0\0\0\0\0";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 11, offset));
+  EXPECT_EQ(11u, offset);
+  EXPECT_EQ(0u, rr.GetRData().GetRaw().size());
+
+  /* An empty TXT is one empty string */
+  input = "\0\0\x10\0\x01\0\0\0\x78\0\0";
+  offset = 0;
+  ASSERT_TRUE(rr.ProcessRR(input, 11, offset));
+  EXPECT_EQ(std::string(1, '\0'),
+            std::string(rr.GetRData().GetTxtData().data(),
+                        rr.GetRData().GetTxtData().size()));
+
+  /* The types we decode still need their fields */
+  for (const char type : {'\x01', '\x1c', '\x0c', '\x21', '\x2f'}) {
+    char empty[] = "\0\0\0\0\x01\0\0\0\x78\0\0";
+    empty[2] = type;
+    offset = 0;
+    EXPECT_FALSE(rr.ProcessRR(empty, 11, offset)) << int(type);
+  }
+}
+
+TEST(DNSMessageTest, QueryWithEdnsOptParses) {
+  /* A query for _googlecast._tcp.local PTR, with an OPT additional as
+     queriers send it */
+  const char input[] =
+      "\0\0\0\0\0\x01\0\0\0\0\0\x01"
+      "\x0b_googlecast\x04_tcp\x05local\0\0\x0c\0\x01"
+      "\0\0\x29\x05\xa0\0\0\x11\x94\0\0";
+  DNSMessage msg{gsl::span<const char>(input, sizeof(input) - 1)};
+  ASSERT_TRUE(msg.ProcessMessage());
+  EXPECT_EQ(1u, msg.GetQuestions().size());
+  ASSERT_EQ(1u, msg.GetAdditionals().size());
+  EXPECT_EQ(41, msg.GetAdditionals()[0].GetRRType());
 }
 
 TEST(NameCompression, BadLength) {
@@ -698,6 +1289,101 @@ TEST(NameCompression, LessSmallOffset) {
   EXPECT_EQ(expect, uncompname);
 }
 
+TEST(NameCompression, PointerChain) {
+  const char* input;
+  std::string compressedname;
+  std::string uncompname;
+  std::size_t mlen;
+
+  /* local <- _tcp.local <- _googlecast._tcp.local <- pointer */
+  input = "\x05""local\0\x04""_tcp\xc0\0\x0b""_googlecast\xc0\x07\xc0\x0e";
+  compressedname.assign(input + 28, 2);
+  mlen = 30;
+  ASSERT_TRUE(DNSMessage::DecompressName(input, mlen, compressedname, uncompname));
+  EXPECT_EQ(std::string("_googlecast._tcp.local"), uncompname);
+}
+
+TEST(NameCompression, PointerLoop) {
+  const char* input;
+  DNSName name;
+  std::size_t offset;
+
+  /* The second pointer points back at the first */
+  input = "\x01""a\xc0\x04\x01""b\xc0\0";
+  offset = 4;
+  EXPECT_FALSE(name.ProcessName(gsl::span<const char>(input, 8), offset));
+  /* And a pointer to itself */
+  input = "\0\xc0\x01";
+  offset = 1;
+  EXPECT_FALSE(name.ProcessName(gsl::span<const char>(input, 3), offset));
+}
+
+TEST(NameCompression, PointerTooDeep) {
+  std::string input("\0", 1);
+  DNSName name;
+  std::size_t offset;
+
+  /* Each pointer refers to the one before it */
+  for (int i = 0; i < 20; i++) {
+    std::size_t target = input.size() == 1 ? 0 : input.size() - 2;
+    input += char(0xc0);
+    input += char(target);
+  }
+  offset = input.size() - 2;
+  EXPECT_FALSE(name.ProcessName(gsl::span<const char>(input.data(),
+                                                      input.size()),
+                                offset));
+  offset = 5;
+  EXPECT_TRUE(name.ProcessName(gsl::span<const char>(input.data(),
+                                                     input.size()),
+                               offset));
+}
+
+TEST(NameCompression, NameTooLong) {
+  std::string input;
+  DNSName name;
+  std::size_t offset;
+
+  /* 4 * 64 octets plus the root is longer than 255 */
+  for (int i = 0; i < 4; i++) {
+    input += char(63);
+    input += std::string(63, 'a');
+  }
+  input += '\0';
+  offset = 0;
+  EXPECT_FALSE(name.ProcessName(gsl::span<const char>(input.data(),
+                                                      input.size()),
+                                offset));
+}
+
+TEST(NameCompression, MemoSharesSuffix) {
+  const char* input;
+  DNSNameMemo memo;
+  DNSName first, second;
+  std::size_t offset;
+  std::uint8_t length, labels;
+
+  input = "\x05""local\0\x04""_tcp\xc0\0\x01""a\xc0\x07\x01""b\xc0\x07";
+  offset = 14;
+  ASSERT_TRUE(first.ProcessName(gsl::span<const char>(input, 22), offset,
+                                &memo));
+  EXPECT_EQ(18u, offset);
+  ASSERT_TRUE(memo.Find(7, length, labels));
+  EXPECT_EQ(12u, length);
+  EXPECT_EQ(2u, labels);
+  ASSERT_TRUE(memo.Find(0, length, labels));
+  EXPECT_EQ(7u, length);
+  EXPECT_EQ(1u, labels);
+  ASSERT_TRUE(second.ProcessName(gsl::span<const char>(input, 22), offset,
+                                 &memo));
+  EXPECT_EQ(14u, second.GetLength());
+  EXPECT_EQ(3u, second.GetLabelCount());
+  ASSERT_EQ(3u, second.GetLabels().size());
+  EXPECT_EQ(std::string("b"), second.GetLabels().at(0));
+  EXPECT_EQ(std::string("_tcp"), second.GetLabels().at(1));
+  EXPECT_EQ(std::string("local"), second.GetLabels().at(2));
+}
+
 TEST(HeaderStringifyTest, Format) {
   char* input;
   bool result;
@@ -0,0 +1,235 @@
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "mdns_response.h"
+#include "mdns_test_util.h"
+
+namespace dns_message {
+
+namespace testing {
+
+// The PTR answer and its SRV, TXT and A additionals. Returns the set.
+static std::uint64_t AddCastRecords(DNSResponseCache& cache,
+                                    std::size_t& txt)
+{
+  std::size_t ptr, srv, a;
+  EXPECT_TRUE(cache.AddRecord(DNSMessage::SECTION_AR,
+                              Span(kInstance, sizeof(kInstance)),
+                              DNSRR::RR_SRV, kFlush, 120,
+                              Span(kSrv, sizeof(kSrv)), srv));
+  EXPECT_TRUE(cache.AddRecord(DNSMessage::SECTION_AR,
+                              Span(kInstance, sizeof(kInstance)),
+                              DNSRR::RR_TXT, kFlush, 4500,
+                              Span(kTxt, sizeof(kTxt) - 1), txt));
+  EXPECT_TRUE(cache.AddRecord(DNSMessage::SECTION_AR,
+                              Span(kHost, sizeof(kHost)), DNSRR::RR_A,
+                              kFlush, 120,
+                              Span(kAddress, sizeof(kAddress) - 1), a));
+  // Added last, but written first because it is an answer
+  EXPECT_TRUE(cache.AddRecord(DNSMessage::SECTION_AN,
+                              Span(kService, sizeof(kService)),
+                              DNSRR::RR_PTR, kIN, 4500,
+                              Span(kInstance, sizeof(kInstance)), ptr));
+  return (1u << ptr) | (1u << srv) | (1u << txt) | (1u << a);
+}
+
+TEST(DNSResponseCacheTest, TemplateMatchesWriter) {
+  DNSResponseCache cache;
+  std::size_t txt;
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR |
+                          DNSMessageWriter::kFlagAA);
+
+  const std::uint64_t set = AddCastRecords(cache, txt);
+  DNSResponseTemplate* t = cache.GetTemplate(set);
+  ASSERT_NE(nullptr, t);
+  EXPECT_EQ(4u, t->GetRecordCount());
+  ASSERT_TRUE(writer.AddPtr(DNSMessage::SECTION_AN,
+                            Span(kService, sizeof(kService)), kIN, 4500,
+                            Span(kInstance, sizeof(kInstance))));
+  ASSERT_TRUE(writer.AddSrv(DNSMessage::SECTION_AR,
+                            Span(kInstance, sizeof(kInstance)), kFlush, 120,
+                            0, 0, 8009, Span(kHost, sizeof(kHost))));
+  ASSERT_TRUE(writer.AddTxt(DNSMessage::SECTION_AR,
+                            Span(kInstance, sizeof(kInstance)), kFlush, 4500,
+                            Span(kTxt, sizeof(kTxt) - 1)));
+  ASSERT_TRUE(writer.AddAddress(DNSMessage::SECTION_AR,
+                                Span(kHost, sizeof(kHost)), kFlush, 120,
+                                Span(kAddress, sizeof(kAddress) - 1)));
+  ASSERT_NE(0u, writer.Finish());
+  EXPECT_EQ(std::string(buf, writer.GetLength()),
+            std::string(t->GetMessage().data(), t->GetMessage().size()));
+
+  // The same set is not compiled again
+  EXPECT_EQ(t, cache.GetTemplate(set));
+  EXPECT_EQ(nullptr, cache.GetTemplate(0));
+  EXPECT_EQ(nullptr, cache.GetTemplate(std::uint64_t(1) << 4));
+}
+
+TEST(DNSResponseCacheTest, LegacyUnicastPatches) {
+  DNSResponseCache cache;
+  std::unique_ptr<DNSMessage> dnsMsg;
+  std::size_t txt;
+  char buf[512];
+
+  DNSResponseTemplate* t = cache.GetTemplate(AddCastRecords(cache, txt));
+  ASSERT_NE(nullptr, t);
+  const std::string original(t->GetMessage().data(), t->GetMessage().size());
+  t->SetMsgID(0x1234);
+  t->SetMaxTTL(10);
+  t->SetCacheFlush(false);
+  const std::size_t len = t->CopyTo(buf, sizeof(buf));
+  ASSERT_EQ(original.size(), len);
+  EXPECT_EQ(0u, t->CopyTo(buf, len - 1));
+
+  dnsMsg.reset(new DNSMessage(gsl::span<const char>(buf, len)));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  EXPECT_EQ(0x1234, dnsMsg->GetHeader().GetMsgID());
+  ASSERT_EQ(1u, dnsMsg->GetAnswers().size());
+  ASSERT_EQ(3u, dnsMsg->GetAdditionals().size());
+  EXPECT_EQ(10u, dnsMsg->GetAnswers().at(0).GetTTL());
+  for (const DNSRR& rr : dnsMsg->GetAdditionals()) {
+    EXPECT_EQ(kIN, rr.GetRRClass());
+    EXPECT_EQ(10u, rr.GetTTL());
+  }
+  EXPECT_EQ(8009, dnsMsg->GetAdditionals().at(0).GetRData().GetPort());
+
+  // Goodbye, then back to a multicast response
+  t->SetMaxTTL(0);
+  dnsMsg.reset(new DNSMessage(t->GetMessage()));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  EXPECT_EQ(0u, dnsMsg->GetAdditionals().at(1).GetTTL());
+  t->SetMsgID(0);
+  t->SetMaxTTL(DNSResponseTemplate::kKeepTTL);
+  t->SetCacheFlush(true);
+  EXPECT_EQ(original,
+            std::string(t->GetMessage().data(), t->GetMessage().size()));
+}
+
+TEST(DNSResponseCacheTest, ChangedRecordRecompiles) {
+  DNSResponseCache cache;
+  std::unique_ptr<DNSMessage> dnsMsg;
+  std::size_t txt;
+  static const char kNewTxt[] = "\x07id=1234\x0c""fn=Den TV ok";
+
+  const std::uint64_t set = AddCastRecords(cache, txt);
+  DNSResponseTemplate* t = cache.GetTemplate(set);
+  ASSERT_NE(nullptr, t);
+  t->SetMsgID(7);
+  const std::uint64_t generation = cache.GetGeneration();
+
+  // Setting the same RDATA or TTL again changes nothing
+  EXPECT_TRUE(cache.UpdateRData(txt, Span(kTxt, sizeof(kTxt) - 1)));
+  EXPECT_TRUE(cache.UpdateTTL(txt, 4500));
+  EXPECT_EQ(generation, cache.GetGeneration());
+  t = cache.GetTemplate(set);
+  dnsMsg.reset(new DNSMessage(t->GetMessage()));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  EXPECT_EQ(7, dnsMsg->GetHeader().GetMsgID());
+
+  EXPECT_TRUE(cache.UpdateRData(txt, Span(kNewTxt, sizeof(kNewTxt) - 1)));
+  EXPECT_NE(generation, cache.GetGeneration());
+  t = cache.GetTemplate(set);
+  ASSERT_NE(nullptr, t);
+  dnsMsg.reset(new DNSMessage(t->GetMessage()));
+  ASSERT_TRUE(dnsMsg->ProcessMessage());
+  // Compiled again, so the message ID patch is gone
+  EXPECT_EQ(0, dnsMsg->GetHeader().GetMsgID());
+  const gsl::span<const char> rdata =
+      dnsMsg->GetAdditionals().at(1).GetRData().GetTxtData();
+  EXPECT_EQ(std::string(kNewTxt, sizeof(kNewTxt) - 1),
+            std::string(rdata.data(), rdata.size()));
+
+  EXPECT_FALSE(cache.UpdateRData(cache.GetRecordCount(),
+                                 Span(kTxt, sizeof(kTxt) - 1)));
+}
+
+TEST(DNSResponseCacheTest, TemplateTableIsBounded) {
+  DNSResponseCache cache;
+  const std::size_t max = DNSResponseCache::kMaxTemplates;
+  std::size_t id;
+
+  for (std::size_t i = 0; i < 8; i++) {
+    const char address[] = {10, 0, 0, static_cast<char>(i)};
+    ASSERT_TRUE(cache.AddRecord(DNSMessage::SECTION_AN,
+                                Span(kHost, sizeof(kHost)), DNSRR::RR_A,
+                                kIN, 120, Span(address, sizeof(address)),
+                                id));
+  }
+  // One set kept in use while many others come and go
+  DNSResponseTemplate* hot = cache.GetTemplate(1);
+  ASSERT_NE(nullptr, hot);
+  for (std::uint64_t set = 2; set < 2 + 2 * max; set++) {
+    ASSERT_NE(nullptr, cache.GetTemplate(set));
+    EXPECT_EQ(hot, cache.GetTemplate(1));
+  }
+  EXPECT_EQ(max, cache.GetTemplateCount());
+  // A set that was dropped is compiled again
+  DNSResponseTemplate* t = cache.GetTemplate(2);
+  ASSERT_NE(nullptr, t);
+  EXPECT_EQ(1u, t->GetRecordCount());
+  EXPECT_EQ(max, cache.GetTemplateCount());
+}
+
+TEST(DNSResponseCacheTest, RejectsBadRecords) {
+  DNSResponseCache cache;
+  std::size_t id;
+
+  EXPECT_FALSE(cache.AddRecord(DNSMessage::SECTION_QD,
+                               Span(kHost, sizeof(kHost)), DNSRR::RR_A, kIN,
+                               120, Span(kAddress, 4), id));
+  EXPECT_FALSE(cache.AddRecord(DNSMessage::SECTION_AN,
+                               Span(kInstance, sizeof(kInstance)),
+                               DNSRR::RR_SRV, kIN, 120, Span(kSrv, 6), id));
+  // An unterminated PTR name is only found when compiling
+  ASSERT_TRUE(cache.AddRecord(DNSMessage::SECTION_AN,
+                              Span(kService, sizeof(kService)),
+                              DNSRR::RR_PTR, kIN, 4500,
+                              Span(kInstance, sizeof(kInstance) - 1), id));
+  EXPECT_EQ(nullptr, cache.GetTemplate(std::uint64_t(1) << id));
+  EXPECT_EQ(1u, cache.GetRecordCount());
+}
+
+TEST(DNSResponseCacheTest, KnownAnswersAreLeftOut) {
+  DNSResponseCache cache;
+  std::size_t txt;
+  char buf[512];
+  DNSMessageWriter query(gsl::span<char>(buf, sizeof(buf)));
+  static const char kHostUpper[] = "\x07KITCHEN\x05local";
+  static const char kOtherTxt[] = "\x07id=5678";
+
+  const std::uint64_t set = AddCastRecords(cache, txt);
+  ASSERT_TRUE(query.AddQuestion(Span(kService, sizeof(kService)),
+                                DNSRR::RR_PTR, kIN));
+  // Known with the full TTL
+  ASSERT_TRUE(query.AddPtr(DNSMessage::SECTION_AN,
+                           Span(kService, sizeof(kService)), kIN, 4500,
+                           Span(kInstance, sizeof(kInstance))));
+  // Less than half of 120 left
+  ASSERT_TRUE(query.AddSrv(DNSMessage::SECTION_AN,
+                           Span(kInstance, sizeof(kInstance)), kFlush, 59,
+                           0, 0, 8009, Span(kHost, sizeof(kHost))));
+  // Exactly half, in another case
+  ASSERT_TRUE(query.AddAddress(DNSMessage::SECTION_AN,
+                               Span(kHostUpper, sizeof(kHostUpper)), kIN,
+                               60, Span(kAddress, sizeof(kAddress) - 1)));
+  // Not the TXT we have
+  ASSERT_TRUE(query.AddTxt(DNSMessage::SECTION_AN,
+                           Span(kInstance, sizeof(kInstance)), kIN, 4500,
+                           Span(kOtherTxt, sizeof(kOtherTxt) - 1)));
+  DNSMessage msg{gsl::span<const char>(buf, query.Finish())};
+  ASSERT_TRUE(msg.ProcessMessage());
+
+  // The PTR and the A, in the order AddCastRecords adds them
+  const std::uint64_t known = cache.GetKnownAnswers(msg);
+  EXPECT_EQ((std::uint64_t(1) << 3) | (std::uint64_t(1) << 2), known);
+  DNSResponseTemplate* t = cache.GetTemplate(set & ~known);
+  ASSERT_NE(nullptr, t);
+  EXPECT_EQ(2u, t->GetRecordCount());
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -0,0 +1,143 @@
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "mdns_scheduler.h"
+#include "mdns_test_util.h"
+
+namespace dns_message {
+
+namespace testing {
+
+// The packets a scheduler sent, and where
+struct Sent {
+  std::vector<unsigned> mIfIndex;
+  std::vector<std::string> mPackets;
+
+  DNSResponseScheduler::Sender GetSender() {
+    return [this](unsigned ifindex, gsl::span<const char> msg) {
+      mIfIndex.push_back(ifindex);
+      mPackets.emplace_back(msg.data(), msg.size());
+    };
+  }
+  // The answers and additionals of packet i
+  std::size_t GetRecordCount(std::size_t i) const {
+    DNSMessage msg{gsl::span<const char>(mPackets[i].data(),
+                                         mPackets[i].size())};
+    EXPECT_TRUE(msg.ProcessMessage());
+    return msg.GetAnswers().size() + msg.GetAdditionals().size();
+  }
+};
+
+class DNSResponseSchedulerTest : public ::testing::Test {
+protected:
+  DNSResponseCache mCache;
+  /* A shared PTR, and the unique SRV and A */
+  std::uint64_t mPtr, mSrv, mA;
+
+  void SetUp() override {
+    std::size_t id;
+    ASSERT_TRUE(mCache.AddRecord(DNSMessage::SECTION_AN,
+                                 Span(kService, sizeof(kService)),
+                                 DNSRR::RR_PTR, kIN, 4500,
+                                 Span(kInstance, sizeof(kInstance)), id));
+    mPtr = std::uint64_t(1) << id;
+    ASSERT_TRUE(mCache.AddRecord(DNSMessage::SECTION_AR,
+                                 Span(kInstance, sizeof(kInstance)),
+                                 DNSRR::RR_SRV, kFlush, 120,
+                                 Span(kSrv, sizeof(kSrv)), id));
+    mSrv = std::uint64_t(1) << id;
+    ASSERT_TRUE(mCache.AddRecord(DNSMessage::SECTION_AR,
+                                 Span(kHost, sizeof(kHost)), DNSRR::RR_A,
+                                 kFlush, 120,
+                                 Span(kAddress, sizeof(kAddress) - 1), id));
+    mA = std::uint64_t(1) << id;
+  }
+};
+
+TEST_F(DNSResponseSchedulerTest, SharedAnswersWaitAndAggregate) {
+  Sent sent;
+  DNSResponseScheduler scheduler(mCache, sent.GetSender(), nullptr,
+                                 DNSResponseScheduler::kDefaultMTU, 1);
+
+  scheduler.Schedule(2, mPtr, 1000);
+  const std::uint64_t due = scheduler.GetNextDeadline();
+  EXPECT_LE(1000 + DNSResponseScheduler::kMinSharedDelayMs, due);
+  EXPECT_GE(1000 + DNSResponseScheduler::kMaxSharedDelayMs, due);
+  // Another query for the PTR is answered by the same packet, and
+  // cannot make it later
+  scheduler.Schedule(2, mPtr, 1010);
+  EXPECT_EQ(1u, scheduler.GetRecordsMerged());
+  EXPECT_EQ(mPtr, scheduler.GetPending(2));
+  EXPECT_GE(due, scheduler.GetNextDeadline());
+  const std::uint64_t first = scheduler.GetNextDeadline();
+  scheduler.Schedule(3, mPtr, 1010);
+
+  EXPECT_EQ(0u, scheduler.Flush(first - 1));
+  EXPECT_LE(1u, scheduler.Flush(first));
+  scheduler.Flush(1010 + DNSResponseScheduler::kMaxSharedDelayMs);
+  ASSERT_EQ(2u, sent.mPackets.size());
+  EXPECT_EQ(1u, sent.GetRecordCount(0));
+  EXPECT_EQ(2u, scheduler.GetPacketsSent());
+  EXPECT_EQ(2u, scheduler.GetRecordsSent());
+  EXPECT_EQ(0u, scheduler.GetNextDeadline());
+}
+
+TEST_F(DNSResponseSchedulerTest, UniqueAnswersAreDueAtOnce) {
+  Sent sent;
+  DNSResponseScheduler scheduler(mCache, sent.GetSender(), nullptr,
+                                 DNSResponseScheduler::kDefaultMTU, 1);
+
+  scheduler.Schedule(2, mSrv | mA, 1000);
+  EXPECT_EQ(1000u, scheduler.GetNextDeadline());
+  // A shared answer rides along, rather than delaying the unique one
+  scheduler.Schedule(2, mPtr, 1000);
+  EXPECT_EQ(1000u, scheduler.GetNextDeadline());
+  EXPECT_EQ(1u, scheduler.Flush(1000));
+  ASSERT_EQ(1u, sent.mPackets.size());
+  EXPECT_EQ(2u, sent.mIfIndex[0]);
+  EXPECT_EQ(3u, sent.GetRecordCount(0));
+}
+
+TEST_F(DNSResponseSchedulerTest, FullPacketGoesEarly) {
+  Sent sent;
+  // Room for the PTR, not for the SRV as well
+  DNSResponseScheduler scheduler(mCache, sent.GetSender(), nullptr, 100, 1);
+
+  scheduler.Schedule(2, mPtr, 1000);
+  scheduler.Schedule(2, mSrv, 1001);
+  ASSERT_EQ(1u, sent.mPackets.size());
+  EXPECT_EQ(1u, sent.GetRecordCount(0));
+  EXPECT_EQ(mSrv, scheduler.GetPending(2));
+  EXPECT_EQ(1u, scheduler.Flush(1001));
+}
+
+TEST_F(DNSResponseSchedulerTest, LeavesOutWhatAnotherResponderSent) {
+  Sent sent;
+  DNSDuplicateSuppressor dups;
+  DNSResponseScheduler scheduler(mCache, sent.GetSender(), &dups,
+                                 DNSResponseScheduler::kDefaultMTU, 1);
+  char buf[512];
+  DNSMessageWriter writer(gsl::span<char>(buf, sizeof(buf)), 0,
+                          DNSMessageWriter::kFlagQR);
+  ASSERT_TRUE(writer.AddAddress(DNSMessage::SECTION_AN,
+                                Span(kHost, sizeof(kHost)), kFlush, 120,
+                                Span(kAddress, sizeof(kAddress) - 1)));
+  DNSMessage response{gsl::span<const char>(buf, writer.Finish())};
+  ASSERT_TRUE(response.ProcessMessage());
+
+  scheduler.Schedule(2, mSrv | mA, 1000);
+  dups.ObserveResponse(response, 1000);
+  EXPECT_EQ(1u, scheduler.Flush(1000));
+  EXPECT_EQ(1u, sent.GetRecordCount(0));
+  EXPECT_EQ(1u, dups.GetSuppressedAnswers());
+
+  // Nothing left to say, nothing is sent
+  scheduler.Schedule(2, mA, 1100);
+  EXPECT_EQ(0u, scheduler.Flush(1100));
+  EXPECT_EQ(0u, scheduler.GetNextDeadline());
+}
+
+} // namespace testing
+} // namespace dns_message
@@ -0,0 +1,485 @@
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "mnet_uring.h"
+
+namespace mnet {
+
+namespace testing {
+
+// Multicast to ourselves over the loopback interface, so the test does
+// not depend on the network the host is on
+static bool LoopbackOnly(MNet& net)
+{
+  std::string errmsg;
+  const int fd = net.GetFd();
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  const std::uint8_t loop = 1;
+  return net.AddMulticastMembership(if_nametoindex("lo"), errmsg) &&
+         setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo)) == 0 &&
+         setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+                    sizeof(loop)) == 0;
+}
+
+static struct sockaddr_in MdnsGroup()
+{
+  struct sockaddr_in dst;
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(5353);
+  dst.sin_addr.s_addr = htonl(0xe00000fb);
+  return dst;
+}
+
+// Reap until count datagrams arrived or a second passed without one
+static std::string ReapAll(MNetUring& ring, MNetBatch& batch,
+                           std::size_t count, Buffer* keep = nullptr)
+{
+  std::string received;
+  std::size_t n = 0;
+  while (n < count) {
+    struct pollfd pfd{ring.GetFd(), POLLIN, 0};
+    if (poll(&pfd, 1, 1000) != 1) {
+      break;
+    }
+    EXPECT_EQ(NET_OK, ring.Reap(batch));
+    for (const MNetBatch::Packet& p : batch) {
+      EXPECT_FALSE(p.mTruncated);
+      EXPECT_EQ(AF_INET, p.mSrcAddr.ss_family);
+      const struct sockaddr_in* src =
+          reinterpret_cast<const struct sockaddr_in*>(&p.mSrcAddr);
+      EXPECT_EQ(htonl(INADDR_LOOPBACK), src->sin_addr.s_addr);
+      EXPECT_EQ(if_nametoindex("lo"), p.mIfIndex);
+      received.append(p.mData, p.mLength);
+      if (keep != nullptr && keep->IsEmpty()) {
+        *keep = p.mBuffer;
+      }
+      n++;
+    }
+  }
+  return received;
+}
+
+TEST(MNetTest, ReadBatchKeepsRawSourceAndInterface) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+
+  if (!net.CreateSocket(errmsg) || !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No loopback multicast";
+  }
+  const struct sockaddr_in dst = MdnsGroup();
+  ASSERT_EQ(3, sendto(net.GetFd(), "abc", 3, 0,
+                      reinterpret_cast<const sockaddr*>(&dst),
+                      sizeof(dst)));
+  struct pollfd pfd{net.GetFd(), POLLIN, 0};
+  ASSERT_EQ(1, poll(&pfd, 1, 1000));
+  short revents;
+  ASSERT_EQ(NET_OK, net.Poll(revents));
+  EXPECT_TRUE(revents & POLLIN);
+
+  ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+  ASSERT_EQ(1u, batch.GetCount());
+  const MNetPacket& p = batch.GetPacket(0);
+  EXPECT_EQ("abc", std::string(p.mData, p.mLength));
+  EXPECT_FALSE(p.mTruncated);
+  EXPECT_EQ(if_nametoindex("lo"), p.mIfIndex);
+  EXPECT_EQ("127.0.0.1:5353", FormatAddress(p.mSrcAddr, p.mSrcAddrLen));
+
+  // Nothing left, which is not an error
+  ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+  EXPECT_EQ(0u, batch.GetCount());
+  MNetPacket single;
+  ASSERT_EQ(NET_OK, net.Read(pool, single));
+  EXPECT_TRUE(single.mBuffer.IsEmpty());
+
+  MNet closed;
+  EXPECT_EQ(NET_ERR_CLOSED, closed.ReadBatch(batch));
+  EXPECT_STREQ("not open", NetErrorName(NET_ERR_CLOSED));
+}
+
+TEST(MNetTest, ReadBatchDrainsSeveralDatagrams) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+  const std::size_t count = 5;
+
+  if (!net.CreateSocket(errmsg) || !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No loopback multicast";
+  }
+  // A sender on its own port, to tell its datagrams apart
+  const int sender = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE(0, sender);
+  struct sockaddr_in src;
+  memset(&src, 0, sizeof(src));
+  src.sin_family = AF_INET;
+  src.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t srclen = sizeof(src);
+  ASSERT_EQ(0, bind(sender, reinterpret_cast<const sockaddr*>(&src),
+                    sizeof(src)));
+  ASSERT_EQ(0, getsockname(sender, reinterpret_cast<sockaddr*>(&src),
+                           &srclen));
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  ASSERT_EQ(0, setsockopt(sender, IPPROTO_IP, IP_MULTICAST_IF, &lo,
+                          sizeof(lo)));
+  const struct sockaddr_in dst = MdnsGroup();
+  for (std::size_t i = 0; i < count; i++) {
+    // Each one longer than the last, and filled with its index
+    const std::string data(10 + i, static_cast<char>('a' + i));
+    ASSERT_EQ(ssize_t(data.size()),
+              sendto(sender, data.data(), data.size(), 0,
+                     reinterpret_cast<const sockaddr*>(&dst), sizeof(dst)));
+  }
+  struct pollfd pfd{net.GetFd(), POLLIN, 0};
+  ASSERT_EQ(1, poll(&pfd, 1, 1000));
+
+  ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+  ASSERT_EQ(count, batch.GetCount());
+  const std::string from =
+      "127.0.0.1:" + std::to_string(ntohs(src.sin_port));
+  for (std::size_t i = 0; i < count; i++) {
+    const MNetPacket& p = batch.GetPacket(i);
+    EXPECT_EQ(10 + i, p.mLength);
+    EXPECT_EQ(std::string(10 + i, static_cast<char>('a' + i)),
+              std::string(p.mData, p.mLength));
+    EXPECT_FALSE(p.mTruncated);
+    EXPECT_EQ(from, FormatAddress(p.mSrcAddr, p.mSrcAddrLen));
+  }
+  close(sender);
+}
+
+TEST(MNetTest, SendsWithTTL255) {
+  std::string errmsg;
+  MNet net;
+  int ttl = 0;
+  socklen_t len = sizeof(ttl);
+
+  if (!net.CreateSocket(errmsg)) {
+    GTEST_SKIP() << errmsg;
+  }
+  ASSERT_EQ(0, getsockopt(net.GetFd(), IPPROTO_IP, IP_MULTICAST_TTL, &ttl,
+                          &len));
+  EXPECT_EQ(255, ttl);
+  len = sizeof(ttl);
+  ASSERT_EQ(0, getsockopt(net.GetFd(), IPPROTO_IP, IP_TTL, &ttl, &len));
+  EXPECT_EQ(255, ttl);
+}
+
+TEST(MNetTest, EligibleInterfaces) {
+  EXPECT_TRUE(MNet::IsEligibleInterface(IFF_UP | IFF_MULTICAST));
+  EXPECT_TRUE(MNet::IsEligibleInterface(IFF_UP | IFF_MULTICAST |
+                                        IFF_BROADCAST | IFF_RUNNING));
+  EXPECT_FALSE(MNet::IsEligibleInterface(IFF_MULTICAST));
+  EXPECT_FALSE(MNet::IsEligibleInterface(IFF_UP));
+  EXPECT_FALSE(MNet::IsEligibleInterface(IFF_UP | IFF_MULTICAST |
+                                         IFF_LOOPBACK));
+}
+
+static MNetSendQueue::Datagram MakeDatagram(BufferPool& pool,
+                                            unsigned ifindex, char c)
+{
+  const struct sockaddr_in dst = MdnsGroup();
+  MNetSendQueue::Datagram d;
+  d.mBuffer = pool.Acquire(BufferPool::CLASS_SMALL);
+  d.mBuffer.GetData()[0] = c;
+  d.mBuffer.SetLength(1);
+  memcpy(&d.mDst, &dst, sizeof(dst));
+  d.mDstLen = sizeof(dst);
+  d.mIfIndex = ifindex;
+  return d;
+}
+
+TEST(MNetSendQueueTest, RoundRobinAcrossInterfaces) {
+  BufferPool pool;
+  MNetSendQueue queue(4);
+  MNetSendQueue::Datagram out[16];
+
+  // A noisy interface 1 fills its queue before 2 and 3 queue anything
+  for (char c = 'a'; c < 'a' + 6; c++) {
+    queue.Push(MakeDatagram(pool, 1, c));
+  }
+  EXPECT_EQ(4u, queue.GetPending(1));
+  EXPECT_EQ(2u, queue.GetDropped(1));
+  EXPECT_TRUE(queue.Push(MakeDatagram(pool, 2, 'x')));
+  EXPECT_TRUE(queue.Push(MakeDatagram(pool, 3, 'y')));
+  EXPECT_TRUE(queue.Push(MakeDatagram(pool, 3, 'z')));
+  EXPECT_EQ(0u, queue.GetDropped(3));
+  EXPECT_EQ(7u, queue.GetPending());
+
+  std::string order;
+  std::size_t n = queue.Pop(out, 4);
+  ASSERT_EQ(4u, n);
+  for (std::size_t i = 0; i < n; i++) {
+    order += out[i].mBuffer.GetData()[0];
+  }
+  n = queue.Pop(out, 16);
+  ASSERT_EQ(3u, n);
+  for (std::size_t i = 0; i < n; i++) {
+    order += out[i].mBuffer.GetData()[0];
+  }
+  EXPECT_EQ("axybzcd", order);
+  EXPECT_EQ(0u, queue.GetPending());
+  EXPECT_EQ(0u, queue.Pop(out, 16));
+}
+
+TEST(MNetTest, FlushSendsOnTheQueuedInterface) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+  MNetSendQueue queue;
+
+  if (!net.CreateSocket(errmsg) || !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No loopback multicast";
+  }
+  // Without a default interface only IP_PKTINFO routes it to loopback
+  const struct in_addr any{htonl(INADDR_ANY)};
+  ASSERT_EQ(0, setsockopt(net.GetFd(), IPPROTO_IP, IP_MULTICAST_IF, &any,
+                          sizeof(any)));
+  const unsigned lo = if_nametoindex("lo");
+  queue.Push(MakeDatagram(pool, lo, 'q'));
+  std::size_t sent;
+  ASSERT_EQ(NET_OK, net.Flush(queue, sent));
+  EXPECT_EQ(1u, sent);
+  EXPECT_EQ(0u, queue.GetPending());
+
+  struct pollfd pfd{net.GetFd(), POLLIN, 0};
+  ASSERT_EQ(1, poll(&pfd, 1, 1000));
+  ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+  ASSERT_EQ(1u, batch.GetCount());
+  EXPECT_EQ('q', batch.GetPacket(0).mData[0]);
+  EXPECT_EQ(lo, batch.GetPacket(0).mIfIndex);
+}
+
+TEST(MNetTest, FlushBatchesIntoFewSyscalls) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+  MNetSendQueue queue;
+  const std::size_t kCount = MNet::kFlushBatch + 8;
+
+  if (!net.CreateSocket(errmsg) || !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No loopback multicast";
+  }
+  const unsigned lo = if_nametoindex("lo");
+  for (std::size_t i = 0; i < kCount; i++) {
+    ASSERT_TRUE(queue.Push(MakeDatagram(pool, lo, 'a' + i % 26)));
+  }
+  std::size_t sent;
+  ASSERT_EQ(NET_OK, net.Flush(queue, sent));
+  EXPECT_EQ(kCount, sent);
+  EXPECT_EQ(0u, queue.GetPending());
+  EXPECT_EQ(kCount, queue.GetSent());
+  EXPECT_EQ(2u, queue.GetSendCalls());
+  EXPECT_EQ(0u, queue.GetSendErrors());
+  EXPECT_DOUBLE_EQ(kCount / 2.0, queue.GetPacketsPerCall());
+
+  std::string received;
+  while (received.size() < kCount) {
+    struct pollfd pfd{net.GetFd(), POLLIN, 0};
+    if (poll(&pfd, 1, 1000) != 1) {
+      break;
+    }
+    ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+    for (const MNetBatch::Packet& p : batch) {
+      received.append(p.mData, p.mLength);
+    }
+  }
+  ASSERT_EQ(kCount, received.size());
+  EXPECT_EQ('a', received[0]);
+  EXPECT_EQ('a' + (kCount - 1) % 26, received.back());
+}
+
+TEST(MNetSendQueueTest, RequeueRestoresOrder) {
+  BufferPool pool;
+  MNetSendQueue queue;
+  MNetSendQueue::Datagram out[4];
+
+  for (char c : std::string("abc")) {
+    queue.Push(MakeDatagram(pool, 1, c));
+  }
+  queue.Push(MakeDatagram(pool, 2, 'x'));
+  ASSERT_EQ(4u, queue.Pop(out, 4));
+  // The first one went out, the socket buffer took no more
+  queue.Requeue(out + 1, 3);
+  EXPECT_EQ(2u, queue.GetPending(1));
+  EXPECT_EQ(1u, queue.GetPending(2));
+
+  std::string order;
+  const std::size_t n = queue.Pop(out, 4);
+  for (std::size_t i = 0; i < n; i++) {
+    order.push_back(out[i].mBuffer.GetData()[0]);
+  }
+  EXPECT_EQ(3u, order.size());
+  EXPECT_LT(order.find('b'), order.find('c'));
+}
+
+// Send a bare header with these flags to the group, one byte of id
+static void SendHeader(const MNet& net, char id, std::uint16_t flags)
+{
+  const struct sockaddr_in dst = MdnsGroup();
+  char header[12] = {};
+  header[1] = id;
+  header[2] = flags >> 8;
+  header[3] = flags & 0xff;
+  ASSERT_EQ(12, sendto(net.GetFd(), header, sizeof(header), 0,
+                       reinterpret_cast<const struct sockaddr*>(&dst),
+                       sizeof(dst)));
+}
+
+// The ids of the datagrams that got through, waiting for the last one
+static std::string ReceivedIds(MNet& net, MNetBatch& batch, char last)
+{
+  std::string ids;
+  while (ids.empty() || ids.back() != last) {
+    struct pollfd pfd{net.GetFd(), POLLIN, 0};
+    if (poll(&pfd, 1, 1000) != 1 || net.ReadBatch(batch) != NET_OK) {
+      break;
+    }
+    for (const MNetBatch::Packet& p : batch) {
+      ids.push_back(p.mData[1]);
+    }
+  }
+  return ids;
+}
+
+TEST(MNetTest, SocketFilterKeepsTheRolesMessages) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+  MdnsSocketFilter filter;
+
+  if (!net.CreateSocket(errmsg) || !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No loopback multicast";
+  }
+  filter.mRole = MdnsSocketFilter::ROLE_RESPONDER;
+  ASSERT_TRUE(net.SetFilter(filter, errmsg)) << errmsg;
+  SendHeader(net, 'r', 0x8400);
+  SendHeader(net, 'o', 0x2800);
+  SendHeader(net, 'c', 0x0003);
+  SendHeader(net, 'q', 0x0000);
+  EXPECT_EQ("q", ReceivedIds(net, batch, 'q'));
+
+  // A role change replaces the program in place
+  filter.mRole = MdnsSocketFilter::ROLE_QUERIER;
+  ASSERT_TRUE(net.SetFilter(filter, errmsg)) << errmsg;
+  SendHeader(net, 'q', 0x0000);
+  SendHeader(net, 'r', 0x8400);
+  EXPECT_EQ("r", ReceivedIds(net, batch, 'r'));
+
+  filter.mRole = MdnsSocketFilter::ROLE_ANY;
+  filter.mStandardOnly = false;
+  ASSERT_TRUE(net.SetFilter(filter, errmsg)) << errmsg;
+  SendHeader(net, 'o', 0x2800);
+  SendHeader(net, 'q', 0x0000);
+  SendHeader(net, 'r', 0x8400);
+  EXPECT_EQ("oqr", ReceivedIds(net, batch, 'r'));
+}
+
+TEST(MNetTest, Ipv6SharesThePipeline) {
+  std::string errmsg;
+  MNet net(AF_INET6);
+  BufferPool pool;
+  MNetBatch batch(pool);
+
+  // Loopback has no IPv6 multicast, the datagram loops back from the
+  // first real interface instead
+  if (!net.CreateSocket(errmsg) || !net.AddMulticastMembership(errmsg)) {
+    GTEST_SKIP() << "No IPv6 multicast: " << errmsg;
+  }
+  ASSERT_FALSE(net.GetInterfaces().empty());
+  const MNetInterface& iface = net.GetInterfaces()[0];
+  EXPECT_EQ(AF_INET6, iface.mAddr.ss_family);
+
+  MNetSendQueue::Datagram d;
+  struct sockaddr_in6 dst;
+  memset(&dst, 0, sizeof(dst));
+  dst.sin6_family = AF_INET6;
+  dst.sin6_port = htons(5353);
+  inet_pton(AF_INET6, "ff02::fb", &dst.sin6_addr);
+  memcpy(&d.mDst, &dst, sizeof(dst));
+  d.mDstLen = sizeof(dst);
+  d.mIfIndex = iface.mIndex;
+  d.mBuffer = pool.Acquire(BufferPool::CLASS_SMALL);
+  memcpy(d.mBuffer.GetData(), "six", 3);
+  d.mBuffer.SetLength(3);
+  ASSERT_EQ(NET_OK, net.Send(d));
+
+  struct pollfd pfd{net.GetFd(), POLLIN, 0};
+  ASSERT_EQ(1, poll(&pfd, 1, 1000));
+  ASSERT_EQ(NET_OK, net.ReadBatch(batch));
+  ASSERT_EQ(1u, batch.GetCount());
+  const MNetPacket& p = batch.GetPacket(0);
+  EXPECT_EQ("six", std::string(p.mData, p.mLength));
+  EXPECT_EQ(AF_INET6, p.mSrcAddr.ss_family);
+  EXPECT_EQ(iface.mIndex, p.mIfIndex);
+}
+
+TEST(MNetUringTest, SendAndReceiveOverLoopback) {
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetBatch batch(pool);
+  MNetUring ring;
+
+  if (!MNetUring::IsSupported() || !net.CreateSocket(errmsg) ||
+      !LoopbackOnly(net)) {
+    GTEST_SKIP() << "No io_uring or no loopback multicast";
+  }
+  if (!ring.Open(net, pool, errmsg)) {
+    GTEST_SKIP() << errmsg;
+  }
+
+  const struct sockaddr_in dst = MdnsGroup();
+  const char* const payloads[] = {"a", "bc", "def"};
+  for (const char* payload : payloads) {
+    Buffer msg = pool.Acquire(BufferPool::CLASS_SMALL);
+    memcpy(msg.GetData(), payload, strlen(payload));
+    msg.SetLength(strlen(payload));
+    ASSERT_EQ(NET_OK,
+              ring.QueueSend(msg, reinterpret_cast<const sockaddr*>(&dst),
+                             sizeof(dst)));
+  }
+  const std::size_t calls = ring.GetEnterCalls();
+  ASSERT_EQ(NET_OK, ring.Submit());
+  EXPECT_EQ(calls + 1, ring.GetEnterCalls());
+
+  Buffer kept;
+  EXPECT_EQ("abcdef", ReapAll(ring, batch, 3, &kept));
+  ASSERT_FALSE(kept.IsEmpty());
+  const std::string kept_data(kept.GetData(), kept.GetLength());
+
+  // More datagrams than there are receive buffers, so the kernel runs
+  // out and the receive has to be posted again
+  const int sender = socket(AF_INET, SOCK_DGRAM, 0);
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  ASSERT_EQ(0, setsockopt(sender, IPPROTO_IP, IP_MULTICAST_IF, &lo,
+                          sizeof(lo)));
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    const char c = 'A' + i % 26;
+    expected += c;
+    ASSERT_EQ(1, sendto(sender, &c, 1, 0,
+                        reinterpret_cast<const sockaddr*>(&dst),
+                        sizeof(dst)));
+  }
+  close(sender);
+  EXPECT_EQ(expected, ReapAll(ring, batch, 100));
+  EXPECT_EQ(0u, ring.GetSendErrors());
+  // A buffer the caller held on to was not handed back to the kernel
+  EXPECT_EQ(kept_data, std::string(kept.GetData(), kept.GetLength()));
+}
+
+} // namespace testing
+} // namespace mnet
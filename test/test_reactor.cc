@@ -0,0 +1,145 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "reactor.h"
+
+namespace mnet {
+
+namespace testing {
+
+TEST(ReactorTest, TimersFireInDeadlineOrder) {
+  Reactor reactor;
+  std::string errmsg;
+  std::vector<int> fired;
+
+  ASSERT_TRUE(reactor.Open(errmsg)) << errmsg;
+  reactor.AddTimer(20, [&fired]() { fired.push_back(3); });
+  reactor.AddTimer(0, [&fired]() { fired.push_back(1); });
+  reactor.AddTimer(0, [&fired]() { fired.push_back(2); });
+  Reactor::TimerId cancelled =
+      reactor.AddTimer(10, [&fired]() { fired.push_back(0); });
+  EXPECT_EQ(4u, reactor.GetTimerCount());
+  EXPECT_TRUE(reactor.CancelTimer(cancelled));
+  EXPECT_FALSE(reactor.CancelTimer(cancelled));
+
+  // A handler may add another timer while timers are dispatched
+  reactor.AddTimer(30, [&reactor, &fired]() {
+    fired.push_back(4);
+    reactor.AddTimer(0, [&reactor]() { reactor.Stop(); });
+  });
+  ASSERT_TRUE(reactor.Run(errmsg)) << errmsg;
+  EXPECT_EQ((std::vector<int>{1, 2, 3, 4}), fired);
+  EXPECT_EQ(0u, reactor.GetTimerCount());
+  EXPECT_EQ(0, reactor.GetStopSignal());
+}
+
+TEST(ReactorTest, ReadyDescriptor) {
+  Reactor reactor;
+  std::string errmsg;
+  int fds[2];
+  char c = 0;
+  int calls = 0;
+
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_TRUE(reactor.Open(errmsg)) << errmsg;
+  ASSERT_TRUE(reactor.AddFd(fds[0], EPOLLIN,
+                            [&](std::uint32_t events) {
+                              EXPECT_TRUE(events & EPOLLIN);
+                              EXPECT_EQ(1, read(fds[0], &c, 1));
+                              calls++;
+                            },
+                            errmsg)) << errmsg;
+
+  // Nothing is ready, so this only waits out the timeout
+  ASSERT_TRUE(reactor.RunOnce(0, errmsg)) << errmsg;
+  EXPECT_EQ(0, calls);
+  ASSERT_EQ(1, write(fds[1], "x", 1));
+  ASSERT_TRUE(reactor.RunOnce(1000, errmsg)) << errmsg;
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ('x', c);
+  reactor.Close();
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(ReactorTest, FlushesSendQueueOncePerIteration) {
+  Reactor reactor;
+  std::string errmsg;
+  MNet net;
+  BufferPool pool;
+  MNetSendQueue queue;
+  struct sockaddr_in dst;
+  socklen_t dstlen = sizeof(dst);
+
+  if (!net.CreateSocket(errmsg)) {
+    GTEST_SKIP() << errmsg;
+  }
+  // A plain unicast receiver, as a QU or legacy querier would have
+  const int rx = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(rx, reinterpret_cast<struct sockaddr*>(&dst),
+                    sizeof(dst)));
+  ASSERT_EQ(0, getsockname(rx, reinterpret_cast<struct sockaddr*>(&dst),
+                           &dstlen));
+
+  ASSERT_TRUE(reactor.Open(errmsg)) << errmsg;
+  ASSERT_TRUE(reactor.AddSendQueue(net, queue, errmsg)) << errmsg;
+  // Three replies queued by one handler leave in one syscall
+  reactor.AddTimer(0, [&]() {
+    for (char c : std::string("xyz")) {
+      MNetSendQueue::Datagram d;
+      d.mBuffer = pool.Acquire(BufferPool::CLASS_SMALL);
+      d.mBuffer.GetData()[0] = c;
+      d.mBuffer.SetLength(1);
+      memcpy(&d.mDst, &dst, sizeof(dst));
+      d.mDstLen = sizeof(dst);
+      d.mIfIndex = 0;
+      queue.Push(std::move(d));
+    }
+  });
+  ASSERT_TRUE(reactor.RunOnce(1000, errmsg)) << errmsg;
+  EXPECT_EQ(0u, queue.GetPending());
+  EXPECT_EQ(3u, queue.GetSent());
+  EXPECT_EQ(1u, queue.GetSendCalls());
+
+  std::string received;
+  char c;
+  while (received.size() < 3 && recv(rx, &c, 1, 0) == 1) {
+    received.push_back(c);
+  }
+  EXPECT_EQ("xyz", received);
+  reactor.Close();
+  close(rx);
+}
+
+TEST(ReactorTest, ShutdownSignal) {
+  Reactor reactor;
+  std::string errmsg;
+  sigset_t mask;
+
+  ASSERT_TRUE(reactor.Open(errmsg)) << errmsg;
+  EXPECT_FALSE(reactor.Open(errmsg));
+  // Blocked, so the signal waits on the signalfd instead of killing us
+  ASSERT_EQ(0, raise(SIGTERM));
+  ASSERT_TRUE(reactor.Run(errmsg)) << errmsg;
+  EXPECT_TRUE(reactor.IsStopping());
+  EXPECT_EQ(SIGTERM, reactor.GetStopSignal());
+
+  reactor.Close();
+  ASSERT_EQ(0, pthread_sigmask(SIG_BLOCK, nullptr, &mask));
+  EXPECT_FALSE(sigismember(&mask, SIGTERM));
+  EXPECT_FALSE(sigismember(&mask, SIGINT));
+}
+
+} // namespace testing
+} // namespace mnet
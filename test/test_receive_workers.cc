@@ -0,0 +1,145 @@
+
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bpf_program.h"
+#include "gtest/gtest.h"
+#include "receive_workers.h"
+
+namespace mnet {
+
+namespace testing {
+
+static bool JoinLoopback(MNet& net, std::string& errmsg)
+{
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  const std::uint8_t loop = 1;
+  return net.AddMulticastMembership(if_nametoindex("lo"), errmsg) &&
+         setsockopt(net.GetFd(), IPPROTO_IP, IP_MULTICAST_IF, &lo,
+                    sizeof(lo)) == 0 &&
+         setsockopt(net.GetFd(), IPPROTO_IP, IP_MULTICAST_LOOP, &loop,
+                    sizeof(loop)) == 0;
+}
+
+// Send n query headers to the group over lo, from source 127.0.0.host
+static bool SendFrom(std::uint8_t host, int n)
+{
+  const char query[12] = {};
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in src;
+  struct sockaddr_in dst;
+  const struct in_addr lo{htonl(INADDR_LOOPBACK)};
+  bool ok = true;
+
+  memset(&src, 0, sizeof(src));
+  src.sin_family = AF_INET;
+  src.sin_addr.s_addr = htonl(0x7f000000 | host);
+  memset(&dst, 0, sizeof(dst));
+  dst.sin_family = AF_INET;
+  dst.sin_port = htons(5353);
+  dst.sin_addr.s_addr = htonl(0xe00000fb);
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&src), sizeof(src)) != 0 ||
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &lo, sizeof(lo)) != 0) {
+    close(fd);
+    return false;
+  }
+  for (int i = 0; i < n && ok; i++) {
+    ok = sendto(fd, query, sizeof(query), 0,
+                reinterpret_cast<struct sockaddr*>(&dst),
+                sizeof(dst)) == sizeof(query);
+  }
+  close(fd);
+  return ok;
+}
+
+TEST(BpfProgramTest, ProgramsEndInAReturn) {
+  const BpfProgram steer = ReuseportSteeringProgram(AF_INET, 4);
+  MdnsSocketFilter config;
+  config.mRole = MdnsSocketFilter::ROLE_RESPONDER;
+  const BpfProgram filter = MdnsFilterProgram(AF_INET6, config, 4, 2);
+
+  ASSERT_LT(0u, steer.GetLength());
+  EXPECT_EQ(BPF_RET | BPF_A, steer[steer.GetLength() - 1].code);
+  EXPECT_EQ(steer.GetLength(), steer.GetProg().len);
+
+  // The shard test, then accept or drop
+  ASSERT_LT(3u, filter.GetLength());
+  const std::size_t last = filter.GetLength() - 1;
+  EXPECT_EQ(BPF_JMP | BPF_JEQ | BPF_K, filter[last - 2].code);
+  EXPECT_EQ(2u, filter[last - 2].k);
+  EXPECT_EQ(0xffffffffu, filter[last - 1].k);
+  EXPECT_EQ(0u, filter[last].k);
+
+  // Every failed check jumps to the drop
+  for (std::size_t i = 0; i < last; i++) {
+    if (BPF_CLASS(filter[i].code) == BPF_JMP) {
+      const std::size_t jt = i + 1 + filter[i].jt;
+      const std::size_t jf = i + 1 + filter[i].jf;
+      EXPECT_TRUE(jt == last || jf == last) << i;
+      EXPECT_LE(jt, last);
+      EXPECT_LE(jf, last);
+    }
+  }
+}
+
+TEST(ReceiveWorkersTest, EachSourceReachesOneWorker) {
+  const std::size_t kWorkers = 2;
+  const int kPerSource = 20;
+  const std::uint8_t kSources = 8;
+  std::string errmsg;
+  ReceiveWorkers workers;
+  // Written by worker i only, read once the workers are joined
+  std::vector<std::map<std::string, int>> seen(kWorkers);
+
+  auto factory = [&seen](std::size_t i) -> Reactor::BatchHandler {
+    return [&seen, i](const MNetBatch& batch) {
+      for (const MNetBatch::Packet& p : batch) {
+        seen[i][FormatAddress(p.mSrcAddr, p.mSrcAddrLen)]++;
+      }
+    };
+  };
+  if (!workers.Start(AF_INET, kWorkers, true, factory, errmsg,
+                     JoinLoopback)) {
+    GTEST_SKIP() << "No reuseport loopback multicast: " << errmsg;
+  }
+  ASSERT_EQ(kWorkers, workers.GetCount());
+  for (std::uint8_t host = 1; host <= kSources; host++) {
+    ASSERT_TRUE(SendFrom(host, kPerSource));
+  }
+
+  const std::uint64_t expected = kSources * kPerSource;
+  for (int wait = 0; wait < 100; wait++) {
+    if (workers.GetPackets(0) + workers.GetPackets(1) >= expected) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(expected, workers.GetPackets(0) + workers.GetPackets(1));
+  workers.Stop();
+  EXPECT_EQ(0u, workers.GetCount());
+
+  // Nothing is delivered twice, and a source sticks to its worker
+  std::set<std::string> sources;
+  for (const std::map<std::string, int>& worker : seen) {
+    for (const std::pair<const std::string, int>& source : worker) {
+      EXPECT_EQ(kPerSource, source.second) << source.first;
+      EXPECT_TRUE(sources.insert(source.first).second) << source.first;
+    }
+  }
+  EXPECT_EQ(kSources, sources.size());
+  EXPECT_FALSE(seen[0].empty());
+  EXPECT_FALSE(seen[1].empty());
+}
+
+} // namespace testing
+} // namespace mnet
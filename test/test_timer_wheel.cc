@@ -0,0 +1,89 @@
+
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "timer_wheel.h"
+
+namespace timer_wheel {
+
+namespace testing {
+
+using Ids = std::vector<TimerWheel::Id>;
+
+TEST(TimerWheelTest, FiresInDeadlineOrder) {
+  TimerWheel wheel(1000);
+  Ids expired;
+
+  wheel.Schedule(3, 1000 + 3000);
+  wheel.Schedule(1, 1000 + 100);
+  wheel.Schedule(2, 1000 + 250);
+  EXPECT_EQ(3u, wheel.GetCount());
+  EXPECT_EQ(1100u, wheel.GetNextDeadline());
+
+  EXPECT_EQ(0u, wheel.Advance(1099, expired));
+  EXPECT_EQ(1u, wheel.Advance(1100, expired));
+  // Deadlines round up to a tick
+  EXPECT_EQ(1300u, wheel.GetNextDeadline());
+  EXPECT_EQ(1u, wheel.Advance(2000, expired));
+  EXPECT_EQ(1u, wheel.Advance(4000, expired));
+  EXPECT_EQ((Ids{1, 2, 3}), expired);
+  EXPECT_EQ(0u, wheel.GetCount());
+  EXPECT_EQ(0u, wheel.GetNextDeadline());
+}
+
+TEST(TimerWheelTest, RescheduleAndCancel) {
+  TimerWheel wheel(0);
+  Ids expired;
+
+  wheel.Schedule(7, 500);
+  wheel.Schedule(8, 500);
+  // Moving a timer does not count it twice
+  wheel.Schedule(7, 900);
+  EXPECT_EQ(2u, wheel.GetCount());
+  EXPECT_TRUE(wheel.Cancel(8));
+  EXPECT_FALSE(wheel.Cancel(8));
+  EXPECT_FALSE(wheel.Cancel(42));
+  EXPECT_FALSE(wheel.IsScheduled(8));
+
+  wheel.Advance(800, expired);
+  EXPECT_TRUE(expired.empty());
+  wheel.Advance(900, expired);
+  EXPECT_EQ((Ids{7}), expired);
+
+  // A deadline already past fires on the following tick
+  wheel.Schedule(9, 100);
+  wheel.Advance(1000, expired);
+  EXPECT_EQ((Ids{7, 9}), expired);
+}
+
+// Deadlines spread over every level, and past the top one, fire at their
+// own tick and not before
+TEST(TimerWheelTest, CascadesThroughEveryLevel) {
+  const std::uint64_t tick = 100;
+  const std::uint64_t start = 123456700;
+  TimerWheel wheel(start, tick);
+  std::vector<std::uint64_t> deadlines;
+  Ids expired;
+
+  for (TimerWheel::Id id = 0; id < 40; id++) {
+    // Up to 2^39 ticks, far past the 2^24 of the top level
+    const std::uint64_t ticks = (std::uint64_t(1) << id) + id;
+    deadlines.push_back(start + ticks * tick);
+    wheel.Schedule(id, deadlines.back());
+  }
+  for (TimerWheel::Id id = 0; id < 40; id++) {
+    const std::uint64_t next = wheel.GetNextDeadline();
+    ASSERT_LE(next, deadlines[id]) << id;
+    // Jump straight to just before the deadline, through every cascade
+    expired.clear();
+    wheel.Advance(deadlines[id] - 1, expired);
+    ASSERT_TRUE(expired.empty()) << id;
+    wheel.Advance(deadlines[id], expired);
+    ASSERT_EQ((Ids{id}), expired) << id;
+  }
+  EXPECT_EQ(0u, wheel.GetCount());
+}
+
+} // namespace testing
+} // namespace timer_wheel